@@ -0,0 +1,163 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "arena.h"
+
+#define ARENA_ALIGN 16
+#define ARENA_DEFAULT_CHUNK (1024 * 1024)
+#define ALIGN_UP(x) (((x) + (ARENA_ALIGN - 1)) & ~((size_t) ARENA_ALIGN - 1))
+
+struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size; /* usable bytes after the header */
+    size_t used;
+};
+
+struct arena {
+    struct arena_chunk *head; /* chunk allocations are served from, older chunks follow it */
+    struct arena_chunk *spare; /* chunks kept by arena_rewind(), used before new ones are allocated */
+    size_t chunk_size;
+    size_t bytes; /* total bytes of all chunks */
+};
+
+#define CHUNK_HEADER ALIGN_UP(sizeof(struct arena_chunk))
+
+static struct arena_chunk *chunk_new(size_t size) {
+    struct arena_chunk *chunk = malloc(CHUNK_HEADER + size);
+    if (!chunk) {
+        return NULL;
+    }
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+    return chunk;
+}
+
+/* arena_new returns an empty arena, chunk_size of zero means 1MB chunks */
+struct arena *arena_new(size_t chunk_size) {
+    struct arena *arena = malloc(sizeof(struct arena));
+    if (!arena) {
+        return NULL;
+    }
+    arena->head = NULL;
+    arena->spare = NULL;
+    arena->chunk_size = chunk_size ? ALIGN_UP(chunk_size) : ARENA_DEFAULT_CHUNK;
+    arena->bytes = 0;
+    return arena;
+}
+
+/* arena_alloc returns size zeroed bytes which stay valid until arena_free(),
+ * NULL is returned when the system is out of memory
+ * */
+void *arena_alloc(struct arena *arena, size_t size) {
+    struct arena_chunk *chunk = arena->head;
+    size = ALIGN_UP(size);
+    if (!chunk || chunk->size - chunk->used < size) {
+        if (arena->spare && size <= arena->spare->size) {
+            chunk = arena->spare;
+            arena->spare = chunk->next;
+            chunk->used = 0;
+        } else {
+            /* oversized requests get a chunk of their own */
+            chunk = chunk_new(size > arena->chunk_size ? size : arena->chunk_size);
+            if (!chunk) {
+                return NULL;
+            }
+            arena->bytes += CHUNK_HEADER + chunk->size;
+        }
+        chunk->next = arena->head;
+        arena->head = chunk;
+    }
+    void *ptr = (char *) chunk + CHUNK_HEADER + chunk->used;
+    chunk->used += size;
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+/* arena_adopt moves all memory of other into arena and frees other,
+ * so the allocations of both are released by one arena_free(arena)
+ * */
+void arena_adopt(struct arena *arena, struct arena *other) {
+    if (!other) {
+        return;
+    }
+    if (other->head) {
+        struct arena_chunk *tail = other->head;
+        while (tail->next) {
+            tail = tail->next;
+        }
+        /* keep serving from our own current chunk */
+        if (arena->head) {
+            tail->next = arena->head->next;
+            arena->head->next = other->head;
+        } else {
+            arena->head = other->head;
+        }
+    }
+    while (other->spare) {
+        struct arena_chunk *chunk = other->spare;
+        other->spare = chunk->next;
+        chunk->next = arena->spare;
+        arena->spare = chunk;
+    }
+    arena->bytes += other->bytes;
+    free(other);
+}
+
+/* arena_reset releases everything allocated from the arena at once,
+ * the current chunk is kept for the allocations that follow
+ * */
+void arena_reset(struct arena *arena) {
+    struct arena_chunk *chunk = arena->head;
+    if (!chunk) {
+        return;
+    }
+    for (struct arena_chunk *next, *old = chunk->next; old; old = next) {
+        next = old->next;
+        arena->bytes -= CHUNK_HEADER + old->size;
+        free(old);
+    }
+    chunk->next = NULL;
+    chunk->used = 0;
+}
+
+/* arena_rewind releases everything allocated from the arena at once, like arena_reset(),
+ * but chunks of the regular size are kept for the allocations that follow, so an arena
+ * filled again to the same size does not go to malloc()
+ * */
+void arena_rewind(struct arena *arena) {
+    struct arena_chunk *chunk = arena->head;
+    while (chunk) {
+        struct arena_chunk *next = chunk->next;
+        if (chunk->size == arena->chunk_size) {
+            chunk->next = arena->spare;
+            arena->spare = chunk;
+        } else {
+            arena->bytes -= CHUNK_HEADER + chunk->size;
+            free(chunk);
+        }
+        chunk = next;
+    }
+    arena->head = NULL;
+}
+
+/* arena_bytes returns how much memory the arena holds */
+size_t arena_bytes(struct arena *arena) {
+    return arena->bytes;
+}
+
+/* arena_free releases the arena with everything allocated from it */
+void arena_free(struct arena *arena) {
+    if (!arena) {
+        return;
+    }
+    for (int list = 0; list < 2; list++) {
+        struct arena_chunk *chunk = list ? arena->spare : arena->head;
+        while (chunk) {
+            struct arena_chunk *next = chunk->next;
+            free(chunk);
+            chunk = next;
+        }
+    }
+    free(arena);
+}
@@ -0,0 +1,23 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/* bump allocator: memory is handed out from big chunks and released all at once */
+struct arena;
+
+struct arena *arena_new(size_t chunk_size);
+
+void *arena_alloc(struct arena *arena, size_t size);
+
+void arena_adopt(struct arena *arena, struct arena *other);
+
+void arena_reset(struct arena *arena);
+
+void arena_rewind(struct arena *arena);
+
+size_t arena_bytes(struct arena *arena);
+
+void arena_free(struct arena *arena);
+
+#endif
@@ -0,0 +1,315 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include <time.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+/*
+ * topo_bench runs topo_parser on topology files and reports its throughput:
+ * lines/s and MB/s of the parse, peak RSS and the cost of one device.
+ * Every file is parsed -r times, the fastest run is reported.
+ * With -c the files are also parsed with --incremental after a given share of
+ * their device blocks has changed, to compare that with parsing them whole.
+ */
+
+#define PROGNAME "topo_bench"
+#define MAX_PARSER_ARGS 32
+#define BILLION  1000000000L
+
+/* what a topology file holds */
+struct input_stats {
+    long int bytes;
+    long int lines;
+    long int devices;
+};
+
+/* one run of the parser */
+struct run_stats {
+    double wall; /* seconds, whole process */
+    double parse; /* seconds, as reported by the parser, < 0 if it did not report */
+    long int maxrss_kb;
+};
+
+void print_usage() {
+    printf("Usage:\n\t%s [-p <parser>] [-r <runs>] [-a \"<parser options>\"] [-c <percent>] <topology file>...\n"
+           "\t-p -- parser binary, ./topo_parser by default\n"
+           "\t-r -- runs per file, the fastest one is reported, 3 by default\n"
+           "\t-a -- extra options for the parser, e.g. \"--mmap\" or \"-j 4\"\n"
+           "\t-c -- also time --incremental on a copy of each file with <percent> of its device blocks changed\n",
+           PROGNAME);
+    exit(EXIT_SUCCESS);
+}
+
+void die(const char *msg) {
+    fprintf(stderr, "%s", msg);
+    exit(EXIT_FAILURE);
+}
+
+/* counting lines and device blocks of the file */
+bool scan_input(const char *file_name, struct input_stats *in) {
+    struct stat st;
+    int fd = open(file_name, O_RDONLY);
+    memset(in, 0, sizeof(*in));
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        if (fd != -1) {
+            close(fd);
+        }
+        return false;
+    }
+    in->bytes = st.st_size;
+    if (st.st_size == 0) {
+        close(fd);
+        return true;
+    }
+    const char *base = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return false;
+    }
+    const char *p = base, *eof = base + st.st_size;
+    while (p < eof) {
+        const char *nl = memchr(p, '\n', (size_t) (eof - p));
+        if (eof - p >= 6 && !memcmp(p, "vendid", 6)) {
+            in->devices++;
+        }
+        in->lines++;
+        p = nl ? nl + 1 : eof;
+    }
+    munmap((void *) base, (size_t) st.st_size);
+    return true;
+}
+
+/* copy of the file with the description of every step-th device changed, so the block no longer matches
+ * the snapshot of the file, the number of changed blocks is returned, -1 if the copy could not be written
+ * */
+long int write_changed_copy(const char *file_name, const char *copy_name, long int step) {
+    struct stat st;
+    long int block = -1, changed = 0;
+    int fd = open(file_name, O_RDONLY);
+    if (fd == -1 || fstat(fd, &st) == -1 || st.st_size == 0) {
+        if (fd != -1) {
+            close(fd);
+        }
+        return -1;
+    }
+    const char *base = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return -1;
+    }
+    FILE *out = fopen(copy_name, "w");
+    if (!out) {
+        munmap((void *) base, (size_t) st.st_size);
+        return -1;
+    }
+    const char *p = base, *eof = base + st.st_size;
+    bool ok = true;
+    while (p < eof && ok) {
+        const char *nl = memchr(p, '\n', (size_t) (eof - p));
+        const char *next = nl ? nl + 1 : eof;
+        const char *desc = NULL;
+        if (eof - p >= 6 && !memcmp(p, "vendid", 6)) {
+            block++;
+        }
+        if (block >= 0 && block % step == 0 &&
+            ((eof - p >= 6 && !memcmp(p, "Switch", 6)) || (eof - p >= 2 && !memcmp(p, "Ca", 2)))) {
+            desc = memmem(p, (size_t) (next - p), "# \"", 3);
+        }
+        if (desc) {
+            desc += 3;
+            ok = fwrite(p, 1, (size_t) (desc - p), out) == (size_t) (desc - p) && fputc('~', out) != EOF &&
+                 fwrite(desc, 1, (size_t) (next - desc), out) == (size_t) (next - desc);
+            changed++;
+        } else {
+            ok = fwrite(p, 1, (size_t) (next - p), out) == (size_t) (next - p);
+        }
+        p = next;
+    }
+    if (fclose(out) != 0) {
+        ok = false;
+    }
+    munmap((void *) base, (size_t) st.st_size);
+    return ok ? changed : -1;
+}
+
+/* running the parser on the file in a scratch directory, so its dumps do not replace the real ones */
+bool run_parser(const char *parser, char **extra, int nextra, const char *file_name, const char *workdir,
+                struct run_stats *run) {
+    struct timespec t0, t1;
+    struct rusage usage;
+    int pipefd[2], status;
+    char *argv[MAX_PARSER_ARGS + 4];
+    int argc = 0;
+
+    argv[argc++] = (char *) parser;
+    for (int i = 0; i < nextra; i++) {
+        argv[argc++] = extra[i];
+    }
+    argv[argc++] = "-f";
+    argv[argc++] = (char *) file_name;
+    argv[argc] = NULL;
+    if (pipe(pipefd) == -1) {
+        return false;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    pid_t pid = fork();
+    if (pid == -1) {
+        return false;
+    }
+    if (pid == 0) {
+        dup2(pipefd[1], STDOUT_FILENO);
+        close(pipefd[0]);
+        close(pipefd[1]);
+        if (chdir(workdir) == -1) {
+            _exit(127);
+        }
+        execv(parser, argv);
+        _exit(127);
+    }
+    close(pipefd[1]);
+    /* the output is small, the time the parser reports is in its last lines */
+    char out[8192];
+    size_t used = 0;
+    ssize_t n;
+    while ((n = read(pipefd[0], out + used, sizeof(out) - 1 - used)) > 0) {
+        used += (size_t) n;
+        if (used == sizeof(out) - 1) {
+            memmove(out, out + used / 2, used - used / 2);
+            used -= used / 2;
+        }
+    }
+    out[used] = '\0';
+    close(pipefd[0]);
+    if (wait4(pid, &status, 0, &usage) == -1) {
+        return false;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        return false;
+    }
+    run->wall = (double) (t1.tv_sec - t0.tv_sec) + (double) (t1.tv_nsec - t0.tv_nsec) / (double) BILLION;
+    run->maxrss_kb = usage.ru_maxrss;
+    run->parse = -1;
+    const char *took = strstr(out, "Topology analysis took ");
+    if (took) {
+        run->parse = strtod(took + strlen("Topology analysis took "), NULL);
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    int opt, runs = 3, nextra = 0;
+    double percent = 0;
+    const char *parser = "./topo_parser";
+    char *extra[MAX_PARSER_ARGS + 1];
+    char parser_path[PATH_MAX], workdir[] = "/tmp/topo_bench.XXXXXX", copy_path[PATH_MAX];
+
+    while ((opt = getopt(argc, argv, "hp:r:a:c:")) != -1) {
+        switch (opt) {
+            case 'p' :
+                parser = optarg;
+                break;
+            case 'r' :
+                runs = atoi(optarg);
+                break;
+            case 'a' :
+                for (char *tok = strtok(optarg, " "); tok; tok = strtok(NULL, " ")) {
+                    if (nextra == MAX_PARSER_ARGS) {
+                        die("Too many parser options\n");
+                    }
+                    extra[nextra++] = tok;
+                }
+                break;
+            case 'c' :
+                percent = atof(optarg);
+                break;
+            default:
+                print_usage();
+                break;
+        }
+    }
+    if (optind >= argc || runs < 1 || percent < 0 || percent > 100) {
+        print_usage();
+    }
+    if (!realpath(parser, parser_path)) {
+        die("Parser binary not found\n");
+    }
+    if (!mkdtemp(workdir)) {
+        die("Could not create scratch directory\n");
+    }
+    snprintf(copy_path, sizeof(copy_path), "%s/changed.topo", workdir);
+    printf("%-28s %9s %10s %8s %9s %9s %12s %8s %8s %8s %8s\n", "file", "devices", "lines", "MB", "parse s",
+           "total s", "lines/s", "MB/s", "RSS MB", "us/dev", "KB/dev");
+    for (int i = optind; i < argc; i++) {
+        struct input_stats in;
+        struct run_stats best = {0, 0, 0}, run;
+        char file_path[PATH_MAX];
+        const char *name = strrchr(argv[i], '/') ? strrchr(argv[i], '/') + 1 : argv[i];
+        if (!realpath(argv[i], file_path) || !scan_input(file_path, &in)) {
+            printf("%-28s could not read the file\n", name);
+            continue;
+        }
+        bool ok = true;
+        for (int r = 0; r < runs && ok; r++) {
+            ok = run_parser(parser_path, extra, nextra, file_path, workdir, &run);
+            if (ok && (r == 0 || run.wall < best.wall)) {
+                best = run;
+            }
+        }
+        if (!ok) {
+            printf("%-28s parser failed\n", name);
+            continue;
+        }
+        /* the parse alone if the parser told it, otherwise the whole run */
+        double t = (best.parse > 0) ? best.parse : best.wall;
+        double mb = (double) in.bytes / (1024.0 * 1024.0);
+        long int devices = in.devices ? in.devices : 1;
+        printf("%-28s %9ld %10ld %8.1f %9.3f %9.3f %12.0f %8.1f %8.1f %8.3f %8.2f\n", name, in.devices, in.lines, mb,
+               t, best.wall, (double) in.lines / t, mb / t, (double) best.maxrss_kb / 1024.0,
+               t * 1e6 / (double) devices, (double) best.maxrss_kb / (double) devices);
+        if (percent == 0) {
+            continue;
+        }
+        /* every run starts from the snapshot of the whole file and parses the changed copy incrementally */
+        long int step = (long int) (100.0 / percent + 0.5);
+        long int changed = write_changed_copy(file_path, copy_path, step > 0 ? step : 1);
+        struct run_stats incr = {0, 0, 0};
+        ok = changed >= 0;
+        extra[nextra] = "--incremental";
+        for (int r = 0; r < runs && ok; r++) {
+            ok = run_parser(parser_path, extra, nextra, file_path, workdir, &run) &&
+                 run_parser(parser_path, extra, nextra + 1, copy_path, workdir, &run);
+            if (ok && (r == 0 || run.wall < incr.wall)) {
+                incr = run;
+            }
+        }
+        if (!ok) {
+            printf("%-28s incremental parse failed\n", name);
+            continue;
+        }
+        double ti = (incr.parse > 0) ? incr.parse : incr.wall;
+        printf("%-28s %ld of %ld device blocks changed, --incremental parse %.3f s, total %.3f s, "
+               "%.1f%% of the whole parse\n", name, changed, in.devices, ti, incr.wall, ti * 100.0 / t);
+    }
+    /* dropping the dumps of the parser */
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/topology.last", workdir);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/topology.snap", workdir);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/topology.guids", workdir);
+    unlink(path);
+    unlink(copy_path);
+    rmdir(workdir);
+    return 0;
+}
@@ -0,0 +1,405 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include <time.h>
+#include <pthread.h>
+#include "hash.h"
+
+/*
+ * hash_bench runs the sharded GUID table from 1 to -t threads. Every thread sets
+ * its part of -n GUIDs, then looks all of them up, and the set and get rates
+ * are reported with the speedup over one thread. One shard is a table behind a
+ * single lock, which is what the shards are measured against.
+ * The frozen table is then scanned by 1 to -t workers with
+ * hashmap_parallel_scan().
+ * With -s it checks the table under load instead: threads set, replace,
+ * insert-if-absent and get overlapping GUIDs at once, each writing values
+ * tagged with its id, and every value read back has to be one a thread wrote
+ * for that GUID. After the freeze every GUID has to be found by all threads
+ * reading without locks, with such a value, the one of the thread that won
+ * its insert where it was inserted if absent, and be seen exactly once by
+ * parallel scans and by iterating its parts.
+ */
+
+#define PROGNAME "hash_bench"
+#define BILLION  1000000000L
+#define VENDOR   UINT64_C(0xb8599f0300000000)
+
+/* the layout of the GUID table of the parser */
+struct guid {
+    uint64_t key;
+    uint32_t index;
+    char type;
+};
+
+struct worker {
+    pthread_t thread;
+    struct hashmap_sharded *sm;
+    struct hashmap *frozen;
+    unsigned int id;
+    unsigned int nthreads;
+    long int n;
+    long int errors;
+    long int inserted;
+    uint32_t *winners; /* value each GUID inserted if absent was inserted with, by the thread that did */
+};
+
+void print_usage() {
+    printf("Usage:\n\t%s [-n <guids>] [-t <threads>] [-S <shards>] [-s]\n"
+           "\t-n -- GUIDs set, 1000000 by default\n"
+           "\t-t -- most threads, they are doubled from 1 up to it, 32 by default\n"
+           "\t-S -- shards, 64 by default\n"
+           "\t-s -- check the table under load instead of timing it\n", PROGNAME);
+    exit(EXIT_SUCCESS);
+}
+
+void die(const char *msg) {
+    fprintf(stderr, "%s", msg);
+    exit(EXIT_FAILURE);
+}
+
+int guid_compare(const void *a, const void *b, void *udata) {
+    (void)udata;
+    const struct guid *ua = a;
+    const struct guid *ub = b;
+    if (ua->key != ub->key) {
+        return (ua->key < ub->key) ? -1 : 1;
+    }
+    return ua->type - ub->type;
+}
+
+uint64_t guid_hash(const void *item, uint64_t seed0, uint64_t seed1) {
+    const struct guid *g = item;
+    uint64_t h = g->key ^ seed0 ^ ((uint64_t) (unsigned char) g->type << 56);
+    (void)seed1;
+    h ^= h >> 33;
+    h *= UINT64_C(0xff51afd7ed558ccd);
+    h ^= h >> 33;
+    h *= UINT64_C(0xc4ceb9fe1a85ec53);
+    h ^= h >> 33;
+    return h;
+}
+
+/* GUIDs of one vendor, dense in their low bits as on a real fabric */
+struct guid make_guid(long int i) {
+    struct guid g = {.key = VENDOR + (uint64_t) i, .index = (uint32_t) i,
+                     .type = (i & 7) ? 'H' : 'S'};
+    return g;
+}
+
+double seconds_since(const struct timespec *t0) {
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (double) (t1.tv_sec - t0->tv_sec) + (double) (t1.tv_nsec - t0->tv_nsec) / (double) BILLION;
+}
+
+void run_workers(struct worker *w, unsigned int nthreads, void *(*fn)(void *)) {
+    for (unsigned int t = 0; t < nthreads; t++) {
+        if (pthread_create(&w[t].thread, NULL, fn, &w[t]) != 0) {
+            die("Could not start thread\n");
+        }
+    }
+    for (unsigned int t = 0; t < nthreads; t++) {
+        pthread_join(w[t].thread, NULL);
+    }
+}
+
+void *set_part(void *arg) {
+    struct worker *w = arg;
+    for (long int i = w->id; i < w->n; i += w->nthreads) {
+        struct guid g = make_guid(i);
+        hashmap_sharded_set(w->sm, &g, NULL);
+    }
+    return NULL;
+}
+
+void *get_part(void *arg) {
+    struct worker *w = arg;
+    struct guid found;
+    for (long int i = w->id; i < w->n; i += w->nthreads) {
+        struct guid g = make_guid(i);
+        if (!hashmap_sharded_get(w->sm, &g, &found) || found.index != g.index) {
+            w->errors++;
+        }
+    }
+    return NULL;
+}
+
+/* GUID i as thread id of nthreads writes it under load, its index tells which thread it was */
+struct guid tagged_guid(long int i, unsigned int id, unsigned int nthreads) {
+    struct guid g = make_guid(i);
+    g.index = (uint32_t) i * nthreads + id;
+    return g;
+}
+
+/* g is GUID i as one of nthreads threads wrote it, whole */
+bool written_for(const struct guid *g, long int i, unsigned int nthreads) {
+    struct guid want = make_guid(i);
+    return g->key == want.key && g->type == want.type && g->index / nthreads == (uint32_t) i;
+}
+
+/* every thread goes over all GUIDs: half of them are set, replaced by the others and read back,
+ * the other half is inserted if absent, so one thread wins each of them and the others find its value
+ * */
+void *stress_part(void *arg) {
+    struct worker *w = arg;
+    struct guid found;
+    for (long int k = 0; k < w->n; k++) {
+        long int i = (k + (long int) w->id * 7919) % w->n;
+        struct guid g = tagged_guid(i, w->id, w->nthreads);
+        if (i & 1) {
+            if (hashmap_sharded_set_if_absent(w->sm, &g, &found)) {
+                w->inserted++;
+                w->winners[i] = g.index;
+            } else if (!written_for(&found, i, w->nthreads) || found.index == g.index) {
+                w->errors++;
+            }
+        } else {
+            hashmap_sharded_set(w->sm, &g, NULL);
+            if (!hashmap_sharded_get(w->sm, &g, &found) || !written_for(&found, i, w->nthreads)) {
+                w->errors++;
+            }
+        }
+    }
+    return NULL;
+}
+
+void *read_frozen(void *arg) {
+    struct worker *w = arg;
+    for (long int i = 0; i < w->n; i++) {
+        struct guid g = make_guid(i);
+        const struct guid *found = hashmap_get(w->frozen, &g);
+        if (!found || !written_for(found, i, w->nthreads) || ((i & 1) && found->index != w->winners[i])) {
+            w->errors++;
+        }
+    }
+    return NULL;
+}
+
+/* what a scan worker has seen, GUIDs are summed by their offset from the first one */
+struct scan_sum {
+    long int count;
+    uint64_t guid_sum;
+};
+
+bool add_guid(const void *item, void *acc) {
+    struct scan_sum *sum = acc;
+    sum->count++;
+    sum->guid_sum += ((const struct guid *) item)->key - VENDOR;
+    return true;
+}
+
+void add_sum(void *acc, const void *other) {
+    struct scan_sum *sum = acc;
+    const struct scan_sum *o = other;
+    sum->count += o->count;
+    sum->guid_sum += o->guid_sum;
+}
+
+/* GUIDs seen by scanning the frozen table with nworkers, the total is in sums[0] */
+struct scan_sum scan_table(struct hashmap *frozen, unsigned int nworkers) {
+    struct scan_sum *sums = calloc(nworkers, sizeof(struct scan_sum));
+    if (!sums) {
+        die("Cannot allocate memory!\n");
+    }
+    hashmap_parallel_scan(frozen, nworkers, add_guid, sums, sizeof(struct scan_sum), add_sum);
+    struct scan_sum total = sums[0];
+    free(sums);
+    return total;
+}
+
+/* errors of scanning the frozen table of GUIDs 0 to n - 1, in parallel and part by part */
+long int check_scans(struct hashmap *frozen, long int n, unsigned int nthreads) {
+    long int errors = 0;
+    uint64_t guid_sum = (uint64_t) n * (uint64_t) (n - 1) / 2;
+    for (unsigned int t = 1; t <= nthreads; t++) {
+        struct scan_sum sum = scan_table(frozen, t);
+        if (sum.count != n || sum.guid_sum != guid_sum) {
+            printf("%u workers scanned %ld GUIDs, %ld expected\n", t, sum.count, n);
+            errors++;
+        }
+        struct scan_sum parts = {0, 0};
+        for (unsigned int part = 0; part < t * 3; part++) {
+            size_t iter = 0;
+            void *item;
+            while (hashmap_iter_range(frozen, part, t * 3, &iter, &item)) {
+                add_guid(item, &parts);
+            }
+        }
+        if (parts.count != n || parts.guid_sum != guid_sum) {
+            printf("%u parts held %ld GUIDs, %ld expected\n", t * 3, parts.count, n);
+            errors++;
+        }
+    }
+    return errors;
+}
+
+struct hashmap_sharded *new_table(unsigned int shards) {
+    struct hashmap_sharded *sm = hashmap_sharded_new(shards, sizeof(struct guid), 0, 0, 0, guid_hash, guid_compare,
+                                                     NULL, NULL);
+    if (!sm) {
+        die("Cannot allocate memory!\n");
+    }
+    return sm;
+}
+
+int stress(long int n, unsigned int nthreads, unsigned int shards) {
+    struct worker *w = calloc(nthreads, sizeof(struct worker));
+    uint32_t *winners = calloc((size_t) n, sizeof(uint32_t));
+    long int errors = 0, inserted = 0;
+    if (!w || !winners) {
+        die("Cannot allocate memory!\n");
+    }
+    /* the tagged values have to fit the index */
+    if ((uint64_t) n * nthreads > UINT32_MAX) {
+        die("Too many GUIDs for the threads\n");
+    }
+    struct hashmap_sharded *sm = new_table(shards);
+    for (unsigned int t = 0; t < nthreads; t++) {
+        w[t] = (struct worker) {.sm = sm, .id = t, .nthreads = nthreads, .n = n, .winners = winners};
+    }
+    run_workers(w, nthreads, stress_part);
+    for (unsigned int t = 0; t < nthreads; t++) {
+        errors += w[t].errors;
+        inserted += w[t].inserted;
+    }
+    if (inserted != n / 2) {
+        printf("%ld GUIDs inserted if absent, %ld expected\n", inserted, n / 2);
+        errors++;
+    }
+    if (hashmap_sharded_count(sm) != (size_t) n || hashmap_sharded_oom(sm)) {
+        printf("%zu GUIDs in the table, %ld expected\n", hashmap_sharded_count(sm), n);
+        errors++;
+    }
+    struct hashmap *frozen = hashmap_sharded_freeze(sm);
+    if (!frozen) {
+        die("Cannot allocate memory!\n");
+    }
+    for (unsigned int t = 0; t < nthreads; t++) {
+        w[t] = (struct worker) {.frozen = frozen, .id = t, .nthreads = nthreads, .n = n, .winners = winners};
+    }
+    run_workers(w, nthreads, read_frozen);
+    for (unsigned int t = 0; t < nthreads; t++) {
+        errors += w[t].errors;
+    }
+    if (hashmap_count(frozen) != (size_t) n) {
+        errors++;
+    }
+    errors += check_scans(frozen, n, nthreads);
+    printf("%s: %ld GUIDs, %u threads, %u shards, %ld errors\n", errors ? "FAIL" : "OK", n, nthreads, shards,
+           errors);
+    hashmap_free(frozen);
+    free(winners);
+    free(w);
+    return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* time of scanning n GUIDs of a frozen table with nworkers, in seconds */
+double timed_scan(long int n, unsigned int nworkers) {
+    struct hashmap_sharded *sm = new_table(1);
+    struct timespec t0;
+    for (long int i = 0; i < n; i++) {
+        struct guid g = make_guid(i);
+        hashmap_sharded_set(sm, &g, NULL);
+    }
+    struct hashmap *frozen = hashmap_sharded_freeze(sm);
+    if (!frozen) {
+        die("Cannot allocate memory!\n");
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    struct scan_sum sum = scan_table(frozen, nworkers);
+    double s = seconds_since(&t0);
+    if (sum.count != n) {
+        die("GUIDs went missing\n");
+    }
+    hashmap_free(frozen);
+    return s;
+}
+
+/* time of setting and then getting n GUIDs with nthreads threads, in seconds */
+void timed_run(long int n, unsigned int nthreads, unsigned int shards, double *set_s, double *get_s) {
+    struct worker *w = calloc(nthreads, sizeof(struct worker));
+    struct timespec t0;
+    if (!w) {
+        die("Cannot allocate memory!\n");
+    }
+    struct hashmap_sharded *sm = new_table(shards);
+    for (unsigned int t = 0; t < nthreads; t++) {
+        w[t] = (struct worker) {.sm = sm, .id = t, .nthreads = nthreads, .n = n};
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    run_workers(w, nthreads, set_part);
+    *set_s = seconds_since(&t0);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    run_workers(w, nthreads, get_part);
+    *get_s = seconds_since(&t0);
+    for (unsigned int t = 0; t < nthreads; t++) {
+        if (w[t].errors) {
+            die("GUIDs went missing\n");
+        }
+    }
+    hashmap_sharded_free(sm);
+    free(w);
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    long int n = 1000000;
+    unsigned int max_threads = 32, shards = 64;
+    bool check = false;
+
+    while ((opt = getopt(argc, argv, "hn:t:S:s")) != -1) {
+        switch (opt) {
+            case 'n' :
+                n = atol(optarg);
+                break;
+            case 't' :
+                max_threads = (unsigned int) atoi(optarg);
+                break;
+            case 'S' :
+                shards = (unsigned int) atoi(optarg);
+                break;
+            case 's' :
+                check = true;
+                break;
+            default:
+                print_usage();
+                break;
+        }
+    }
+    if (n < 1 || max_threads < 1 || shards < 1) {
+        print_usage();
+    }
+    if (check) {
+        return stress(n, max_threads, shards);
+    }
+    printf("%8s %8s %12s %8s %12s %8s\n", "threads", "shards", "set Mops/s", "speedup", "get Mops/s", "speedup");
+    unsigned int table_shards[2] = {1, shards};
+    for (int s = 0; s < 2; s++) {
+        double set_one = 0, get_one = 0;
+        for (unsigned int t = 1; t <= max_threads; t *= 2) {
+            double set_s, get_s;
+            timed_run(n, t, table_shards[s], &set_s, &get_s);
+            if (t == 1) {
+                set_one = set_s;
+                get_one = get_s;
+            }
+            printf("%8u %8u %12.2f %7.2fx %12.2f %7.2fx\n", t, table_shards[s], (double) n / set_s / 1e6,
+                   set_one / set_s, (double) n / get_s / 1e6, get_one / get_s);
+        }
+    }
+    printf("\n%8s %12s %8s\n", "workers", "scan Mops/s", "speedup");
+    double scan_one = 0;
+    for (unsigned int t = 1; t <= max_threads; t *= 2) {
+        double scan_s = timed_scan(n, t);
+        if (t == 1) {
+            scan_one = scan_s;
+        }
+        printf("%8u %12.2f %7.2fx\n", t, (double) n / scan_s / 1e6, scan_one / scan_s);
+    }
+    return 0;
+}
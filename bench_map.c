@@ -0,0 +1,266 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include <time.h>
+#include "hash.h"
+#include "hash_typed.h"
+
+/*
+ * map_bench times the GUID table of the layout it is built with: map_bench is the
+ * robin hood table, map_bench_swiss the Swiss table. For each size the table is
+ * filled with that many GUIDs, then -l lookups are timed for GUIDs that are there
+ * (hits) and for GUIDs of another vendor that are not (misses), in random order.
+ * The fastest of -r runs is reported. map_bench also times the same robin hood
+ * table generated by HASHMAP_DEFINE for the GUID key, as the parser uses it.
+ */
+
+#define PROGNAME "map_bench"
+#define BILLION  1000000000L
+#define MAX_SIZES 16
+
+#ifdef HASHMAP_SWISS
+#define LAYOUT "swiss"
+#else
+#define LAYOUT "robinhood"
+#endif
+
+/* the layout of the GUID table of the parser */
+struct guid {
+    uint64_t key;
+    uint32_t index;
+    char type;
+};
+
+/* key of the typed GUID table, the index is its value */
+struct guid_key {
+    uint64_t key;
+    char type;
+};
+
+/* best times of the runs of one table, in seconds */
+struct timing {
+    double set;
+    double hit;
+    double miss;
+};
+
+void print_usage() {
+    printf("Usage:\n\t%s [-l <lookups>] [-r <runs>] [<GUIDs>...]\n"
+           "\t-l -- lookups timed of each kind, 4000000 by default\n"
+           "\t-r -- runs, the fastest one is reported, 3 by default\n"
+           "\tGUIDs -- table sizes, 10000 100000 1000000 by default\n", PROGNAME);
+    exit(EXIT_SUCCESS);
+}
+
+void die(const char *msg) {
+    fprintf(stderr, "%s", msg);
+    exit(EXIT_FAILURE);
+}
+
+int guid_compare(const void *a, const void *b, void *udata) {
+    (void)udata;
+    const struct guid *ua = a;
+    const struct guid *ub = b;
+    if (ua->key != ub->key) {
+        return (ua->key < ub->key) ? -1 : 1;
+    }
+    return ua->type - ub->type;
+}
+
+uint64_t guid_hash(const void *item, uint64_t seed0, uint64_t seed1) {
+    const struct guid *g = item;
+    uint64_t h = g->key ^ seed0 ^ ((uint64_t) (unsigned char) g->type << 56);
+    (void)seed1;
+    h ^= h >> 33;
+    h *= UINT64_C(0xff51afd7ed558ccd);
+    h ^= h >> 33;
+    h *= UINT64_C(0xc4ceb9fe1a85ec53);
+    h ^= h >> 33;
+    return h;
+}
+
+static inline bool guid_key_equal(const struct guid_key *a, const struct guid_key *b) {
+    return a->key == b->key && a->type == b->type;
+}
+
+static inline uint64_t guid_key_hash(const struct guid_key *g) {
+    uint64_t h = g->key ^ ((uint64_t) (unsigned char) g->type << 56);
+    h ^= h >> 33;
+    h *= UINT64_C(0xff51afd7ed558ccd);
+    h ^= h >> 33;
+    h *= UINT64_C(0xc4ceb9fe1a85ec53);
+    h ^= h >> 33;
+    return h;
+}
+
+HASHMAP_DEFINE(guid_map, struct guid_key, uint32_t, guid_key_hash, guid_key_equal)
+
+/* GUIDs of one vendor are dense in their low bits as on a real fabric, misses are of another one */
+struct guid make_guid(uint64_t vendor, long int i) {
+    struct guid g = {.key = vendor + (uint64_t) i, .index = (uint32_t) i, .type = (i & 7) ? 'H' : 'S'};
+    return g;
+}
+
+double seconds_since(const struct timespec *t0) {
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (double) (t1.tv_sec - t0->tv_sec) + (double) (t1.tv_nsec - t0->tv_nsec) / (double) BILLION;
+}
+
+/* xorshift, the same order of lookups for both layouts */
+uint64_t next_random(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+/* time of the lookups, found counts the GUIDs that were there */
+double time_lookups(struct hashmap *map, long int n, long int lookups, uint64_t vendor, long int *found) {
+    struct timespec t0;
+    uint64_t state = UINT64_C(0x9e3779b97f4a7c15);
+    *found = 0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (long int k = 0; k < lookups; k++) {
+        struct guid g = make_guid(vendor, (long int) (next_random(&state) % (uint64_t) n));
+        if (hashmap_get(map, &g)) {
+            (*found)++;
+        }
+    }
+    return seconds_since(&t0);
+}
+
+#ifndef HASHMAP_SWISS
+double time_typed_lookups(struct guid_map *map, long int n, long int lookups, uint64_t vendor, long int *found) {
+    struct timespec t0;
+    uint64_t state = UINT64_C(0x9e3779b97f4a7c15);
+    *found = 0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (long int k = 0; k < lookups; k++) {
+        struct guid g = make_guid(vendor, (long int) (next_random(&state) % (uint64_t) n));
+        struct guid_key key = {g.key, g.type};
+        if (guid_map_get(map, &key)) {
+            (*found)++;
+        }
+    }
+    return seconds_since(&t0);
+}
+#endif
+
+void keep_best(struct timing *best, const struct timing *t, int run) {
+    if (run == 0 || t->set < best->set) {
+        best->set = t->set;
+    }
+    if (run == 0 || t->hit < best->hit) {
+        best->hit = t->hit;
+    }
+    if (run == 0 || t->miss < best->miss) {
+        best->miss = t->miss;
+    }
+}
+
+void print_row(const char *layout, long int n, long int lookups, const struct timing *best,
+               const struct hashmap_stats *hs) {
+    printf("%-10s %9ld %11.2f %11.2f %11.2f %9.3f %9.1f\n", layout, n, (double) n / best->set / 1e6,
+           (double) lookups / best->hit / 1e6, (double) lookups / best->miss / 1e6, hs->avg_probe,
+           (double) hs->memory / (double) n);
+}
+
+int main(int argc, char **argv) {
+    int opt, runs = 3, nsizes = 0;
+    long int lookups = 4000000, sizes[MAX_SIZES];
+    const uint64_t vendor = UINT64_C(0xb8599f0300000000), other = UINT64_C(0x0002c90300000000);
+
+    while ((opt = getopt(argc, argv, "hl:r:")) != -1) {
+        switch (opt) {
+            case 'l' :
+                lookups = atol(optarg);
+                break;
+            case 'r' :
+                runs = atoi(optarg);
+                break;
+            default:
+                print_usage();
+                break;
+        }
+    }
+    for (int i = optind; i < argc && nsizes < MAX_SIZES; i++) {
+        sizes[nsizes++] = atol(argv[i]);
+    }
+    if (nsizes == 0) {
+        sizes[nsizes++] = 10000;
+        sizes[nsizes++] = 100000;
+        sizes[nsizes++] = 1000000;
+    }
+    if (lookups < 1 || runs < 1) {
+        print_usage();
+    }
+    printf("%-10s %9s %11s %11s %11s %9s %9s\n", "layout", "GUIDs", "set Mops/s", "hit Mops/s", "miss Mops/s",
+           "avg probe", "bytes/GUID");
+    for (int s = 0; s < nsizes; s++) {
+        long int n = sizes[s], found;
+        struct timing best, t;
+        struct hashmap_stats hs;
+        if (n < 1) {
+            print_usage();
+        }
+        for (int r = 0; r < runs; r++) {
+            struct timespec t0;
+            struct hashmap *map = hashmap_new(sizeof(struct guid), 0, 0, 0, guid_hash, guid_compare, NULL, NULL);
+            if (!map) {
+                die("Cannot allocate memory!\n");
+            }
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+            for (long int i = 0; i < n; i++) {
+                struct guid g = make_guid(vendor, i);
+                hashmap_set(map, &g);
+            }
+            t.set = seconds_since(&t0);
+            t.hit = time_lookups(map, n, lookups, vendor, &found);
+            if (found != lookups) {
+                die("GUIDs went missing\n");
+            }
+            t.miss = time_lookups(map, n, lookups, other, &found);
+            if (found != 0) {
+                die("GUIDs were found that were never set\n");
+            }
+            keep_best(&best, &t, r);
+            hashmap_stats(map, &hs);
+            hashmap_free(map);
+        }
+        print_row(LAYOUT, n, lookups, &best, &hs);
+#ifndef HASHMAP_SWISS
+        for (int r = 0; r < runs; r++) {
+            struct timespec t0;
+            struct guid_map *map = guid_map_new(0);
+            if (!map) {
+                die("Cannot allocate memory!\n");
+            }
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+            for (long int i = 0; i < n; i++) {
+                struct guid g = make_guid(vendor, i);
+                struct guid_key key = {g.key, g.type};
+                guid_map_set(map, &key, &g.index);
+            }
+            t.set = seconds_since(&t0);
+            t.hit = time_typed_lookups(map, n, lookups, vendor, &found);
+            if (found != lookups) {
+                die("GUIDs went missing\n");
+            }
+            t.miss = time_typed_lookups(map, n, lookups, other, &found);
+            if (found != 0) {
+                die("GUIDs were found that were never set\n");
+            }
+            keep_best(&best, &t, r);
+            guid_map_stats(map, &hs);
+            guid_map_free(map);
+        }
+        print_row("typed", n, lookups, &best, &hs);
+#endif
+    }
+    return 0;
+}
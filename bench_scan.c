@@ -0,0 +1,158 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "scan.h"
+
+/*
+ * scan_bench reports how fast the structural characters of a topology file are found
+ * by each block scanner the CPU runs: whole 64 byte blocks, and line by line as the
+ * parser does it, every '#' and '"' of the line looked up. The byte by byte loop the
+ * tokenizers used before is the baseline of the lines. The fastest of -r runs is reported.
+ */
+
+#define PROGNAME "scan_bench"
+#define BILLION  1000000000L
+
+void print_usage() {
+    printf("Usage:\n\t%s [-r <runs>] <topology file>\n"
+           "\t-r -- runs per scanner, the fastest one is reported, 5 by default\n", PROGNAME);
+    exit(EXIT_SUCCESS);
+}
+
+void die(const char *msg) {
+    fprintf(stderr, "%s", msg);
+    exit(EXIT_FAILURE);
+}
+
+double seconds_since(const struct timespec *t0) {
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (double) (t1.tv_sec - t0->tv_sec) + (double) (t1.tv_nsec - t0->tv_nsec) / (double) BILLION;
+}
+
+/* every block of the file, the count of structural characters keeps the work from being dropped */
+long int scan_blocks(const char *base, size_t size) {
+    struct scan_masks m;
+    long int found = 0;
+    for (size_t off = 0; off + SCAN_BLOCK <= size; off += SCAN_BLOCK) {
+        scan_block(base + off, &m);
+        for (int k = 0; k < SCAN_KINDS; k++) {
+            found += __builtin_popcountll(m.bits[k]);
+        }
+    }
+    return found;
+}
+
+/* every line indexed and walked from one '#' or '"' to the next */
+long int scan_lines(const char *base, size_t size) {
+    static struct scan_line sl;
+    long int found = 0;
+    const char *p = base, *eof = base + size;
+    while (p < eof) {
+        const char *nl = memchr(p, '\n', (size_t) (eof - p));
+        size_t len = nl ? (size_t) (nl - p) : (size_t) (eof - p);
+        scan_line(&sl, p, len);
+        for (size_t i = scan_find(&sl, SCAN_BIT(SCAN_HASH) | SCAN_BIT(SCAN_QUOTE), 0); i < len;
+             i = scan_find(&sl, SCAN_BIT(SCAN_HASH) | SCAN_BIT(SCAN_QUOTE), i + 1)) {
+            found++;
+        }
+        p = nl ? nl + 1 : eof;
+    }
+    return found;
+}
+
+/* the same walk looking at every byte */
+long int scan_lines_bytewise(const char *base, size_t size) {
+    long int found = 0;
+    const char *p = base, *eof = base + size;
+    while (p < eof) {
+        const char *nl = memchr(p, '\n', (size_t) (eof - p));
+        size_t len = nl ? (size_t) (nl - p) : (size_t) (eof - p);
+        for (size_t i = 0; i < len; i++) {
+            found += (p[i] == '#' || p[i] == '"');
+        }
+        p = nl ? nl + 1 : eof;
+    }
+    return found;
+}
+
+/* fastest of runs, in seconds */
+double best_of(int runs, long int (*fn)(const char *, size_t), const char *base, size_t size, long int *found) {
+    double best = 0;
+    for (int r = 0; r < runs; r++) {
+        struct timespec t0;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        *found = fn(base, size);
+        double t = seconds_since(&t0);
+        if (r == 0 || t < best) {
+            best = t;
+        }
+    }
+    return best;
+}
+
+int main(int argc, char **argv) {
+    int opt, runs = 5;
+    struct stat st;
+
+    while ((opt = getopt(argc, argv, "hr:")) != -1) {
+        switch (opt) {
+            case 'r' :
+                runs = atoi(optarg);
+                break;
+            default:
+                print_usage();
+                break;
+        }
+    }
+    if (optind >= argc || runs < 1) {
+        print_usage();
+    }
+    int fd = open(argv[optind], O_RDONLY);
+    if (fd == -1 || fstat(fd, &st) == -1 || st.st_size == 0) {
+        die("Could not read the topology file\n");
+    }
+    size_t size = (size_t) st.st_size;
+    const char *base = mmap(NULL, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        die("Could not map the topology file\n");
+    }
+    double mb = (double) size / (1024.0 * 1024.0);
+    long int found, expected;
+    double bytewise = best_of(runs, scan_lines_bytewise, base, size, &expected);
+    double scalar_blocks = 0, scalar_lines = 0;
+
+    printf("%-10s %12s %8s %12s %8s %10s\n", "scanner", "blocks MB/s", "speedup", "lines MB/s", "speedup",
+           "vs bytes");
+    printf("%-10s %12s %8s %12.1f %8s %10s\n", "bytewise", "-", "-", mb / bytewise, "-", "1.00x");
+    for (SCAN_IMPL impl = SCAN_SCALAR; impl <= SCAN_AVX2; impl++) {
+        if (!scan_use(impl)) {
+            printf("%-10s not run by this CPU\n", scan_name(impl));
+            continue;
+        }
+        double blocks = best_of(runs, scan_blocks, base, size, &found);
+        double lines = best_of(runs, scan_lines, base, size, &found);
+        if (found != expected) {
+            die("Scanners disagree on the structural characters\n");
+        }
+        if (impl == SCAN_SCALAR) {
+            scalar_blocks = blocks;
+            scalar_lines = lines;
+        }
+        printf("%-10s %12.1f %7.2fx %12.1f %7.2fx %9.2fx\n", scan_name(impl), mb / blocks, scalar_blocks / blocks,
+               mb / lines, scalar_lines / lines, bytewise / lines);
+    }
+    printf("best on this CPU: %s\n", scan_name(scan_best()));
+    munmap((void *) base, size);
+    return 0;
+}
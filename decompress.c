@@ -0,0 +1,304 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#ifdef WITH_ZSTD
+#include <zstd.h>
+#endif
+#include "decompress.h"
+
+#define RING_BUFFERS 4 /* buffers decompressed ahead of the reader, the one it reads included */
+#define RING_BUFFER_SIZE (1024 * 1024)
+#define INPUT_CHUNK (256 * 1024) /* compressed bytes read at once */
+
+struct ring_buffer {
+    char *data;
+    size_t len;
+};
+
+struct decompress {
+    COMPRESS_TYPE type;
+    int fd;
+    long int size; /* of the compressed file */
+    long int consumed; /* compressed bytes read by the thread so far */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t filled; /* the reader waits for a buffer */
+    pthread_cond_t freed; /* the thread waits for room in the ring */
+    struct ring_buffer ring[RING_BUFFERS];
+    unsigned int head; /* buffers taken by the reader */
+    unsigned int tail; /* buffers filled by the thread */
+    bool held; /* the reader holds ring[head], it is given back by the next decompress_next() */
+    bool done; /* the thread has filled its last buffer */
+    bool stop; /* the reader has gone, the thread stops early */
+    bool failed; /* read error, corrupt or truncated input */
+    bool eof;
+    bool ended; /* the last frame of the input is complete */
+    char *in;
+    z_stream zs;
+#ifdef WITH_ZSTD
+    ZSTD_DStream *zds;
+    ZSTD_inBuffer zin;
+#endif
+};
+
+/* compression of the file by its magic number, whatever its name is */
+COMPRESS_TYPE compress_type(const char *file_name) {
+    unsigned char magic[4];
+    int fd = open(file_name, O_RDONLY);
+    if (fd == -1) {
+        return COMPRESS_NONE;
+    }
+    ssize_t n = read(fd, magic, sizeof(magic));
+    close(fd);
+    if (n >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) {
+        return COMPRESS_GZIP;
+    }
+    if (n == 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd) {
+        return COMPRESS_ZSTD;
+    }
+    return COMPRESS_NONE;
+}
+
+/* zstd input needs the parser built with WITH_ZSTD */
+bool compress_supported(COMPRESS_TYPE type) {
+#ifdef WITH_ZSTD
+    (void)type;
+    return true;
+#else
+    return type != COMPRESS_ZSTD;
+#endif
+}
+
+/* the next compressed chunk, false at the end of the file or on error */
+static bool read_input(struct decompress *d, size_t *len) {
+    ssize_t n;
+    do {
+        n = read(d->fd, d->in, INPUT_CHUNK);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) {
+        d->failed |= (n < 0);
+        d->eof = true;
+        return false;
+    }
+    __atomic_fetch_add(&d->consumed, (long int) n, __ATOMIC_RELAXED);
+    *len = (size_t) n;
+    return true;
+}
+
+/* gzip members one after another are one file, as gunzip has it */
+static size_t fill_gzip(struct decompress *d, char *out, size_t size) {
+    size_t len;
+    d->zs.next_out = (Bytef *) out;
+    d->zs.avail_out = (uInt) size;
+    while (d->zs.avail_out > 0 && !d->failed) {
+        if (d->zs.avail_in == 0) {
+            if (!read_input(d, &len)) {
+                break;
+            }
+            d->zs.next_in = (Bytef *) d->in;
+            d->zs.avail_in = (uInt) len;
+        }
+        int ret = inflate(&d->zs, Z_NO_FLUSH);
+        if (ret == Z_STREAM_END) {
+            d->ended = true;
+            inflateReset(&d->zs);
+        } else if (ret == Z_OK || ret == Z_BUF_ERROR) {
+            d->ended = false;
+        } else {
+            d->failed = true;
+        }
+    }
+    return size - d->zs.avail_out;
+}
+
+#ifdef WITH_ZSTD
+static size_t fill_zstd(struct decompress *d, char *out, size_t size) {
+    ZSTD_outBuffer zout = {out, size, 0};
+    size_t len;
+    while (zout.pos < zout.size && !d->failed) {
+        if (d->zin.pos == d->zin.size) {
+            if (!read_input(d, &len)) {
+                break;
+            }
+            d->zin.src = d->in;
+            d->zin.size = len;
+            d->zin.pos = 0;
+        }
+        size_t ret = ZSTD_decompressStream(d->zds, &zout, &d->zin);
+        if (ZSTD_isError(ret)) {
+            d->failed = true;
+        } else {
+            d->ended = (ret == 0);
+        }
+    }
+    return zout.pos;
+}
+#endif
+
+static void *decompress_thread(void *arg) {
+    struct decompress *d = arg;
+    bool last = false;
+    while (!last) {
+        pthread_mutex_lock(&d->lock);
+        while (d->tail - d->head >= RING_BUFFERS && !d->stop) {
+            pthread_cond_wait(&d->freed, &d->lock);
+        }
+        struct ring_buffer *buf = &d->ring[d->tail % RING_BUFFERS];
+        last = d->stop;
+        pthread_mutex_unlock(&d->lock);
+        if (last) {
+            break;
+        }
+        /* the buffer is not the reader's until tail moves past it */
+#ifdef WITH_ZSTD
+        if (d->type == COMPRESS_ZSTD) {
+            buf->len = fill_zstd(d, buf->data, RING_BUFFER_SIZE);
+        } else
+#endif
+        buf->len = fill_gzip(d, buf->data, RING_BUFFER_SIZE);
+        last = d->eof || d->failed;
+        pthread_mutex_lock(&d->lock);
+        if (buf->len > 0) {
+            d->tail++;
+        }
+        if (last) {
+            /* input that stops in the middle of a frame is truncated */
+            d->failed |= !d->ended;
+            d->done = true;
+        }
+        pthread_cond_signal(&d->filled);
+        pthread_mutex_unlock(&d->lock);
+    }
+    return NULL;
+}
+
+static void decompress_free(struct decompress *d) {
+    for (int i = 0; i < RING_BUFFERS; i++) {
+        free(d->ring[i].data);
+    }
+    free(d->in);
+    if (d->type == COMPRESS_GZIP) {
+        inflateEnd(&d->zs);
+    }
+#ifdef WITH_ZSTD
+    if (d->zds) {
+        ZSTD_freeDStream(d->zds);
+    }
+#endif
+    if (d->fd != -1) {
+        close(d->fd);
+    }
+    pthread_mutex_destroy(&d->lock);
+    pthread_cond_destroy(&d->filled);
+    pthread_cond_destroy(&d->freed);
+    free(d);
+}
+
+/* decompress_open starts decompressing the file, NULL if it cannot be read or the type
+ * is not supported by the build
+ * */
+struct decompress *decompress_open(const char *file_name, COMPRESS_TYPE type) {
+    struct stat st;
+    sigset_t all, saved;
+    bool ok = true;
+    if (type == COMPRESS_NONE || !compress_supported(type)) {
+        return NULL;
+    }
+    struct decompress *d = calloc(1, sizeof(struct decompress));
+    if (!d) {
+        return NULL;
+    }
+    d->type = type;
+    pthread_mutex_init(&d->lock, NULL);
+    pthread_cond_init(&d->filled, NULL);
+    pthread_cond_init(&d->freed, NULL);
+    d->fd = open(file_name, O_RDONLY);
+    d->in = malloc(INPUT_CHUNK);
+    for (int i = 0; i < RING_BUFFERS; i++) {
+        d->ring[i].data = malloc(RING_BUFFER_SIZE);
+        ok = ok && d->ring[i].data;
+    }
+    if (type == COMPRESS_GZIP) {
+        /* 15 + 32: the largest window, gzip or zlib header told by the data */
+        ok = ok && inflateInit2(&d->zs, 15 + 32) == Z_OK;
+        if (!ok) {
+            d->type = COMPRESS_NONE; /* nothing for inflateEnd() */
+        }
+    }
+#ifdef WITH_ZSTD
+    if (type == COMPRESS_ZSTD) {
+        d->zds = ZSTD_createDStream();
+        ok = ok && d->zds && !ZSTD_isError(ZSTD_initDStream(d->zds));
+    }
+#endif
+    if (!ok || d->fd == -1 || !d->in || fstat(d->fd, &st) == -1) {
+        decompress_free(d);
+        return NULL;
+    }
+    d->size = (long int) st.st_size;
+    posix_fadvise(d->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    /* signals are handled by the main thread only */
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &saved);
+    ok = (pthread_create(&d->thread, NULL, decompress_thread, d) == 0);
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+    if (!ok) {
+        decompress_free(d);
+        return NULL;
+    }
+    return d;
+}
+
+/* decompress_next gives the next buffer of decompressed data, it stays valid until the next call,
+ * false when the data ended
+ * */
+bool decompress_next(struct decompress *d, const char **data, size_t *len) {
+    pthread_mutex_lock(&d->lock);
+    if (d->held) {
+        d->head++;
+        d->held = false;
+        pthread_cond_signal(&d->freed);
+    }
+    while (d->head == d->tail && !d->done) {
+        pthread_cond_wait(&d->filled, &d->lock);
+    }
+    bool more = (d->head != d->tail);
+    if (more) {
+        *data = d->ring[d->head % RING_BUFFERS].data;
+        *len = d->ring[d->head % RING_BUFFERS].len;
+        d->held = true;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return more;
+}
+
+/* compressed bytes read so far, for progress */
+long int decompress_consumed(struct decompress *d) {
+    return __atomic_load_n(&d->consumed, __ATOMIC_RELAXED);
+}
+
+long int decompress_size(struct decompress *d) {
+    return d->size;
+}
+
+/* decompress_close stops the thread and frees everything,
+ * false if the input could not be read or was corrupt or truncated
+ * */
+bool decompress_close(struct decompress *d) {
+    pthread_mutex_lock(&d->lock);
+    d->stop = true;
+    pthread_cond_signal(&d->freed);
+    pthread_mutex_unlock(&d->lock);
+    pthread_join(d->thread, NULL);
+    bool ok = !d->failed;
+    decompress_free(d);
+    return ok;
+}
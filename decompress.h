@@ -0,0 +1,31 @@
+#ifndef DECOMPRESS_H
+#define DECOMPRESS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* compression of a topology file, told by its first bytes */
+typedef enum {
+    COMPRESS_NONE, COMPRESS_GZIP, COMPRESS_ZSTD
+} COMPRESS_TYPE;
+
+COMPRESS_TYPE compress_type(const char *file_name);
+
+bool compress_supported(COMPRESS_TYPE type);
+
+/* compressed file decompressed by a thread of its own into a ring of buffers,
+ * the reader takes the buffers in order while the next ones are being filled
+ * */
+struct decompress;
+
+struct decompress *decompress_open(const char *file_name, COMPRESS_TYPE type);
+
+bool decompress_next(struct decompress *d, const char **data, size_t *len);
+
+long int decompress_consumed(struct decompress *d);
+
+long int decompress_size(struct decompress *d);
+
+bool decompress_close(struct decompress *d);
+
+#endif
@@ -0,0 +1,102 @@
+#include <string.h>
+#include "digits.h"
+
+#if defined(__SSE2__) && defined(__x86_64__)
+#include <emmintrin.h>
+#define DIGITS_SSE2 1
+#endif
+
+/* hex16_decode reads exactly HEX_DIGITS hex digits at p, either case, false if one of them is not a digit */
+bool hex16_decode(const char *p, uint64_t *out) {
+#ifdef DIGITS_SSE2
+    /* x86-64 always has SSE2, the digits are checked and turned into nibbles all at once */
+    __m128i v = _mm_loadu_si128((const __m128i *) p);
+    __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+                                  _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+    __m128i letter = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                                   _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+    if (_mm_movemask_epi8(_mm_or_si128(digit, letter)) != 0xffff) {
+        return false;
+    }
+    __m128i nibbles = _mm_or_si128(_mm_and_si128(digit, _mm_sub_epi8(v, _mm_set1_epi8('0'))),
+                                   _mm_andnot_si128(digit, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10))));
+    /* each 16-bit lane holds two digits, the first one in its low byte: first << 4 | second */
+    __m128i bytes = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(nibbles, _mm_set1_epi16(0x00ff)), 4),
+                                 _mm_srli_epi16(nibbles, 8));
+    uint64_t packed = (uint64_t) _mm_cvtsi128_si64(_mm_packus_epi16(bytes, bytes));
+    /* the most significant byte came first */
+    *out = __builtin_bswap64(packed);
+    return true;
+#else
+    uint64_t val = 0;
+    for (int i = 0; i < HEX_DIGITS; i++) {
+        char c = p[i];
+        if (c >= '0' && c <= '9') {
+            val = val << 4 | (uint64_t) (c - '0');
+        } else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') {
+            val = val << 4 | (uint64_t) ((c | 0x20) - 'a' + 10);
+        } else {
+            return false;
+        }
+    }
+    *out = val;
+    return true;
+#endif
+}
+
+/* hex_decode reads a hex number of 1 to HEX_DIGITS digits, "0x" in front is allowed,
+ * false for anything else: no digits, a stray character or a number not fitting 64 bits
+ * */
+bool hex_decode(const char *p, size_t len, uint64_t *out) {
+    char lane[HEX_DIGITS];
+    if (len >= 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+        p += 2;
+        len -= 2;
+    }
+    if (len == 0 || len > HEX_DIGITS) {
+        return false;
+    }
+    if (len == HEX_DIGITS) {
+        return hex16_decode(p, out);
+    }
+    /* leading zeros do not change the number, shorter ones are decoded the same way */
+    memset(lane, '0', sizeof(lane));
+    memcpy(lane + HEX_DIGITS - len, p, len);
+    return hex16_decode(lane, out);
+}
+
+/* dec_decode reads a decimal number of 1 to 8 digits, ports, lids and lmcs,
+ * false for anything else so the caller can fall back to a slower parse
+ * */
+bool dec_decode(const char *p, size_t len, int *out) {
+    if (len == 0 || len > 8) {
+        return false;
+    }
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint64_t val;
+    /* the digits are right-aligned in 8 bytes of '0's and checked and summed 8 at a time */
+    char lane[8] = {'0', '0', '0', '0', '0', '0', '0', '0'};
+    memcpy(lane + 8 - len, p, len);
+    memcpy(&val, lane, sizeof(val));
+    val -= UINT64_C(0x3030303030303030);
+    if ((val | (val + UINT64_C(0x0606060606060606))) & UINT64_C(0xf0f0f0f0f0f0f0f0)) {
+        return false;
+    }
+    /* little-endian: the first digit is in the low byte, pairs, quads and then both halves are joined */
+    val = (val * 10) + (val >> 8);
+    val = (((val & UINT64_C(0x000000ff000000ff)) * (100 + (UINT64_C(1000000) << 32))) +
+           (((val >> 16) & UINT64_C(0x000000ff000000ff)) * (1 + (UINT64_C(10000) << 32)))) >> 32;
+    *out = (int) (uint32_t) val;
+#else
+    int val = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (p[i] < '0' || p[i] > '9') {
+            return false;
+        }
+        val = val * 10 + p[i] - '0';
+    }
+    *out = val;
+#endif
+    return true;
+}
@@ -0,0 +1,17 @@
+#ifndef DIGITS_H
+#define DIGITS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* hex digits of a 64-bit GUID */
+#define HEX_DIGITS 16
+
+bool hex16_decode(const char *p, uint64_t *out);
+
+bool hex_decode(const char *p, size_t len, uint64_t *out);
+
+bool dec_decode(const char *p, size_t len, int *out);
+
+#endif
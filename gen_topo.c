@@ -0,0 +1,394 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <getopt.h>
+
+/*
+ * gen_topo writes a synthetic fabric in ibnetdiscover format, the same format
+ * topo_parser reads, so parser throughput can be measured on inputs of any size.
+ *
+ * fattree:   hosts hang off leaf switches, radix/2 ports of a switch go down and
+ *            radix/2 go up, the top level uses all of its ports for the level below
+ * dragonfly: groups of switches connected all-to-all inside of the group, every
+ *            switch has p hosts, a - 1 local and h global links, a = 2p = 2h
+ */
+
+#define PROGNAME "gen_topo"
+#define MAX_SPEEDS 16
+#define MAX_LEVELS 8
+#define SWITCH_GUID_BASE UINT64_C(0x0002c90300000000)
+#define HOST_GUID_BASE   UINT64_C(0xec0d9a0300000000)
+
+typedef enum {
+    FATTREE, DRAGONFLY
+} TOPOLOGY_KIND;
+
+/* far end of a switch port, peer < 0 if the port is not connected */
+struct port {
+    int peer; /* switch index, or host index if to_host */
+    int peer_port;
+    int speed; /* index into speeds[] */
+    bool to_host;
+};
+
+/* link speed and its share of the links */
+struct speed {
+    char name[16];
+    unsigned int weight;
+};
+
+static struct speed speeds[MAX_SPEEDS];
+static unsigned int nspeeds = 0, speed_weights = 0;
+static int radix = 36;
+static int nswitches = 0;
+static long int nhosts = 0;
+static struct port *ports; /* radix + 1 entries per switch, port numbers start at 1 */
+static struct port *host_ports; /* the only port of every host */
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+void print_usage() {
+    printf("Usage:\n\t%s [-t fattree|dragonfly] [-r <radix>] [-n <hosts> | -N <devices>] [-l <levels>]\n"
+           "\t\t[-s <speed>:<weight>,...] [-S <seed>] [-o <file>]\n"
+           "\t-t -- topology kind, fattree by default\n"
+           "\t-r -- ports per switch, 36 by default\n"
+           "\t-n -- number of hosts, 1000 by default\n"
+           "\t-N -- number of devices (hosts and switches), the host count is derived from it\n"
+           "\t-l -- switch levels of a fat tree, 2 by default\n"
+           "\t-s -- link speeds with their weights, 4xHDR:4,4xEDR:2,4xFDR:1 by default\n"
+           "\t-S -- random seed\n"
+           "\t-o -- output file, stdout by default\n", PROGNAME);
+    exit(EXIT_SUCCESS);
+}
+
+void die(const char *msg) {
+    fprintf(stderr, "%s", msg);
+    exit(EXIT_FAILURE);
+}
+
+/* xorshift64*, so the same seed always gives the same fabric */
+uint64_t next_random() {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * UINT64_C(0x2545f4914f6cdd1d);
+}
+
+/* parsing "4xHDR:4,4xEDR:1", a speed without weight has weight 1 */
+void parse_speeds(const char *spec) {
+    char *copy = strdup(spec), *save = NULL;
+    if (!copy) {
+        die("Cannot allocate memory!\n");
+    }
+    nspeeds = speed_weights = 0;
+    for (char *tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        char *colon = strchr(tok, ':');
+        unsigned int weight = 1;
+        if (nspeeds == MAX_SPEEDS) {
+            die("Too many link speeds\n");
+        }
+        if (colon) {
+            *colon = '\0';
+            weight = (unsigned int) strtoul(colon + 1, NULL, 10);
+        }
+        if (*tok == '\0' || strlen(tok) >= sizeof(speeds[0].name)) {
+            die("Bad link speed\n");
+        }
+        snprintf(speeds[nspeeds].name, sizeof(speeds[nspeeds].name), "%s", tok);
+        speeds[nspeeds].weight = weight;
+        speed_weights += weight;
+        nspeeds++;
+    }
+    free(copy);
+    if (nspeeds == 0 || speed_weights == 0) {
+        die("No link speeds given\n");
+    }
+}
+
+int random_speed() {
+    unsigned int r = (unsigned int) (next_random() % speed_weights);
+    for (unsigned int i = 0; i < nspeeds; i++) {
+        if (r < speeds[i].weight) {
+            return (int) i;
+        }
+        r -= speeds[i].weight;
+    }
+    return 0;
+}
+
+struct port *switch_port(int sw, int port) {
+    return &ports[(size_t) sw * (size_t) (radix + 1) + (size_t) port];
+}
+
+/* first free port of switch sw at or after port from, 0 if there is none */
+int free_port(int sw, int from) {
+    for (int p = from; p <= radix; p++) {
+        if (switch_port(sw, p)->peer < 0) {
+            return p;
+        }
+    }
+    return 0;
+}
+
+void connect_switches(int a, int pa, int b, int pb) {
+    int speed = random_speed();
+    *switch_port(a, pa) = (struct port) {.peer = b, .peer_port = pb, .speed = speed, .to_host = false};
+    *switch_port(b, pb) = (struct port) {.peer = a, .peer_port = pa, .speed = speed, .to_host = false};
+}
+
+void connect_host(long int host, int sw, int port) {
+    int speed = random_speed();
+    *switch_port(sw, port) = (struct port) {.peer = (int) host, .peer_port = 1, .speed = speed, .to_host = true};
+    host_ports[host] = (struct port) {.peer = sw, .peer_port = port, .speed = speed, .to_host = false};
+}
+
+void alloc_fabric() {
+    ports = malloc((size_t) nswitches * (size_t) (radix + 1) * sizeof(struct port));
+    host_ports = calloc((size_t) nhosts, sizeof(struct port));
+    if (!ports || !host_ports) {
+        die("Cannot allocate memory!\n");
+    }
+    for (size_t i = 0; i < (size_t) nswitches * (size_t) (radix + 1); i++) {
+        ports[i].peer = -1;
+    }
+}
+
+/* switches per level of a fat tree with hosts at the bottom, level 0 are the leaves */
+int fattree_levels(long int hosts, int levels, int count[MAX_LEVELS]) {
+    int down = radix / 2, up = radix - down, total = 0;
+    long int below = (hosts + down - 1) / down;
+    for (int l = 0; l < levels; l++) {
+        count[l] = (int) (below > 0 ? below : 1);
+        total += count[l];
+        /* the uplinks of this level, spread over the next one */
+        below = ((long int) count[l] * up + ((l + 1 == levels - 1) ? radix : down) - 1) /
+                ((l + 1 == levels - 1) ? radix : down);
+    }
+    return total;
+}
+
+void build_fattree(int levels) {
+    int count[MAX_LEVELS], first[MAX_LEVELS];
+    int down = radix / 2, up = radix - down;
+    nswitches = fattree_levels(nhosts, levels, count);
+    alloc_fabric();
+    for (int l = 0, n = 0; l < levels; l++) {
+        first[l] = n;
+        n += count[l];
+    }
+    for (long int h = 0; h < nhosts; h++) {
+        connect_host(h, first[0] + (int) (h / down), (int) (h % down) + 1);
+    }
+    for (int l = 0; l + 1 < levels; l++) {
+        /* uplink j of every switch of the level goes to the next switch above, round robin,
+         * the upper switch takes the lowest free port
+         * */
+        long int link = 0;
+        for (int s = 0; s < count[l]; s++) {
+            for (int j = 0; j < up; j++, link++) {
+                int lower = first[l] + s, upper = first[l + 1] + (int) (link % count[l + 1]);
+                int pl = down + 1 + j, pu = free_port(upper, 1);
+                if (pu == 0) {
+                    continue;
+                }
+                connect_switches(lower, pl, upper, pu);
+            }
+        }
+    }
+}
+
+void build_dragonfly() {
+    int h = (radix + 1) / 4, p = h, a = 2 * h;
+    if (h < 1) {
+        die("Radix is too small for a dragonfly\n");
+    }
+    long int groups = (nhosts + (long int) a * p - 1) / ((long int) a * p);
+    if (groups < 1) {
+        groups = 1;
+    }
+    nswitches = (int) (groups * a);
+    alloc_fabric();
+    /* ports 1..p hosts, p+1..p+a-1 local links, p+a.. global links */
+    for (long int host = 0; host < nhosts; host++) {
+        connect_host(host, (int) (host / p), (int) (host % p) + 1);
+    }
+    for (long int g = 0; g < groups; g++) {
+        for (int i = 0; i < a; i++) {
+            for (int j = i + 1; j < a; j++) {
+                connect_switches((int) (g * a + i), p + j, (int) (g * a + j), p + 1 + i);
+            }
+        }
+    }
+    if (groups < 2) {
+        return;
+    }
+    /* global port k of group g goes to group g + 1 + k (mod groups), port groups - 2 - k of
+     * that group comes back, only rounds that every group can complete are wired
+     * */
+    long int global_ports = (long int) a * h, rounds = global_ports / (groups - 1);
+    for (long int g = 0; g < groups; g++) {
+        for (long int k = 0; k < rounds * (groups - 1); k++) {
+            long int round = k / (groups - 1), m = k % (groups - 1);
+            long int t = (g + 1 + m) % groups, back = round * (groups - 1) + (groups - 2 - m);
+            if (t < g) {
+                continue; /* wired from the other side */
+            }
+            connect_switches((int) (g * a + k / h), p + a + (int) (k % h),
+                             (int) (t * a + back / h), p + a + (int) (back % h));
+        }
+    }
+}
+
+uint64_t switch_guid(int sw) {
+    return SWITCH_GUID_BASE + (uint64_t) sw;
+}
+
+uint64_t host_guid(long int host) {
+    return HOST_GUID_BASE + (uint64_t) host * 2;
+}
+
+int switch_lid(int sw) {
+    return sw + 1;
+}
+
+int host_lid(long int host) {
+    return nswitches + (int) host + 1;
+}
+
+void write_switch(FILE *out, int sw) {
+    uint64_t guid = switch_guid(sw);
+    fprintf(out, "vendid=0x2c9\ndevid=0xd2f0\nsysimgguid=0x%" PRIx64 "\nswitchguid=0x%" PRIx64 "(%" PRIx64 ")\n",
+            guid, guid, guid);
+    fprintf(out, "Switch\t%d \"S-%016" PRIx64 "\"\t\t# \"MF0;sw-%d:MQM8700/U1\" enhanced port 0 lid %d lmc 0\n",
+            radix, guid, sw, switch_lid(sw));
+    for (int p = 1; p <= radix; p++) {
+        const struct port *port = switch_port(sw, p);
+        if (port->peer < 0) {
+            continue;
+        }
+        if (port->to_host) {
+            uint64_t peer = host_guid(port->peer);
+            fprintf(out, "[%d]\t\"H-%016" PRIx64 "\"[%d](%" PRIx64 ") \t\t# \"host-%d HCA-1\" lid %d %s\n",
+                    p, peer, port->peer_port, peer, port->peer, host_lid(port->peer), speeds[port->speed].name);
+        } else {
+            fprintf(out, "[%d]\t\"S-%016" PRIx64 "\"[%d]\t\t# \"MF0;sw-%d:MQM8700/U1\" lid %d %s\n",
+                    p, switch_guid(port->peer), port->peer_port, port->peer, switch_lid(port->peer),
+                    speeds[port->speed].name);
+        }
+    }
+    fprintf(out, "\n");
+}
+
+void write_host(FILE *out, long int host) {
+    uint64_t guid = host_guid(host);
+    const struct port *port = &host_ports[host];
+    fprintf(out, "vendid=0x2c9\ndevid=0x1017\nsysimgguid=0x%" PRIx64 "\ncaguid=0x%" PRIx64 "\n", guid, guid);
+    fprintf(out, "Ca\t1 \"H-%016" PRIx64 "\"\t\t# \"host-%ld HCA-1\"\n", guid, host);
+    fprintf(out, "[1](%" PRIx64 ") \t\"S-%016" PRIx64 "\"[%d]\t\t# lid %d lmc 0 \"MF0;sw-%d:MQM8700/U1\" lid %d %s\n\n",
+            guid, switch_guid(port->peer), port->peer_port, host_lid(host), port->peer, switch_lid(port->peer),
+            speeds[port->speed].name);
+}
+
+/* host count giving about the requested number of devices, switches included */
+long int hosts_for_devices(long int devices, TOPOLOGY_KIND kind, int levels) {
+    long int hosts = devices;
+    for (int i = 0; i < 8; i++) {
+        int count[MAX_LEVELS];
+        long int switches;
+        if (kind == FATTREE) {
+            switches = fattree_levels(hosts, levels, count);
+        } else {
+            int h = (radix + 1) / 4;
+            switches = (hosts + 2L * h * h - 1) / (2L * h * h) * 2 * h;
+        }
+        hosts = devices - switches;
+        if (hosts < 1) {
+            return 1;
+        }
+    }
+    return hosts;
+}
+
+int main(int argc, char **argv) {
+    int opt, levels = 2;
+    long int devices = 0;
+    TOPOLOGY_KIND kind = FATTREE;
+    const char *out_name = NULL;
+    FILE *out = stdout;
+
+    nhosts = 1000;
+    parse_speeds("4xHDR:4,4xEDR:2,4xFDR:1");
+    while ((opt = getopt(argc, argv, "ht:r:n:N:l:s:S:o:")) != -1) {
+        switch (opt) {
+            case 't' :
+                if (!strcmp(optarg, "fattree")) {
+                    kind = FATTREE;
+                } else if (!strcmp(optarg, "dragonfly")) {
+                    kind = DRAGONFLY;
+                } else {
+                    print_usage();
+                }
+                break;
+            case 'r' :
+                radix = atoi(optarg);
+                break;
+            case 'n' :
+                nhosts = atol(optarg);
+                break;
+            case 'N' :
+                devices = atol(optarg);
+                break;
+            case 'l' :
+                levels = atoi(optarg);
+                break;
+            case 's' :
+                parse_speeds(optarg);
+                break;
+            case 'S' :
+                rng_state = strtoull(optarg, NULL, 0) * UINT64_C(0x9e3779b97f4a7c15) | 1;
+                break;
+            case 'o' :
+                out_name = optarg;
+                break;
+            default:
+                print_usage();
+                break;
+        }
+    }
+    if (radix < 4 || radix > 255 || levels < 1 || levels > MAX_LEVELS) {
+        die("Radix must be 4..255 and levels 1..8\n");
+    }
+    if (devices > 0) {
+        nhosts = hosts_for_devices(devices, kind, levels);
+    }
+    if (nhosts < 1) {
+        die("Need at least one host\n");
+    }
+    if (kind == FATTREE) {
+        build_fattree(levels);
+    } else {
+        build_dragonfly();
+    }
+    if (out_name && !(out = fopen(out_name, "w"))) {
+        die("Could not open the file\n");
+    }
+    fprintf(out, "#\n# Topology file: generated by %s, %s, radix %d, %d switches, %ld hosts\n#\n"
+                 "# Initiated from node %016" PRIx64 " port %016" PRIx64 "\n\n",
+            PROGNAME, (kind == FATTREE) ? "fat tree" : "dragonfly", radix, nswitches, nhosts,
+            host_guid(0), host_guid(0));
+    for (int s = 0; s < nswitches; s++) {
+        write_switch(out, s);
+    }
+    for (long int h = 0; h < nhosts; h++) {
+        write_host(out, h);
+    }
+    if (out != stdout && fclose(out) != 0) {
+        die("Could not write the file\n");
+    }
+    free(ports);
+    free(host_ports);
+    return 0;
+}
@@ -3,6 +3,10 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stddef.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "hash.h"
 
 static void *(*_malloc)(size_t) = NULL;
@@ -24,6 +28,592 @@ void hashmap_set_allocator(void *(*malloc)(size_t), void (*free)(void *)) {
     exit(1); \
 }
 
+// A map written by hashmap_save() is this header followed by the table as it
+// is in memory. The table is only mapped back by a build of the same layout
+// and byte order.
+#define SAVED_MAGIC "hashmap"
+#define SAVED_VERSION 1
+#define SAVED_BYTE_ORDER UINT64_C(0x0102030405060708)
+
+struct saved_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t layout;     // SAVED_LAYOUT of the writer
+    uint64_t byte_order; // SAVED_BYTE_ORDER as the writer stored it
+    uint64_t elsize;
+    uint64_t bucketsz;
+    uint64_t nbuckets;
+    uint64_t count;
+    uint64_t seed0;
+    uint64_t seed1;
+};
+
+static bool write_all(int fd, const void *data, size_t len) {
+    const char *p = data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= (size_t) n;
+    }
+    return true;
+}
+
+#ifdef HASHMAP_SWISS
+
+// The Swiss table layout, built with -DHASHMAP_SWISS. Every slot has a
+// control byte apart from the items: 7 bits of the hash of its item, or a
+// mark of an empty or deleted slot. A lookup compares the tag with the
+// control bytes of a group of 16 slots at once and only looks at the slots
+// whose tag matches, groups are probed quadratically until one has an empty
+// slot. The first GROUP control bytes are repeated after the last one, so a
+// group may start at any slot.
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define GROUP 16
+#define CTRL_EMPTY ((uint8_t) 0x80)
+#define CTRL_DELETED ((uint8_t) 0xfe)
+
+struct slot {
+    uint64_t hash;
+};
+
+struct hashmap {
+    void *(*malloc)(size_t);
+
+    void *(*realloc)(void *, size_t);
+
+    void (*free)(void *);
+
+    bool oom;
+    size_t elsize;
+    size_t cap;
+    uint64_t seed0;
+    uint64_t seed1;
+
+    uint64_t (*hash)(const void *item, uint64_t seed0, uint64_t seed1);
+
+    int (*compare)(const void *a, const void *b, void *udata);
+
+    void (*elfree)(void *item);
+
+    void *udata;
+    size_t bucketsz; // a slot: the hash and the item
+    size_t nbuckets;
+    size_t count;
+    size_t deleted;  // slots of deleted items, taking room until a resize
+    size_t mask;
+    size_t growat;   // count + deleted that resizes the map
+    size_t shrinkat;
+    uint8_t *ctrl;   // nbuckets + GROUP control bytes
+    void *buckets;   // the slots
+    void *spare;
+    void *edata;
+    size_t resizes;
+    void *mapped;       // file of hashmap_map_readonly(), NULL for a map
+    size_t mapped_size; // that can be changed
+};
+
+static struct slot *slot_at(struct hashmap *map, size_t index) {
+    return (struct slot *) (((char *) map->buckets) + (map->bucketsz * index));
+}
+
+static void *slot_item(struct slot *slot) {
+    return ((char *) slot) + sizeof(struct slot);
+}
+
+// bucket_size returns the size of a slot of elsize items.
+static size_t bucket_size(size_t elsize) {
+    size_t bucketsz = sizeof(struct slot) + elsize;
+    while (bucketsz & (sizeof(uintptr_t) - 1)) {
+        bucketsz++;
+    }
+    return bucketsz;
+}
+
+static uint64_t get_hash(struct hashmap *map, const void *key) {
+    return map->hash(key, map->seed0, map->seed1) << 16 >> 16;
+}
+
+// the low 7 bits of the hash are the tag, the others pick the first group
+static uint8_t hash_tag(uint64_t hash) {
+    return (uint8_t) (hash & 0x7f);
+}
+
+static size_t hash_pos(struct hashmap *map, uint64_t hash) {
+    return (size_t) (hash >> 7) & map->mask;
+}
+
+// group_match returns a bit for each of the GROUP control bytes at ctrl that
+// is c.
+static uint32_t group_match(const uint8_t *ctrl, uint8_t c) {
+#ifdef __SSE2__
+    __m128i group = _mm_loadu_si128((const __m128i *) ctrl);
+    return (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(group,
+                                                       _mm_set1_epi8((char) c)));
+#else
+    uint32_t bits = 0;
+    for (int i = 0; i < GROUP; i++) {
+        if (ctrl[i] == c) bits |= 1u << i;
+    }
+    return bits;
+#endif
+}
+
+// group_free returns a bit for each empty or deleted slot of the group, the
+// control bytes with the top bit set.
+static uint32_t group_free(const uint8_t *ctrl) {
+#ifdef __SSE2__
+    return (uint32_t) _mm_movemask_epi8(
+            _mm_loadu_si128((const __m128i *) ctrl));
+#else
+    uint32_t bits = 0;
+    for (int i = 0; i < GROUP; i++) {
+        if (ctrl[i] & 0x80) bits |= 1u << i;
+    }
+    return bits;
+#endif
+}
+
+static void set_ctrl(struct hashmap *map, size_t i, uint8_t c) {
+    map->ctrl[i] = c;
+    if (i < GROUP) {
+        map->ctrl[map->nbuckets + i] = c;
+    }
+}
+
+static void *set_hashed(struct hashmap *map, const void *item, uint64_t hash);
+
+static void *get_hashed(struct hashmap *map, const void *key, uint64_t hash);
+
+// find_slot returns the slot of the key, SIZE_MAX if there is none.
+static size_t find_slot(struct hashmap *map, const void *key, uint64_t hash) {
+    size_t pos = hash_pos(map, hash), stride = 0;
+    uint8_t tag = hash_tag(hash);
+    for (;;) {
+        const uint8_t *group = map->ctrl + pos;
+        for (uint32_t m = group_match(group, tag); m; m &= m - 1) {
+            size_t i = (pos + (size_t) __builtin_ctz(m)) & map->mask;
+            struct slot *slot = slot_at(map, i);
+            if (slot->hash == hash &&
+                map->compare(key, slot_item(slot), map->udata) == 0) {
+                return i;
+            }
+        }
+        if (group_match(group, CTRL_EMPTY)) {
+            return SIZE_MAX;
+        }
+        stride += GROUP;
+        pos = (pos + stride) & map->mask;
+    }
+}
+
+// free_slot returns the first empty or deleted slot on the way of the hash.
+static size_t free_slot(struct hashmap *map, uint64_t hash) {
+    size_t pos = hash_pos(map, hash), stride = 0;
+    for (;;) {
+        uint32_t m = group_free(map->ctrl + pos);
+        if (m) {
+            return (pos + (size_t) __builtin_ctz(m)) & map->mask;
+        }
+        stride += GROUP;
+        pos = (pos + stride) & map->mask;
+    }
+}
+
+static void set_limits(struct hashmap *map) {
+    map->mask = map->nbuckets - 1;
+    map->growat = map->nbuckets - map->nbuckets / 8;
+    map->shrinkat = map->nbuckets * 0.10;
+}
+
+// hashmap_new_with_allocator returns a new hash map using a custom allocator.
+// See hashmap_new for more information
+struct hashmap *hashmap_new_with_allocator(
+        void *(*_malloc)(size_t),
+        void *(*_realloc)(void *, size_t),
+        void (*_free)(void *),
+        size_t elsize, size_t cap,
+        uint64_t seed0, uint64_t seed1,
+        uint64_t (*hash)(const void *item,
+                         uint64_t seed0, uint64_t seed1),
+        int (*compare)(const void *a, const void *b,
+                       void *udata),
+        void (*elfree)(void *item),
+        void *udata) {
+    _malloc = _malloc ? _malloc : malloc;
+    _realloc = _realloc ? _realloc : realloc;
+    _free = _free ? _free : free;
+    size_t ncap = GROUP;
+    while (ncap < cap) {
+        ncap *= 2;
+    }
+    size_t bucketsz = bucket_size(elsize);
+    // hashmap + spare + edata
+    struct hashmap *map = _malloc(sizeof(struct hashmap) + bucketsz * 2);
+    if (!map) {
+        return NULL;
+    }
+    memset(map, 0, sizeof(struct hashmap));
+    map->elsize = elsize;
+    map->bucketsz = bucketsz;
+    map->seed0 = seed0;
+    map->seed1 = seed1;
+    map->hash = hash;
+    map->compare = compare;
+    map->elfree = elfree;
+    map->udata = udata;
+    map->spare = ((char *) map) + sizeof(struct hashmap);
+    map->edata = (char *) map->spare + bucketsz;
+    map->cap = ncap;
+    map->nbuckets = ncap;
+    map->ctrl = _malloc(ncap + GROUP);
+    map->buckets = _malloc(bucketsz * ncap);
+    if (!map->ctrl || !map->buckets) {
+        _free(map->ctrl);
+        _free(map->buckets);
+        _free(map);
+        return NULL;
+    }
+    memset(map->ctrl, CTRL_EMPTY, ncap + GROUP);
+    set_limits(map);
+    map->malloc = _malloc;
+    map->realloc = _realloc;
+    map->free = _free;
+    return map;
+}
+
+static void free_elements(struct hashmap *map) {
+    if (map->elfree) {
+        for (size_t i = 0; i < map->nbuckets; i++) {
+            if (!(map->ctrl[i] & 0x80)) map->elfree(slot_item(slot_at(map, i)));
+        }
+    }
+}
+
+// resize moves the items into new_cap slots, deleted slots are dropped.
+static bool resize(struct hashmap *map, size_t new_cap) {
+    uint8_t *new_ctrl = map->malloc(new_cap + GROUP);
+    void *new_buckets = map->malloc(map->bucketsz * new_cap);
+    if (!new_ctrl || !new_buckets) {
+        if (new_ctrl) map->free(new_ctrl);
+        if (new_buckets) map->free(new_buckets);
+        return false;
+    }
+    memset(new_ctrl, CTRL_EMPTY, new_cap + GROUP);
+    uint8_t *old_ctrl = map->ctrl;
+    void *old_buckets = map->buckets;
+    size_t old_nbuckets = map->nbuckets;
+    map->ctrl = new_ctrl;
+    map->buckets = new_buckets;
+    map->nbuckets = new_cap;
+    set_limits(map);
+    for (size_t i = 0; i < old_nbuckets; i++) {
+        if (old_ctrl[i] & 0x80) {
+            continue;
+        }
+        struct slot *old = (struct slot *) ((char *) old_buckets + map->bucketsz * i);
+        size_t j = free_slot(map, old->hash);
+        memcpy(slot_at(map, j), old, map->bucketsz);
+        set_ctrl(map, j, hash_tag(old->hash));
+    }
+    map->free(old_ctrl);
+    map->free(old_buckets);
+    map->deleted = 0;
+    return true;
+}
+
+// hashmap_clear quickly clears the map.
+// Every item is called with the element-freeing function given in hashmap_new,
+// if present, to free any data referenced in the elements of the hashmap.
+// When the update_cap is provided, the map's capacity will be updated to match
+// the currently number of allocated buckets. This is an optimization to ensure
+// that this operation does not perform any allocations.
+void hashmap_clear(struct hashmap *map, bool update_cap) {
+    if (map->mapped) {
+        panic("map is read-only");
+    }
+    free_elements(map);
+    map->count = 0;
+    map->deleted = 0;
+    if (update_cap) {
+        map->cap = map->nbuckets;
+    } else if (map->nbuckets != map->cap) {
+        uint8_t *new_ctrl = map->malloc(map->cap + GROUP);
+        void *new_buckets = map->malloc(map->bucketsz * map->cap);
+        if (new_ctrl && new_buckets) {
+            map->free(map->ctrl);
+            map->free(map->buckets);
+            map->ctrl = new_ctrl;
+            map->buckets = new_buckets;
+            map->nbuckets = map->cap;
+        } else {
+            if (new_ctrl) map->free(new_ctrl);
+            if (new_buckets) map->free(new_buckets);
+        }
+    }
+    memset(map->ctrl, CTRL_EMPTY, map->nbuckets + GROUP);
+    set_limits(map);
+}
+
+// buckets_for returns the number of slots that holds count items without
+// growing.
+static size_t buckets_for(struct hashmap *map, size_t count) {
+    size_t ncap = map->nbuckets;
+    while (ncap - ncap / 8 < count) {
+        ncap *= 2;
+    }
+    return ncap;
+}
+
+// hashmap_reserve makes room for count items, so that many can be set
+// without the map growing on the way. The room is kept as the lower capacity
+// of the map, deletes do not shrink it below. Returns false if the system is
+// unable to allocate the slots, the map is left as it was then.
+bool hashmap_reserve(struct hashmap *map, size_t count) {
+    if (map->mapped) {
+        panic("map is read-only");
+    }
+    size_t ncap = buckets_for(map, count + map->deleted);
+    if (ncap > map->nbuckets && !resize(map, ncap)) {
+        return false;
+    }
+    if (map->cap < ncap) {
+        map->cap = ncap;
+    }
+    return true;
+}
+
+// hashmap_build_bulk sets n items of the items array, as hashmap_set() one
+// after another would: of items comparing equal the last one is kept. The
+// room is made first, then the items are set one by one, in this layout an
+// insert does not move other items anyway. Returns false if the system is
+// unable to allocate memory, the map may hold part of the items then.
+bool hashmap_build_bulk(struct hashmap *map, const void *items, size_t n) {
+    const char *base = items;
+    map->oom = false;
+    if (!hashmap_reserve(map, map->count + n)) {
+        map->oom = true;
+        return false;
+    }
+    for (size_t k = 0; k < n; k++) {
+        if (!hashmap_set(map, base + k * map->elsize) && map->oom) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// set_hashed is hashmap_set() of an item whose hash is known.
+static void *set_hashed(struct hashmap *map, const void *item, uint64_t hash) {
+    map->oom = false;
+    size_t i = find_slot(map, item, hash);
+    if (i != SIZE_MAX) {
+        void *old = slot_item(slot_at(map, i));
+        memcpy(map->spare, old, map->elsize);
+        memcpy(old, item, map->elsize);
+        return map->spare;
+    }
+    if (map->count + map->deleted >= map->growat) {
+        // a map full of deleted slots is rebuilt at its size
+        size_t ncap = (map->count >= map->growat / 2) ? map->nbuckets * 2
+                                                      : map->nbuckets;
+        if (!resize(map, ncap)) {
+            map->oom = true;
+            return NULL;
+        }
+        map->resizes++;
+    }
+    i = free_slot(map, hash);
+    if (map->ctrl[i] == CTRL_DELETED) {
+        map->deleted--;
+    }
+    struct slot *slot = slot_at(map, i);
+    slot->hash = hash;
+    memcpy(slot_item(slot), item, map->elsize);
+    set_ctrl(map, i, hash_tag(hash));
+    map->count++;
+    return NULL;
+}
+
+// get_hashed is hashmap_get() of a key whose hash is known.
+static void *get_hashed(struct hashmap *map, const void *key, uint64_t hash) {
+    size_t i = find_slot(map, key, hash);
+    return (i == SIZE_MAX) ? NULL : slot_item(slot_at(map, i));
+}
+
+// hashmap_probe returns the item in the bucket at position or NULL if an item
+// is not set for that bucket. The position is 'moduloed' by the number of
+// buckets in the hashmap.
+void *hashmap_probe(struct hashmap *map, uint64_t position) {
+    size_t i = position & map->mask;
+    if (map->ctrl[i] & 0x80) {
+        return NULL;
+    }
+    return slot_item(slot_at(map, i));
+}
+
+// hashmap_delete removes an item from the hash map and returns it. If the
+// item is not found then NULL is returned.
+void *hashmap_delete(struct hashmap *map, void *key) {
+    if (!key) {
+        panic("key is null");
+    }
+    if (map->mapped) {
+        panic("map is read-only");
+    }
+    map->oom = false;
+    uint64_t hash = get_hash(map, key);
+    size_t i = find_slot(map, key, hash);
+    if (i == SIZE_MAX) {
+        return NULL;
+    }
+    memcpy(map->spare, slot_item(slot_at(map, i)), map->elsize);
+    // lookups of other items may have passed the slot, it stays taken
+    set_ctrl(map, i, CTRL_DELETED);
+    map->count--;
+    map->deleted++;
+    if (map->nbuckets > map->cap && map->count <= map->shrinkat) {
+        // Ignore the return value. It's ok for the resize operation to
+        // fail to allocate enough memory because a shrink operation
+        // does not change the integrity of the data.
+        if (resize(map, map->nbuckets / 2)) {
+            map->resizes++;
+        }
+    }
+    return map->spare;
+}
+
+// written into saved maps, a map is only mapped back by the layout that saved it
+#define SAVED_LAYOUT 2
+
+// table_size returns the bytes of a saved table: the slots, then the control
+// bytes.
+static size_t table_size(size_t nbuckets, size_t bucketsz) {
+    return nbuckets * bucketsz + nbuckets + GROUP;
+}
+
+static bool write_table(struct hashmap *map, int fd) {
+    return write_all(fd, map->buckets, map->nbuckets * map->bucketsz) &&
+           write_all(fd, map->ctrl, map->nbuckets + GROUP);
+}
+
+// attach_table points the map into a saved table, false if its control bytes
+// do not hold count items or have no empty slot to end a probe.
+static bool attach_table(struct hashmap *map, char *table) {
+    size_t count = 0;
+    bool empty = false;
+    if (map->nbuckets < GROUP) {
+        return false;
+    }
+    map->buckets = table;
+    map->ctrl = (uint8_t *) table + map->nbuckets * map->bucketsz;
+    set_limits(map);
+    for (size_t i = 0; i < map->nbuckets; i++) {
+        uint8_t c = map->ctrl[i];
+        if (i < GROUP && map->ctrl[map->nbuckets + i] != c) {
+            return false;
+        }
+        if (c == CTRL_EMPTY) {
+            empty = true;
+        } else if (c == CTRL_DELETED) {
+            map->deleted++;
+        } else if (c & 0x80) {
+            return false;
+        } else {
+            count++;
+        }
+    }
+    return empty && count == map->count;
+}
+
+// hashmap_free frees the hash map
+// Every item is called with the element-freeing function given in hashmap_new,
+// if present, to free any data referenced in the elements of the hashmap.
+void hashmap_free(struct hashmap *map) {
+    if (!map) return;
+    if (map->mapped) {
+        munmap(map->mapped, map->mapped_size);
+        map->free(map);
+        return;
+    }
+    free_elements(map);
+    map->free(map->ctrl);
+    map->free(map->buckets);
+    map->free(map);
+}
+
+// hashmap_stats fills stats with the shape of the hash map. Probe lengths
+// are the numbers of groups a lookup of each item goes through.
+void hashmap_stats(struct hashmap *map, struct hashmap_stats *stats) {
+    size_t total = 0;
+    memset(stats, 0, sizeof(*stats));
+    stats->count = map->count;
+    stats->nbuckets = map->nbuckets;
+    stats->resizes = map->resizes;
+    stats->memory = map->bucketsz * map->nbuckets + map->nbuckets + GROUP;
+    for (size_t i = 0; i < map->nbuckets; i++) {
+        if (map->ctrl[i] & 0x80) {
+            continue;
+        }
+        size_t pos = hash_pos(map, slot_at(map, i)->hash), stride = 0;
+        size_t probe = 1;
+        while (((i - pos) & map->mask) >= GROUP) {
+            stride += GROUP;
+            pos = (pos + stride) & map->mask;
+            probe++;
+        }
+        total += probe;
+        if (probe > stats->max_probe) {
+            stats->max_probe = probe;
+        }
+    }
+    stats->avg_probe = map->count ? (double) total / (double) map->count : 0;
+}
+
+// hashmap_scan iterates over all items in the hash map
+// Param `iter` can return false to stop iteration early.
+// Returns false if the iteration has been stopped early.
+bool hashmap_scan(struct hashmap *map,
+                  bool (*iter)(const void *item, void *udata), void *udata) {
+    for (size_t i = 0; i < map->nbuckets; i++) {
+        if (!(map->ctrl[i] & 0x80)) {
+            if (!iter(slot_item(slot_at(map, i)), udata)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// hashmap_iter iterates one key at a time yielding a reference to an
+// entry at each iteration, see the robin hood layout below.
+bool hashmap_iter(struct hashmap *map, size_t *i, void **item) {
+    for (; *i < map->nbuckets; (*i)++) {
+        if (!(map->ctrl[*i] & 0x80)) {
+            *item = slot_item(slot_at(map, (*i)++));
+            return true;
+        }
+    }
+    return false;
+}
+
+// next_hashed is hashmap_iter() giving the hash of the item as well.
+static bool next_hashed(struct hashmap *map, size_t *i, void **item,
+                        uint64_t *hash) {
+    if (!hashmap_iter(map, i, item)) {
+        return false;
+    }
+    *hash = slot_at(map, *i - 1)->hash;
+    return true;
+}
+
+#else
+
 struct bucket {
     uint64_t hash: 48;
     uint64_t dib: 16;
@@ -59,6 +649,9 @@ struct hashmap {
     void *buckets;
     void *spare;
     void *edata;
+    size_t resizes;
+    void *mapped;       // file of hashmap_map_readonly(), NULL for a map
+    size_t mapped_size; // that can be changed
 };
 
 static struct bucket *bucket_at(struct hashmap *map, size_t index) {
@@ -69,10 +662,23 @@ static void *bucket_item(struct bucket *entry) {
     return ((char *) entry) + sizeof(struct bucket);
 }
 
+// bucket_size returns the size of a bucket of elsize items.
+static size_t bucket_size(size_t elsize) {
+    size_t bucketsz = sizeof(struct bucket) + elsize;
+    while (bucketsz & (sizeof(uintptr_t) - 1)) {
+        bucketsz++;
+    }
+    return bucketsz;
+}
+
 static uint64_t get_hash(struct hashmap *map, const void *key) {
     return map->hash(key, map->seed0, map->seed1) << 16 >> 16;
 }
 
+static void *set_hashed(struct hashmap *map, const void *item, uint64_t hash);
+
+static void *get_hashed(struct hashmap *map, const void *key, uint64_t hash);
+
 // hashmap_new_with_allocator returns a new hash map using a custom allocator.
 // See hashmap_new for more information
 struct hashmap *hashmap_new_with_allocator(
@@ -99,10 +705,7 @@ struct hashmap *hashmap_new_with_allocator(
         }
         cap = ncap;
     }
-    size_t bucketsz = sizeof(struct bucket) + elsize;
-    while (bucketsz & (sizeof(uintptr_t) - 1)) {
-        bucketsz++;
-    }
+    size_t bucketsz = bucket_size(elsize);
     // hashmap + spare + edata
     size_t size = sizeof(struct hashmap) + bucketsz * 2;
     struct hashmap *map = _malloc(size);
@@ -132,45 +735,12 @@ struct hashmap *hashmap_new_with_allocator(
     map->growat = map->nbuckets * 0.75;
     map->shrinkat = map->nbuckets * 0.10;
     map->malloc = _malloc;
-    map->realloc = _realloc;
-    map->free = _free;
-    return map;
-}
-
-
-// hashmap_new returns a new hash map.
-// Param `elsize` is the size of each element in the tree. Every element that
-// is inserted, deleted, or retrieved will be this size.
-// Param `cap` is the default lower capacity of the hashmap. Setting this to
-// zero will default to 16.
-// Params `seed0` and `seed1` are optional seed values that are passed to the
-// following `hash` function. These can be any value you wish but it's often
-// best to use randomly generated values.
-// Param `hash` is a function that generates a hash value for an item. It's
-// important that you provide a good hash function, otherwise it will perform
-// poorly or be vulnerable to Denial-of-service attacks. This implementation
-// comes with two helper functions `hashmap_sip()` and `hashmap_murmur()`.
-// Param `compare` is a function that compares items in the tree. See the
-// qsort stdlib function for an example of how this function works.
-// The hashmap must be freed with hashmap_free().
-// Param `elfree` is a function that frees a specific item. This should be NULL
-// unless you're storing some kind of reference data in the hash.
-struct hashmap *hashmap_new(size_t elsize, size_t cap,
-                            uint64_t seed0, uint64_t seed1,
-                            uint64_t (*hash)(const void *item,
-                                             uint64_t seed0, uint64_t seed1),
-                            int (*compare)(const void *a, const void *b,
-                                           void *udata),
-                            void (*elfree)(void *item),
-                            void *udata) {
-    return hashmap_new_with_allocator(
-            (_malloc ? _malloc : malloc),
-            (_realloc ? _realloc : realloc),
-            (_free ? _free : free),
-            elsize, cap, seed0, seed1, hash, compare, elfree, udata
-    );
+    map->realloc = _realloc;
+    map->free = _free;
+    return map;
 }
 
+
 static void free_elements(struct hashmap *map) {
     if (map->elfree) {
         for (size_t i = 0; i < map->nbuckets; i++) {
@@ -188,6 +758,9 @@ static void free_elements(struct hashmap *map) {
 // the currently number of allocated buckets. This is an optimization to ensure
 // that this operation does not perform any allocations.
 void hashmap_clear(struct hashmap *map, bool update_cap) {
+    if (map->mapped) {
+        panic("map is read-only");
+    }
     map->count = 0;
     free_elements(map);
     if (update_cap) {
@@ -207,65 +780,173 @@ void hashmap_clear(struct hashmap *map, bool update_cap) {
 }
 
 
+// resize moves the items into new_cap buckets. Only the bucket array is
+// allocated, map->edata is the scratch bucket of the moves, so an item that
+// hashmap_delete() left in map->spare survives a shrink.
 static bool resize(struct hashmap *map, size_t new_cap) {
-    struct hashmap *map2 = hashmap_new_with_allocator(map->malloc, map->realloc, map->free,
-                                                      map->elsize, new_cap, map->seed0,
-                                                      map->seed1, map->hash, map->compare,
-                                                      map->elfree, map->udata);
-    if (!map2) {
+    size_t new_mask = new_cap - 1;
+    void *new_buckets = map->malloc(map->bucketsz * new_cap);
+    if (!new_buckets) {
         return false;
     }
+    memset(new_buckets, 0, map->bucketsz * new_cap);
     for (size_t i = 0; i < map->nbuckets; i++) {
         struct bucket *entry = bucket_at(map, i);
         if (!entry->dib) {
             continue;
         }
         entry->dib = 1;
-        size_t j = entry->hash & map2->mask;
+        size_t j = entry->hash & new_mask;
         for (;;) {
-            struct bucket *bucket = bucket_at(map2, j);
+            struct bucket *bucket = (struct bucket *) ((char *) new_buckets + map->bucketsz * j);
             if (bucket->dib == 0) {
                 memcpy(bucket, entry, map->bucketsz);
                 break;
             }
             if (bucket->dib < entry->dib) {
-                memcpy(map2->spare, bucket, map->bucketsz);
+                memcpy(map->edata, bucket, map->bucketsz);
                 memcpy(bucket, entry, map->bucketsz);
-                memcpy(entry, map2->spare, map->bucketsz);
+                memcpy(entry, map->edata, map->bucketsz);
             }
-            j = (j + 1) & map2->mask;
+            j = (j + 1) & new_mask;
             entry->dib += 1;
         }
     }
     map->free(map->buckets);
-    map->buckets = map2->buckets;
-    map->nbuckets = map2->nbuckets;
-    map->mask = map2->mask;
-    map->growat = map2->growat;
-    map->shrinkat = map2->shrinkat;
-    map->free(map2);
+    map->buckets = new_buckets;
+    map->nbuckets = new_cap;
+    map->mask = new_mask;
+    map->growat = map->nbuckets * 0.75;
+    map->shrinkat = map->nbuckets * 0.10;
     return true;
 }
 
-// hashmap_set inserts or replaces an item in the hash map. If an item is
-// replaced then it is returned otherwise NULL is returned. This operation
-// may allocate memory. If the system is unable to allocate additional
-// memory then NULL is returned and hashmap_oom() returns true.
-void *hashmap_set(struct hashmap *map, const void *item) {
-    if (!item) {
-        panic("item is null");
+// buckets_for returns the number of buckets that holds count items without
+// growing.
+static size_t buckets_for(struct hashmap *map, size_t count) {
+    size_t ncap = map->nbuckets;
+    while ((size_t) (ncap * 0.75) < count) {
+        ncap *= 2;
+    }
+    return ncap;
+}
+
+// hashmap_reserve makes room for count items, so that many can be set
+// without the map growing on the way. The room is kept as the lower capacity
+// of the map, deletes do not shrink it below. Returns false if the system is
+// unable to allocate the buckets, the map is left as it was then.
+bool hashmap_reserve(struct hashmap *map, size_t count) {
+    if (map->mapped) {
+        panic("map is read-only");
+    }
+    size_t ncap = buckets_for(map, count);
+    if (ncap > map->nbuckets && !resize(map, ncap)) {
+        return false;
+    }
+    if (map->cap < ncap) {
+        map->cap = ncap;
+    }
+    return true;
+}
+
+// hashmap_build_bulk sets n items of the items array, as hashmap_set() one
+// after another would: of items comparing equal the last one is kept. An
+// empty map is built in one pass: the items are sorted by their home
+// bucket, and with linear probing each then goes to its home or right after
+// the item placed before, no item is moved twice. Items that would run past
+// the last bucket wrap around through hashmap_set(). A map that is not empty
+// gets the items one by one. Returns false if the system is unable to
+// allocate memory, the map may hold part of the items then.
+bool hashmap_build_bulk(struct hashmap *map, const void *items, size_t n) {
+    const char *base = items;
+    map->oom = false;
+    if (!hashmap_reserve(map, map->count + n)) {
+        map->oom = true;
+        return false;
+    }
+    uint64_t *hashes = map->count == 0 ? map->malloc(n * sizeof(uint64_t)) : NULL;
+    size_t *start = hashes ? map->malloc((map->nbuckets + 1) * sizeof(size_t)) : NULL;
+    size_t *order = start ? map->malloc(n * sizeof(size_t)) : NULL;
+    if (!order) {
+        if (hashes) map->free(hashes);
+        if (start) map->free(start);
+        for (size_t k = 0; k < n; k++) {
+            if (!hashmap_set(map, base + k * map->elsize) && map->oom) {
+                return false;
+            }
+        }
+        return true;
+    }
+    // counting sort by home bucket, stable, so equal items keep their order
+    memset(start, 0, (map->nbuckets + 1) * sizeof(size_t));
+    for (size_t k = 0; k < n; k++) {
+        hashes[k] = get_hash(map, base + k * map->elsize);
+        start[(hashes[k] & map->mask) + 1]++;
+    }
+    for (size_t i = 0; i < map->nbuckets; i++) {
+        start[i + 1] += start[i];
+    }
+    for (size_t k = 0; k < n; k++) {
+        order[start[hashes[k] & map->mask]++] = k;
+    }
+    size_t pos = 0, run = 0, home_prev = SIZE_MAX, nwrap = 0;
+    for (size_t o = 0; o < n; o++) {
+        size_t k = order[o];
+        const void *item = base + k * map->elsize;
+        size_t home = hashes[k] & map->mask;
+        if (home != home_prev) {
+            // items of one home bucket are next to each other from run on
+            run = home > pos ? home : pos;
+            pos = run;
+            home_prev = home;
+        }
+        struct bucket *dup = NULL;
+        for (size_t i = run; i < pos && i < map->nbuckets; i++) {
+            struct bucket *bucket = bucket_at(map, i);
+            if (bucket->hash == hashes[k] &&
+                map->compare(item, bucket_item(bucket), map->udata) == 0) {
+                dup = bucket;
+                break;
+            }
+        }
+        if (dup) {
+            memcpy(bucket_item(dup), item, map->elsize);
+        } else if (pos < map->nbuckets) {
+            struct bucket *bucket = bucket_at(map, pos);
+            bucket->hash = hashes[k];
+            bucket->dib = pos - home + 1;
+            memcpy(bucket_item(bucket), item, map->elsize);
+            map->count++;
+            pos++;
+        } else {
+            // past the last bucket, set after the pass in their order
+            order[nwrap++] = k;
+        }
     }
+    bool ok = true;
+    for (size_t o = 0; o < nwrap && ok; o++) {
+        ok = hashmap_set(map, base + order[o] * map->elsize) || !map->oom;
+    }
+    map->free(hashes);
+    map->free(start);
+    map->free(order);
+    return ok;
+}
+
+// set_hashed is hashmap_set() of an item whose hash is known.
+static void *set_hashed(struct hashmap *map, const void *item, uint64_t hash) {
     map->oom = false;
     if (map->count == map->growat) {
         if (!resize(map, map->nbuckets * 2)) {
             map->oom = true;
             return NULL;
         }
+        map->resizes++;
     }
 
 
     struct bucket *entry = map->edata;
-    entry->hash = get_hash(map, item);
+    entry->hash = hash;
     entry->dib = 1;
     memcpy(bucket_item(entry), item, map->elsize);
 
@@ -294,13 +975,8 @@ void *hashmap_set(struct hashmap *map, const void *item) {
     }
 }
 
-// hashmap_get returns the item based on the provided key. If the item is not
-// found then NULL is returned.
-void *hashmap_get(struct hashmap *map, const void *key) {
-    if (!key) {
-        panic("key is null");
-    }
-    uint64_t hash = get_hash(map, key);
+// get_hashed is hashmap_get() of a key whose hash is known.
+static void *get_hashed(struct hashmap *map, const void *key, uint64_t hash) {
     size_t i = hash & map->mask;
     for (;;) {
         struct bucket *bucket = bucket_at(map, i);
@@ -334,6 +1010,9 @@ void *hashmap_delete(struct hashmap *map, void *key) {
     if (!key) {
         panic("key is null");
     }
+    if (map->mapped) {
+        panic("map is read-only");
+    }
     map->oom = false;
     uint64_t hash = get_hash(map, key);
     size_t i = hash & map->mask;
@@ -362,7 +1041,9 @@ void *hashmap_delete(struct hashmap *map, void *key) {
                 // Ignore the return value. It's ok for the resize operation to
                 // fail to allocate enough memory because a shrink operation
                 // does not change the integrity of the data.
-                resize(map, map->nbuckets / 2);
+                if (resize(map, map->nbuckets / 2)) {
+                    map->resizes++;
+                }
             }
             return map->spare;
         }
@@ -370,9 +1051,32 @@ void *hashmap_delete(struct hashmap *map, void *key) {
     }
 }
 
-// hashmap_count returns the number of items in the hash map.
-size_t hashmap_count(struct hashmap *map) {
-    return map->count;
+// written into saved maps, a map is only mapped back by the layout that saved it
+#define SAVED_LAYOUT 1
+
+// table_size returns the bytes of a saved table, the buckets.
+static size_t table_size(size_t nbuckets, size_t bucketsz) {
+    return nbuckets * bucketsz;
+}
+
+static bool write_table(struct hashmap *map, int fd) {
+    return write_all(fd, map->buckets, map->nbuckets * map->bucketsz);
+}
+
+// attach_table points the map into a saved table, false if its buckets do not
+// hold count items or have no empty bucket to end a probe.
+static bool attach_table(struct hashmap *map, char *table) {
+    size_t count = 0;
+    map->buckets = table;
+    map->mask = map->nbuckets - 1;
+    map->growat = map->nbuckets * 0.75;
+    map->shrinkat = map->nbuckets * 0.10;
+    for (size_t i = 0; i < map->nbuckets; i++) {
+        if (bucket_at(map, i)->dib) {
+            count++;
+        }
+    }
+    return count == map->count && count < map->nbuckets;
 }
 
 // hashmap_free frees the hash map
@@ -380,15 +1084,36 @@ size_t hashmap_count(struct hashmap *map) {
 // if present, to free any data referenced in the elements of the hashmap.
 void hashmap_free(struct hashmap *map) {
     if (!map) return;
+    if (map->mapped) {
+        munmap(map->mapped, map->mapped_size);
+        map->free(map);
+        return;
+    }
     free_elements(map);
     map->free(map->buckets);
     map->free(map);
 }
 
-// hashmap_oom returns true if the last hashmap_set() call failed due to the
-// system being out of memory.
-bool hashmap_oom(struct hashmap *map) {
-    return map->oom;
+// hashmap_stats fills stats with the shape of the hash map. Probe lengths
+// are the numbers of buckets a lookup of each item goes through, they are
+// read from the buckets, so keeping them costs nothing on inserts.
+void hashmap_stats(struct hashmap *map, struct hashmap_stats *stats) {
+    size_t total = 0;
+    memset(stats, 0, sizeof(*stats));
+    stats->count = map->count;
+    stats->nbuckets = map->nbuckets;
+    stats->resizes = map->resizes;
+    stats->memory = map->bucketsz * map->nbuckets;
+    for (size_t i = 0; i < map->nbuckets; i++) {
+        struct bucket *bucket = bucket_at(map, i);
+        if (bucket->dib) {
+            total += bucket->dib;
+            if (bucket->dib > stats->max_probe) {
+                stats->max_probe = bucket->dib;
+            }
+        }
+    }
+    stats->avg_probe = map->count ? (double) total / (double) map->count : 0;
 }
 
 // hashmap_scan iterates over all items in the hash map
@@ -422,7 +1147,11 @@ bool hashmap_scan(struct hashmap *map,
 // the buckets are rearranged and the iterator must be reset to 0, otherwise
 // unexpected results may be returned after deletion.
 //
-// This function has not been tested for thread safety.
+// A map that no thread changes may be read by any number of threads at once:
+// hashmap_get(), hashmap_probe(), hashmap_count(), hashmap_stats(),
+// hashmap_scan(), hashmap_iter() and hashmap_iter_range() do not write to
+// the map, each thread only needs its own cursor. A set, delete or clear
+// meanwhile is a data race.
 //
 // The function returns true if an item was retrieved; false if the end of the
 // iteration has been reached.
@@ -441,6 +1170,533 @@ bool hashmap_iter(struct hashmap *map, size_t *i, void **item) {
     return true;
 }
 
+// next_hashed is hashmap_iter() giving the hash of the item as well.
+static bool next_hashed(struct hashmap *map, size_t *i, void **item,
+                        uint64_t *hash) {
+    for (; *i < map->nbuckets; (*i)++) {
+        struct bucket *bucket = bucket_at(map, *i);
+        if (bucket->dib) {
+            (*i)++;
+            *item = bucket_item(bucket);
+            *hash = bucket->hash;
+            return true;
+        }
+    }
+    return false;
+}
+
+#endif
+
+// hashmap_new returns a new hash map.
+// Param `elsize` is the size of each element in the tree. Every element that
+// is inserted, deleted, or retrieved will be this size.
+// Param `cap` is the default lower capacity of the hashmap. Setting this to
+// zero will default to 16.
+// Params `seed0` and `seed1` are optional seed values that are passed to the
+// following `hash` function. These can be any value you wish but it's often
+// best to use randomly generated values.
+// Param `hash` is a function that generates a hash value for an item. It's
+// important that you provide a good hash function, otherwise it will perform
+// poorly or be vulnerable to Denial-of-service attacks. This implementation
+// comes with two helper functions `hashmap_sip()` and `hashmap_murmur()`.
+// Param `compare` is a function that compares items in the tree. See the
+// qsort stdlib function for an example of how this function works.
+// The hashmap must be freed with hashmap_free().
+// Param `elfree` is a function that frees a specific item. This should be NULL
+// unless you're storing some kind of reference data in the hash.
+struct hashmap *hashmap_new(size_t elsize, size_t cap,
+                            uint64_t seed0, uint64_t seed1,
+                            uint64_t (*hash)(const void *item,
+                                             uint64_t seed0, uint64_t seed1),
+                            int (*compare)(const void *a, const void *b,
+                                           void *udata),
+                            void (*elfree)(void *item),
+                            void *udata) {
+    return hashmap_new_with_allocator(
+            (_malloc ? _malloc : malloc),
+            (_realloc ? _realloc : realloc),
+            (_free ? _free : free),
+            elsize, cap, seed0, seed1, hash, compare, elfree, udata
+    );
+}
+
+// hashmap_set inserts or replaces an item in the hash map. If an item is
+// replaced then it is returned otherwise NULL is returned. This operation
+// may allocate memory. If the system is unable to allocate additional
+// memory then NULL is returned and hashmap_oom() returns true.
+void *hashmap_set(struct hashmap *map, const void *item) {
+    if (!item) {
+        panic("item is null");
+    }
+    if (map->mapped) {
+        panic("map is read-only");
+    }
+    return set_hashed(map, item, get_hash(map, item));
+}
+
+// hashmap_get returns the item based on the provided key. If the item is not
+// found then NULL is returned.
+void *hashmap_get(struct hashmap *map, const void *key) {
+    if (!key) {
+        panic("key is null");
+    }
+    return get_hashed(map, key, get_hash(map, key));
+}
+
+// hashmap_count returns the number of items in the hash map.
+size_t hashmap_count(struct hashmap *map) {
+    return map->count;
+}
+
+// hashmap_oom returns true if the last hashmap_set() call failed due to the
+// system being out of memory.
+bool hashmap_oom(struct hashmap *map) {
+    return map->oom;
+}
+
+// hashmap_save writes the map to fd: a header with the seeds, the item size
+// and the layout, then the table byte for byte. Nothing in it depends on
+// where it is loaded, so hashmap_map_readonly() answers lookups straight from
+// the file. The items are written as they are, they must not hold pointers.
+// Returns false if writing failed.
+bool hashmap_save(struct hashmap *map, int fd) {
+    struct saved_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SAVED_MAGIC, sizeof(hdr.magic));
+    hdr.version = SAVED_VERSION;
+    hdr.layout = SAVED_LAYOUT;
+    hdr.byte_order = SAVED_BYTE_ORDER;
+    hdr.elsize = map->elsize;
+    hdr.bucketsz = map->bucketsz;
+    hdr.nbuckets = map->nbuckets;
+    hdr.count = map->count;
+    hdr.seed0 = map->seed0;
+    hdr.seed1 = map->seed1;
+    return write_all(fd, &hdr, sizeof(hdr)) && write_table(map, fd);
+}
+
+// hashmap_map_readonly maps a map saved by hashmap_save() from fd, with the
+// hash and compare functions the saved map had, its seeds come from the file.
+// Nothing is copied or rehashed: hashmap_get(), hashmap_iter(),
+// hashmap_scan() and hashmap_stats() read the mapped pages, and any call that
+// changes the map panics. fd may be closed afterwards, hashmap_free() unmaps
+// the file. Returns NULL if fd does not hold a map saved by a build of the
+// same layout, or it could not be mapped.
+struct hashmap *hashmap_map_readonly(int fd,
+                                     uint64_t (*hash)(const void *item,
+                                                      uint64_t seed0,
+                                                      uint64_t seed1),
+                                     int (*compare)(const void *a,
+                                                    const void *b,
+                                                    void *udata),
+                                     void *udata) {
+    struct stat st;
+    struct hashmap *map = NULL;
+    if (fstat(fd, &st) == -1 ||
+        st.st_size < (off_t) sizeof(struct saved_header)) {
+        return NULL;
+    }
+    size_t size = (size_t) st.st_size;
+    void *base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+    const struct saved_header *hdr = base;
+    void *(*alloc)(size_t) = _malloc ? _malloc : malloc;
+    if (memcmp(hdr->magic, SAVED_MAGIC, sizeof(hdr->magic)) == 0 &&
+        hdr->version == SAVED_VERSION && hdr->layout == SAVED_LAYOUT &&
+        hdr->byte_order == SAVED_BYTE_ORDER && hdr->elsize > 0 &&
+        hdr->elsize < size && hdr->bucketsz == bucket_size(hdr->elsize) &&
+        hdr->nbuckets > 0 && (hdr->nbuckets & (hdr->nbuckets - 1)) == 0 &&
+        hdr->nbuckets <= size / hdr->bucketsz &&
+        size == sizeof(*hdr) + table_size(hdr->nbuckets, hdr->bucketsz)) {
+        // hashmap + spare + edata
+        map = alloc(sizeof(struct hashmap) + hdr->bucketsz * 2);
+    }
+    if (!map) {
+        munmap(base, size);
+        return NULL;
+    }
+    memset(map, 0, sizeof(struct hashmap));
+    map->malloc = alloc;
+    map->realloc = _realloc ? _realloc : realloc;
+    map->free = _free ? _free : free;
+    map->elsize = hdr->elsize;
+    map->bucketsz = hdr->bucketsz;
+    map->seed0 = hdr->seed0;
+    map->seed1 = hdr->seed1;
+    map->hash = hash;
+    map->compare = compare;
+    map->udata = udata;
+    map->spare = ((char *) map) + sizeof(struct hashmap);
+    map->edata = (char *) map->spare + map->bucketsz;
+    map->cap = hdr->nbuckets;
+    map->nbuckets = hdr->nbuckets;
+    map->count = hdr->count;
+    map->mapped = base;
+    map->mapped_size = size;
+    if (!attach_table(map, (char *) base + sizeof(*hdr))) {
+        hashmap_free(map);
+        return NULL;
+    }
+    return map;
+}
+
+// Parts of the bucket array for hashmap_iter_range() start at multiples of
+// CACHE_LINE bytes from its start, hashmap_parallel_scan() splits it into
+// SCAN_PARTS_PER_WORKER parts per worker so a worker with a dense part does
+// not keep the others waiting.
+#define CACHE_LINE 64
+#define SCAN_PARTS_PER_WORKER 4
+
+// part_bounds sets [begin, end) to the buckets of part of nparts.
+static void part_bounds(struct hashmap *map, size_t part, size_t nparts,
+                        size_t *begin, size_t *end) {
+    // buckets filling whole cache lines, nbuckets is a multiple of them
+    size_t step = 1;
+    while ((step * map->bucketsz) % CACHE_LINE && step < map->nbuckets) {
+        step *= 2;
+    }
+    size_t nsteps = map->nbuckets / step;
+    if (nparts == 0 || part >= nparts) {
+        *begin = *end = 0;
+        return;
+    }
+    *begin = nsteps * part / nparts * step;
+    *end = nsteps * (part + 1) / nparts * step;
+}
+
+// hashmap_iter_range is hashmap_iter() over part of nparts parts of the
+// buckets, the parts together cover the map once. Threads iterating parts
+// of their own read no cache line of the buckets twice. i is a cursor that
+// should be initialized to 0, as with hashmap_iter().
+bool hashmap_iter_range(struct hashmap *map, size_t part, size_t nparts,
+                        size_t *i, void **item) {
+    size_t begin, end;
+    part_bounds(map, part, nparts, &begin, &end);
+    if (*i < begin) {
+        *i = begin;
+    }
+    while (*i < end) {
+        void *found = hashmap_probe(map, (*i)++);
+        if (found) {
+            *item = found;
+            return true;
+        }
+    }
+    return false;
+}
+
+struct scan_job {
+    struct hashmap *map;
+    bool (*iter)(const void *item, void *acc);
+    size_t nparts;
+    size_t next;  // part to take next, taken atomically
+    bool stopped; // an iter returned false
+};
+
+struct scan_worker {
+    pthread_t thread;
+    struct scan_job *job;
+    void *acc;
+};
+
+// scan_parts takes parts of the job until none are left or the scan stops.
+static void scan_parts(struct scan_job *job, void *acc) {
+    size_t part;
+    while (!__atomic_load_n(&job->stopped, __ATOMIC_RELAXED) &&
+           (part = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) <
+           job->nparts) {
+        size_t i = 0;
+        void *item;
+        while (hashmap_iter_range(job->map, part, job->nparts, &i, &item)) {
+            if (!job->iter(item, acc)) {
+                __atomic_store_n(&job->stopped, true, __ATOMIC_RELAXED);
+                return;
+            }
+        }
+    }
+}
+
+static void *scan_worker(void *arg) {
+    struct scan_worker *w = arg;
+    scan_parts(w->job, w->acc);
+    return NULL;
+}
+
+// hashmap_parallel_scan is hashmap_scan() by nworkers threads at once, the
+// calling thread being one of them, over parts of the buckets taken in turn.
+// accs is an array of nworkers accumulators of accsize bytes, each worker
+// passes its own to iter, so iter needs no locking. When all are done,
+// reduce, if given, folds the others into the first one, in worker order.
+// The map must not be changed meanwhile. iter returning false stops all
+// workers. A worker thread that cannot be started leaves its parts to the
+// others, its accumulator is then not used. Returns false if the scan has
+// been stopped early.
+bool hashmap_parallel_scan(struct hashmap *map, size_t nworkers,
+                           bool (*iter)(const void *item, void *acc),
+                           void *accs, size_t accsize,
+                           void (*reduce)(void *acc, const void *other)) {
+    struct scan_job job;
+    struct scan_worker *workers = NULL;
+    size_t started = 0;
+    if (nworkers == 0) {
+        nworkers = 1;
+    }
+    memset(&job, 0, sizeof(job));
+    job.map = map;
+    job.iter = iter;
+    job.nparts = nworkers * SCAN_PARTS_PER_WORKER;
+    if (nworkers > 1) {
+        workers = (_malloc ? _malloc : malloc)((nworkers - 1) *
+                                               sizeof(struct scan_worker));
+    }
+    for (size_t w = 1; workers && w < nworkers; w++) {
+        struct scan_worker *sw = &workers[started];
+        sw->job = &job;
+        sw->acc = accs ? (char *) accs + w * accsize : NULL;
+        if (pthread_create(&sw->thread, NULL, scan_worker, sw) != 0) {
+            break;
+        }
+        started++;
+    }
+    scan_parts(&job, accs);
+    for (size_t w = 0; w < started; w++) {
+        pthread_join(workers[w].thread, NULL);
+    }
+    if (reduce && accs) {
+        for (size_t w = 1; w <= started; w++) {
+            reduce(accs, (char *) accs + w * accsize);
+        }
+    }
+    if (workers) {
+        (_free ? _free : free)(workers);
+    }
+    return !job.stopped;
+}
+
+// hashmap_sharded is a hash map that many threads set and get at once. The
+// items are spread over shards by their hash, each shard is a hashmap of its
+// own behind its own lock, so threads only wait for each other when they hit
+// the same shard. Items are copied in and out, as a pointer into a shard
+// would be moved by another thread growing it. Once the writers are done,
+// hashmap_sharded_freeze() turns it into a plain hashmap for lock-free
+// reading.
+#define SHARD_ALIGN 64
+
+struct hashmap_shard {
+    pthread_mutex_t lock;
+    struct hashmap *map;
+} __attribute__((aligned(SHARD_ALIGN)));
+
+struct hashmap_sharded {
+    size_t nshards;
+    struct hashmap_shard *shards; // aligned to SHARD_ALIGN within raw
+    void *raw;
+    void (*free)(void *);
+    bool oom;
+};
+
+// hashmap_sharded_new returns a new sharded hash map of at least nshards
+// shards, rounded up to a power of two. cap is the capacity of all of them
+// together, the other params are those of hashmap_new().
+struct hashmap_sharded *hashmap_sharded_new(size_t nshards, size_t elsize,
+                                            size_t cap, uint64_t seed0,
+                                            uint64_t seed1,
+                                            uint64_t (*hash)(const void *item,
+                                                             uint64_t seed0,
+                                                             uint64_t seed1),
+                                            int (*compare)(const void *a,
+                                                           const void *b,
+                                                           void *udata),
+                                            void (*elfree)(void *item),
+                                            void *udata) {
+    void *(*malloc_fn)(size_t) = _malloc ? _malloc : malloc;
+    void (*free_fn)(void *) = _free ? _free : free;
+    size_t n = 1;
+    while (n < nshards) {
+        n *= 2;
+    }
+    struct hashmap_sharded *sm = malloc_fn(sizeof(struct hashmap_sharded));
+    if (!sm) {
+        return NULL;
+    }
+    memset(sm, 0, sizeof(struct hashmap_sharded));
+    sm->free = free_fn;
+    sm->raw = malloc_fn((n + 1) * sizeof(struct hashmap_shard));
+    if (!sm->raw) {
+        free_fn(sm);
+        return NULL;
+    }
+    sm->shards = (struct hashmap_shard *)
+            (((uintptr_t) sm->raw + SHARD_ALIGN - 1) & ~(uintptr_t) (SHARD_ALIGN - 1));
+    for (size_t i = 0; i < n; i++) {
+        sm->shards[i].map = hashmap_new(elsize, cap / n, seed0, seed1, hash,
+                                        compare, elfree, udata);
+        if (!sm->shards[i].map) {
+            sm->nshards = i;
+            hashmap_sharded_free(sm);
+            return NULL;
+        }
+        pthread_mutex_init(&sm->shards[i].lock, NULL);
+        sm->nshards = i + 1;
+    }
+    return sm;
+}
+
+// hashmap_sharded_free frees the sharded hash map and its items, as
+// hashmap_free() does. No thread may be using it.
+void hashmap_sharded_free(struct hashmap_sharded *sm) {
+    if (!sm) return;
+    for (size_t i = 0; i < sm->nshards; i++) {
+        pthread_mutex_destroy(&sm->shards[i].lock);
+        hashmap_free(sm->shards[i].map);
+    }
+    sm->free(sm->raw);
+    sm->free(sm);
+}
+
+// shard_of picks the shard from bits of the hash above the ones the shards
+// use for their buckets.
+static struct hashmap_shard *shard_of(struct hashmap_sharded *sm,
+                                      uint64_t hash) {
+    return &sm->shards[(hash >> 32) & (sm->nshards - 1)];
+}
+
+// hashmap_sharded_get copies the item of the key into item, returns false if
+// there is none.
+bool hashmap_sharded_get(struct hashmap_sharded *sm, const void *key,
+                         void *item) {
+    if (!key) {
+        panic("key is null");
+    }
+    struct hashmap *any = sm->shards[0].map;
+    uint64_t hash = get_hash(any, key);
+    struct hashmap_shard *shard = shard_of(sm, hash);
+    pthread_mutex_lock(&shard->lock);
+    void *found = get_hashed(shard->map, key, hash);
+    if (found) {
+        memcpy(item, found, shard->map->elsize);
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return found != NULL;
+}
+
+// hashmap_sharded_set inserts or replaces an item. Returns true if an item
+// was replaced, it is copied into old unless old is NULL. If the system is
+// unable to allocate memory false is returned and hashmap_sharded_oom()
+// returns true from then on.
+bool hashmap_sharded_set(struct hashmap_sharded *sm, const void *item,
+                         void *old) {
+    if (!item) {
+        panic("item is null");
+    }
+    uint64_t hash = get_hash(sm->shards[0].map, item);
+    struct hashmap_shard *shard = shard_of(sm, hash);
+    pthread_mutex_lock(&shard->lock);
+    void *prev = set_hashed(shard->map, item, hash);
+    if (prev && old) {
+        memcpy(old, prev, shard->map->elsize);
+    }
+    bool oom = shard->map->oom;
+    pthread_mutex_unlock(&shard->lock);
+    if (oom) {
+        __atomic_store_n(&sm->oom, true, __ATOMIC_RELAXED);
+    }
+    return prev != NULL;
+}
+
+// hashmap_sharded_set_if_absent inserts the item unless one equal to it is
+// there already, the lookup and the insert are one step for the other
+// threads. Returns true if the item was inserted, otherwise the item there is
+// copied into existing unless existing is NULL. False is returned as well if
+// the system is unable to allocate memory, see hashmap_sharded_oom().
+bool hashmap_sharded_set_if_absent(struct hashmap_sharded *sm,
+                                   const void *item, void *existing) {
+    if (!item) {
+        panic("item is null");
+    }
+    uint64_t hash = get_hash(sm->shards[0].map, item);
+    struct hashmap_shard *shard = shard_of(sm, hash);
+    bool inserted = false, oom = false;
+    pthread_mutex_lock(&shard->lock);
+    void *found = get_hashed(shard->map, item, hash);
+    if (found) {
+        if (existing) {
+            memcpy(existing, found, shard->map->elsize);
+        }
+    } else {
+        set_hashed(shard->map, item, hash);
+        oom = shard->map->oom;
+        inserted = !oom;
+    }
+    pthread_mutex_unlock(&shard->lock);
+    if (oom) {
+        __atomic_store_n(&sm->oom, true, __ATOMIC_RELAXED);
+    }
+    return inserted;
+}
+
+// hashmap_sharded_oom returns true if a set of any thread failed for the
+// lack of memory.
+bool hashmap_sharded_oom(struct hashmap_sharded *sm) {
+    return __atomic_load_n(&sm->oom, __ATOMIC_RELAXED);
+}
+
+// hashmap_sharded_count returns the number of items of all shards, items
+// set meanwhile by other threads may or may not be counted.
+size_t hashmap_sharded_count(struct hashmap_sharded *sm) {
+    size_t count = 0;
+    for (size_t i = 0; i < sm->nshards; i++) {
+        pthread_mutex_lock(&sm->shards[i].lock);
+        count += sm->shards[i].map->count;
+        pthread_mutex_unlock(&sm->shards[i].lock);
+    }
+    return count;
+}
+
+// hashmap_sharded_freeze moves all items into one hashmap and frees the
+// sharded one. It is called once the threads setting items are done. The
+// returned map is read-only as far as the threads are concerned: any number
+// of them may call hashmap_get(), hashmap_probe(), hashmap_iter() and
+// hashmap_scan() on it at once without locking, as long as none of them
+// changes it. NULL is returned if the system is unable to allocate memory,
+// the sharded map is left as it was then.
+struct hashmap *hashmap_sharded_freeze(struct hashmap_sharded *sm) {
+    struct hashmap *first = sm->shards[0].map;
+    struct hashmap *map = hashmap_new_with_allocator(first->malloc,
+                                                     first->realloc,
+                                                     first->free,
+                                                     first->elsize, 0,
+                                                     first->seed0,
+                                                     first->seed1,
+                                                     first->hash,
+                                                     first->compare,
+                                                     first->elfree,
+                                                     first->udata);
+    size_t count = 0;
+    for (size_t i = 0; i < sm->nshards; i++) {
+        count += sm->shards[i].map->count;
+    }
+    if (!map || !hashmap_reserve(map, count)) {
+        hashmap_free(map);
+        return NULL;
+    }
+    // shards hold distinct items, they go in with the hashes they have
+    for (size_t i = 0; i < sm->nshards; i++) {
+        struct hashmap *shard = sm->shards[i].map;
+        size_t j = 0;
+        void *item;
+        uint64_t hash;
+        while (next_hashed(shard, &j, &item, &hash)) {
+            set_hashed(map, item, hash);
+        }
+        shard->elfree = NULL; // the items live on in map
+    }
+    hashmap_sharded_free(sm);
+    return map;
+}
+
 static uint64_t SIP64(const uint8_t *in, const size_t inlen,
                       uint64_t seed0, uint64_t seed1) {
 #define U8TO64_LE(p) \
@@ -537,10 +1793,12 @@ static void MM86128(const void *key, const int len, uint32_t seed, void *out) {
     uint32_t c4 = 0xa1e38b93;
     const uint32_t *blocks = (const uint32_t *) (data + nblocks * 16);
     for (int i = -nblocks; i; i++) {
-        uint32_t k1 = blocks[i * 4 + 0];
-        uint32_t k2 = blocks[i * 4 + 1];
-        uint32_t k3 = blocks[i * 4 + 2];
-        uint32_t k4 = blocks[i * 4 + 3];
+        uint32_t k1, k2, k3, k4;
+        // keys are not necessarily aligned, e.g. lines of a mapped file
+        memcpy(&k1, &blocks[i * 4 + 0], sizeof(k1));
+        memcpy(&k2, &blocks[i * 4 + 1], sizeof(k2));
+        memcpy(&k3, &blocks[i * 4 + 2], sizeof(k3));
+        memcpy(&k4, &blocks[i * 4 + 3], sizeof(k4));
         k1 *= c1;
         k1 = ROTL32(k1, 15);
         k1 *= c2;
@@ -41,6 +41,21 @@ size_t hashmap_count(struct hashmap *map);
 
 bool hashmap_oom(struct hashmap *map);
 
+bool hashmap_reserve(struct hashmap *map, size_t count);
+
+bool hashmap_build_bulk(struct hashmap *map, const void *items, size_t n);
+
+struct hashmap_stats {
+    size_t count;
+    size_t nbuckets;
+    size_t resizes;   // times inserts and deletes grew or shrank the buckets, reserves do not count
+    size_t memory;    // bytes of the buckets
+    size_t max_probe; // longest probe sequence of an item
+    double avg_probe;
+};
+
+void hashmap_stats(struct hashmap *map, struct hashmap_stats *stats);
+
 void *hashmap_get(struct hashmap *map, const void *item);
 
 void *hashmap_set(struct hashmap *map, const void *item);
@@ -54,6 +69,56 @@ bool hashmap_scan(struct hashmap *map,
 
 bool hashmap_iter(struct hashmap *map, size_t *i, void **item);
 
+bool hashmap_iter_range(struct hashmap *map, size_t part, size_t nparts,
+                        size_t *i, void **item);
+
+bool hashmap_parallel_scan(struct hashmap *map, size_t nworkers,
+                           bool (*iter)(const void *item, void *acc),
+                           void *accs, size_t accsize,
+                           void (*reduce)(void *acc, const void *other));
+
+bool hashmap_save(struct hashmap *map, int fd);
+
+struct hashmap *hashmap_map_readonly(int fd,
+                                     uint64_t (*hash)(const void *item,
+                                                      uint64_t seed0,
+                                                      uint64_t seed1),
+                                     int (*compare)(const void *a,
+                                                    const void *b,
+                                                    void *udata),
+                                     void *udata);
+
+struct hashmap_sharded;
+
+struct hashmap_sharded *hashmap_sharded_new(size_t nshards, size_t elsize,
+                                            size_t cap, uint64_t seed0,
+                                            uint64_t seed1,
+                                            uint64_t (*hash)(const void *item,
+                                                             uint64_t seed0,
+                                                             uint64_t seed1),
+                                            int (*compare)(const void *a,
+                                                           const void *b,
+                                                           void *udata),
+                                            void (*elfree)(void *item),
+                                            void *udata);
+
+void hashmap_sharded_free(struct hashmap_sharded *sm);
+
+bool hashmap_sharded_get(struct hashmap_sharded *sm, const void *key,
+                         void *item);
+
+bool hashmap_sharded_set(struct hashmap_sharded *sm, const void *item,
+                         void *old);
+
+bool hashmap_sharded_set_if_absent(struct hashmap_sharded *sm,
+                                   const void *item, void *existing);
+
+bool hashmap_sharded_oom(struct hashmap_sharded *sm);
+
+size_t hashmap_sharded_count(struct hashmap_sharded *sm);
+
+struct hashmap *hashmap_sharded_freeze(struct hashmap_sharded *sm);
+
 uint64_t hashmap_sip(const void *data, size_t len,
                      uint64_t seed0, uint64_t seed1);
 
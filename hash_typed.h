@@ -0,0 +1,288 @@
+#ifndef HASH_TYPED_H
+#define HASH_TYPED_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hash.h"
+
+// HASHMAP_DEFINE(name, key_t, val_t, hash_fn, eq_fn) generates a hash map of
+// fixed-size keys and values, struct name, with its functions prefixed name_.
+// It is the robin hood table of hash.c written for one type: hash_fn and
+// eq_fn are called directly so the compiler can inline them, and buckets are
+// typed structs moved by assignment instead of memcpy() of a runtime size.
+//
+//     uint64_t hash_fn(const key_t *key);
+//     bool eq_fn(const key_t *a, const key_t *b);
+//
+// Both have to be declared before the macro, static inline ones are best.
+// The hash is not kept in the buckets, hash_fn is called again when the map
+// grows, so it should be cheap; the distance of a bucket from its home is
+// what lookups compare first.
+//
+//     struct name *name_new(size_t cap);
+//     void name_free(struct name *map);
+//     void name_clear(struct name *map, bool update_cap);
+//     size_t name_count(struct name *map);
+//     bool name_oom(struct name *map);
+//     bool name_reserve(struct name *map, size_t count);
+//     val_t *name_get(struct name *map, const key_t *key);
+//     val_t *name_set(struct name *map, const key_t *key, const val_t *val);
+//     val_t *name_delete(struct name *map, const key_t *key);
+//     bool name_iter(struct name *map, size_t *i, key_t **key, val_t **val);
+//     void name_stats(struct name *map, struct hashmap_stats *stats);
+//
+// They behave as their hashmap_ counterparts: set returns the value it
+// replaced or NULL, with name_oom() telling a failed allocation from a new
+// key, and set and delete return a copy of the old value that stays valid
+// until the next call changing the map.
+#define HASHMAP_DEFINE(name, key_t, val_t, hash_fn, eq_fn)                     \
+                                                                               \
+struct name##_bucket {                                                         \
+    key_t key;                                                                 \
+    val_t val;                                                                 \
+    uint32_t dib; /* 0 for an empty bucket, 1 in its home bucket */           \
+};                                                                             \
+                                                                               \
+struct name {                                                                  \
+    struct name##_bucket *buckets;                                             \
+    size_t nbuckets;                                                           \
+    size_t cap;                                                                \
+    size_t count;                                                              \
+    size_t mask;                                                               \
+    size_t growat;                                                             \
+    size_t shrinkat;                                                           \
+    size_t resizes;                                                            \
+    bool oom;                                                                  \
+    val_t spare;                                                               \
+};                                                                             \
+                                                                               \
+static inline void name##_set_limits(struct name *map) {                       \
+    map->mask = map->nbuckets - 1;                                             \
+    map->growat = map->nbuckets * 0.75;                                        \
+    map->shrinkat = map->nbuckets * 0.10;                                      \
+}                                                                              \
+                                                                               \
+static inline struct name *name##_new(size_t cap) {                            \
+    size_t ncap = 16;                                                          \
+    while (ncap < cap) {                                                       \
+        ncap *= 2;                                                             \
+    }                                                                          \
+    struct name *map = malloc(sizeof(struct name));                            \
+    if (!map) {                                                                \
+        return NULL;                                                           \
+    }                                                                          \
+    memset(map, 0, sizeof(struct name));                                       \
+    map->buckets = malloc(ncap * sizeof(struct name##_bucket));                \
+    if (!map->buckets) {                                                       \
+        free(map);                                                             \
+        return NULL;                                                           \
+    }                                                                          \
+    memset(map->buckets, 0, ncap * sizeof(struct name##_bucket));              \
+    map->cap = ncap;                                                           \
+    map->nbuckets = ncap;                                                      \
+    name##_set_limits(map);                                                    \
+    return map;                                                                \
+}                                                                              \
+                                                                               \
+static inline void name##_free(struct name *map) {                             \
+    if (!map) return;                                                          \
+    free(map->buckets);                                                        \
+    free(map);                                                                 \
+}                                                                              \
+                                                                               \
+static inline size_t name##_count(struct name *map) {                          \
+    return map->count;                                                         \
+}                                                                              \
+                                                                               \
+static inline bool name##_oom(struct name *map) {                              \
+    return map->oom;                                                           \
+}                                                                              \
+                                                                               \
+/* the items are put into new_cap buckets, rehashed as the hash is not kept */ \
+static inline bool name##_resize(struct name *map, size_t new_cap) {           \
+    size_t new_mask = new_cap - 1;                                             \
+    struct name##_bucket *new_buckets =                                        \
+            malloc(new_cap * sizeof(struct name##_bucket));                    \
+    if (!new_buckets) {                                                        \
+        return false;                                                          \
+    }                                                                          \
+    memset(new_buckets, 0, new_cap * sizeof(struct name##_bucket));            \
+    for (size_t i = 0; i < map->nbuckets; i++) {                               \
+        if (!map->buckets[i].dib) {                                            \
+            continue;                                                          \
+        }                                                                      \
+        struct name##_bucket entry = map->buckets[i];                          \
+        size_t j = hash_fn(&entry.key) & new_mask;                             \
+        for (entry.dib = 1;; j = (j + 1) & new_mask, entry.dib++) {            \
+            struct name##_bucket *bucket = &new_buckets[j];                    \
+            if (!bucket->dib) {                                                \
+                *bucket = entry;                                               \
+                break;                                                         \
+            }                                                                  \
+            if (bucket->dib < entry.dib) {                                     \
+                struct name##_bucket tmp = *bucket;                            \
+                *bucket = entry;                                               \
+                entry = tmp;                                                   \
+            }                                                                  \
+        }                                                                      \
+    }                                                                          \
+    free(map->buckets);                                                        \
+    map->buckets = new_buckets;                                                \
+    map->nbuckets = new_cap;                                                   \
+    name##_set_limits(map);                                                    \
+    return true;                                                               \
+}                                                                              \
+                                                                               \
+static inline void name##_clear(struct name *map, bool update_cap) {           \
+    map->count = 0;                                                            \
+    if (update_cap) {                                                          \
+        map->cap = map->nbuckets;                                              \
+    } else if (map->nbuckets != map->cap) {                                    \
+        struct name##_bucket *new_buckets =                                    \
+                malloc(map->cap * sizeof(struct name##_bucket));               \
+        if (new_buckets) {                                                     \
+            free(map->buckets);                                                \
+            map->buckets = new_buckets;                                        \
+            map->nbuckets = map->cap;                                          \
+        }                                                                      \
+    }                                                                          \
+    memset(map->buckets, 0, map->nbuckets * sizeof(struct name##_bucket));     \
+    name##_set_limits(map);                                                    \
+}                                                                              \
+                                                                               \
+static inline bool name##_reserve(struct name *map, size_t count) {            \
+    size_t ncap = map->nbuckets;                                               \
+    while ((size_t) (ncap * 0.75) < count) {                                   \
+        ncap *= 2;                                                             \
+    }                                                                          \
+    if (ncap > map->nbuckets && !name##_resize(map, ncap)) {                   \
+        return false;                                                          \
+    }                                                                          \
+    if (map->cap < ncap) {                                                     \
+        map->cap = ncap;                                                       \
+    }                                                                          \
+    return true;                                                               \
+}                                                                              \
+                                                                               \
+/* a key sits at the same distance from home as the probe, and a bucket */    \
+/* closer to its home than the probe ends it: the key would have been there */\
+static inline val_t *name##_get(struct name *map, const key_t *key) {          \
+    size_t i = hash_fn(key) & map->mask;                                       \
+    for (uint32_t dib = 1;; i = (i + 1) & map->mask, dib++) {                  \
+        struct name##_bucket *bucket = &map->buckets[i];                       \
+        if (bucket->dib < dib) {                                               \
+            return NULL;                                                       \
+        }                                                                      \
+        if (bucket->dib == dib && eq_fn(&bucket->key, key)) {                  \
+            return &bucket->val;                                               \
+        }                                                                      \
+    }                                                                          \
+}                                                                              \
+                                                                               \
+static inline val_t *name##_set(struct name *map, const key_t *key,            \
+                                const val_t *val) {                            \
+    map->oom = false;                                                          \
+    if (map->count == map->growat) {                                           \
+        if (!name##_resize(map, map->nbuckets * 2)) {                          \
+            map->oom = true;                                                   \
+            return NULL;                                                       \
+        }                                                                      \
+        map->resizes++;                                                        \
+    }                                                                          \
+    struct name##_bucket entry = {*key, *val, 1};                              \
+    size_t i = hash_fn(key) & map->mask;                                       \
+    for (;; i = (i + 1) & map->mask, entry.dib++) {                            \
+        struct name##_bucket *bucket = &map->buckets[i];                       \
+        if (bucket->dib < entry.dib) {                                         \
+            break;                                                             \
+        }                                                                      \
+        if (bucket->dib == entry.dib && eq_fn(&bucket->key, key)) {            \
+            map->spare = bucket->val;                                          \
+            bucket->val = *val;                                                \
+            return &map->spare;                                                \
+        }                                                                      \
+    }                                                                          \
+    /* a new key, it takes the bucket and the items from there move on */     \
+    for (;; i = (i + 1) & map->mask, entry.dib++) {                            \
+        struct name##_bucket *bucket = &map->buckets[i];                       \
+        if (!bucket->dib) {                                                    \
+            *bucket = entry;                                                   \
+            break;                                                             \
+        }                                                                      \
+        if (bucket->dib < entry.dib) {                                         \
+            struct name##_bucket tmp = *bucket;                                \
+            *bucket = entry;                                                   \
+            entry = tmp;                                                       \
+        }                                                                      \
+    }                                                                          \
+    map->count++;                                                              \
+    return NULL;                                                               \
+}                                                                              \
+                                                                               \
+static inline val_t *name##_delete(struct name *map, const key_t *key) {       \
+    map->oom = false;                                                          \
+    size_t i = hash_fn(key) & map->mask;                                       \
+    for (uint32_t dib = 1;; i = (i + 1) & map->mask, dib++) {                  \
+        struct name##_bucket *bucket = &map->buckets[i];                       \
+        if (bucket->dib < dib) {                                               \
+            return NULL;                                                       \
+        }                                                                      \
+        if (bucket->dib == dib && eq_fn(&bucket->key, key)) {                  \
+            break;                                                             \
+        }                                                                      \
+    }                                                                          \
+    map->spare = map->buckets[i].val;                                          \
+    /* the items after it move one bucket back, closer to their home */       \
+    for (;;) {                                                                 \
+        struct name##_bucket *next = &map->buckets[(i + 1) & map->mask];       \
+        if (next->dib <= 1) {                                                  \
+            map->buckets[i].dib = 0;                                           \
+            break;                                                             \
+        }                                                                      \
+        map->buckets[i] = *next;                                               \
+        map->buckets[i].dib--;                                                 \
+        i = (i + 1) & map->mask;                                               \
+    }                                                                          \
+    map->count--;                                                              \
+    if (map->nbuckets > map->cap && map->count <= map->shrinkat &&             \
+        name##_resize(map, map->nbuckets / 2)) {                               \
+        map->resizes++;                                                        \
+    }                                                                          \
+    return &map->spare;                                                        \
+}                                                                              \
+                                                                               \
+static inline bool name##_iter(struct name *map, size_t *i, key_t **key,       \
+                               val_t **val) {                                  \
+    for (; *i < map->nbuckets; (*i)++) {                                       \
+        if (map->buckets[*i].dib) {                                            \
+            *key = &map->buckets[*i].key;                                      \
+            *val = &map->buckets[*i].val;                                      \
+            (*i)++;                                                            \
+            return true;                                                       \
+        }                                                                      \
+    }                                                                          \
+    return false;                                                              \
+}                                                                              \
+                                                                               \
+static inline void name##_stats(struct name *map,                              \
+                                struct hashmap_stats *stats) {                 \
+    size_t total = 0;                                                          \
+    memset(stats, 0, sizeof(*stats));                                          \
+    stats->count = map->count;                                                 \
+    stats->nbuckets = map->nbuckets;                                           \
+    stats->resizes = map->resizes;                                             \
+    stats->memory = map->nbuckets * sizeof(struct name##_bucket);              \
+    for (size_t i = 0; i < map->nbuckets; i++) {                               \
+        uint32_t dib = map->buckets[i].dib;                                    \
+        total += dib;                                                          \
+        if (dib > stats->max_probe) {                                          \
+            stats->max_probe = dib;                                            \
+        }                                                                      \
+    }                                                                          \
+    stats->avg_probe = map->count ? (double) total / (double) map->count : 0;  \
+}
+
+#endif
@@ -8,43 +8,100 @@
 #include <getopt.h>
 #include <strings.h>
 #include <ctype.h>
+#include <limits.h>
 #include <time.h>
 #include <signal.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include "hash.h"
+#include "hash_typed.h"
+#include "arena.h"
+#include "topo.h"
+#include "stats.h"
+#include "render.h"
+#include "stream.h"
+#include "serve.h"
+#include "path.h"
+#include "watch.h"
+#include "decompress.h"
+#include "scan.h"
+#include "digits.h"
 
 #define DEBUG 0 // if set 1, app will output debug values while parsing topology file
 #define debug_print(fmt, ...) \
             do { if (DEBUG) printf(fmt, __VA_ARGS__); } while (0)
 #define TOPOLOGY_DUMP_NAME   "topology.last"
-#define SW_SSCANF_FMT     "Switch\t%d %s"
-#define SW_SSCANF_CON_FMT "[%d]\t%20s[%d]%18s"
-#define CA_SSCANF_FMT     "Ca\t%d %s"
-#define CA_SSCANF_CON_FMT "[%d]%20s\t%20s[%d]"
+#define TOPOLOGY_SNAPSHOT_NAME "topology.snap"
+#define TOPOLOGY_GUIDS_NAME "topology.guids" /* GUID index of the snapshot */
 #define PROGNAME "topo_parser"
-#define MAXLINE 1024
 #define FREE(x) do { if(x) { free(x); x = NULL; } } while(0);
 #define NODE_DESC_LEN 64
 #define GUID_LEN 20
 #define WSPEED_LEN 8
-#define VALUE_LEN 38
 /* defining colors for progress bar */
 #define BLU   "\x1B[34m"
 #define RESET "\x1B[0m"
 /* High intensty background */
 #define GRNHB "\e[0;102m"
 #define BILLION  1000000000L;
-struct hashmap *map; /* Here is hash table where device guids will be saved */
-struct timespec start, end; /* Variables for calculating function execution duration */
-static unsigned int device_counter = 0; /* Keeping here parsed devices counter for statistics */
-static long int line_counter = 0; /* Keeping here line counters for detailed statistic (TBD) */
-/* device types */
-typedef enum {
-    SW, CADAPTER
-} DEV_TYPE;
-/* base port types */
-typedef enum {
-    ENHANCED, BASE
-} PORT_TYPE;
+#define PROGRESS_STEP (256 * 1024) /* bytes a parser thread goes through before updating the shared progress */
+#define PROGRESS_INTERVAL_MS 200 /* how often the progress bar is redrawn */
+#define SERVE_CHECK_MS 1000 /* --serve: how often the topology file is checked for changes */
+#define WATCH_SETTLE_MS 500 /* --watch: the file is parsed once it was not written for this long */
+#define BYTES_PER_DEVICE 320 /* fewest bytes a device block takes, a 1-port adapter, for sizing the GUID table */
+#define MALFORMED_SHOWN 5 /* malformed values told about one by one, by each parser thread */
+/* Parser state is thread-local: every -j worker fills its own device list and hash table,
+ * which are merged into the ones of the main thread afterwards */
+__thread struct guid_map *map; /* Here is hash table where device guids will be saved */
+struct timespec start, end; /* Variables for calculating function execution duration, monotonic clock */
+static __thread unsigned int device_counter = 0; /* Keeping here parsed devices counter for statistics */
+static __thread long int line_counter = 0; /* Keeping here line counters for detailed statistic (TBD) */
+static bool use_mmap = false; /* map the topology file instead of reading it line by line */
+static unsigned int parse_threads = 1; /* number of threads parsing the file, set by -j */
+static volatile sig_atomic_t interrupted = 0; /* signal caught, the loops stop and what was read is saved */
+static unsigned int render_threads = 0; /* threads rendering the dump, one per online CPU unless -j is given */
+static bool incremental = false; /* reuse device blocks not changed since the previous run, set by --incremental */
+static __thread bool hash_blocks = false; /* lines come from the mapped file, so device blocks can be hashed */
+static __thread const char *block_start = NULL; /* first line of the device block being parsed */
+static __thread unsigned int blocks_reused = 0; /* device blocks taken from the previous snapshot */
+static __thread unsigned int malformed_values = 0; /* ids and GUIDs of attribute lines that are not hex numbers */
+static bool stats_json = false; /* --stats format, text otherwise */
+static size_t worker_map_resizes = 0; /* resizes of the GUID tables of -j workers */
+static bool keep_warm = false; /* the file is parsed again later, memory of a parse is kept for the next one */
+static char *stdio_line = NULL; /* getline() buffer, lines split between buffers of compressed input are joined in it */
+static size_t stdio_line_size = 0;
+static COMPRESS_TYPE input_compression = COMPRESS_NONE;
+/* progress of the parse: parser threads add to it every PROGRESS_STEP bytes, the reporter thread draws it */
+struct progress {
+    long int bytes;
+    long int lines;
+    unsigned int devices;
+};
+static struct progress progress;
+static __thread long int unpublished_bytes = 0; /* parsed by the thread but not yet in the progress */
+static __thread long int published_lines = 0;
+static __thread unsigned int published_devices = 0;
+/* progress bar reporter, it runs only when stdout is a terminal */
+static pthread_t reporter;
+static pthread_mutex_t reporter_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t reporter_wake = PTHREAD_COND_INITIALIZER;
+static bool reporter_running = false;
+static bool reporter_stop = false;
+static long int progress_total = 0; /* size of the topology file */
+/* long-only options */
+enum {
+    OPT_MMAP = 256,
+    OPT_INCREMENTAL,
+    OPT_STATS,
+    OPT_SERVE,
+    OPT_PATH,
+    OPT_HOPS,
+    OPT_WATCH
+};
 /* connection data */
 struct connection {
     int lport;
@@ -76,42 +133,213 @@ struct ibdevice {
     int64_t devguid;
     char node_desc[NODE_DESC_LEN + 1];
     struct connection *connections;
+    struct connection *connections_tail;
+    uint64_t block_hash; /* content hash of the device block in the file, 0 if unknown */
+    bool block_hashed; /* a block has been hashed for the device already */
+    bool reused; /* --incremental: unchanged blocks of devices prev_index .. prev_index + reused_count - 1 */
+    uint32_t prev_index; /* of the previous snapshot */
+    uint32_t reused_count;
     struct ibdevice *next;
 };
+/* key of the GUID table, node GUID string "S-<16 hex digits>" or "H-<16 hex digits>" decoded,
+ * the value is the position of the device in the device list
+ * */
 struct guid {
-    char key[GUID_LEN + 1];
-    char value[VALUE_LEN + 1];
+    uint64_t key;   /* the 16 hex digits */
+    char type;      /* 'S' or 'H' */
+};
+/* copy of the device block being parsed, for lines read with getline() which do not stay in memory */
+struct block_buffer {
+    char *data;
+    size_t len;
+    size_t cap;
+    bool active;
+};
+static __thread struct block_buffer line_block;
+static __thread struct scan_line line_scan; /* structural characters of the device or link line being parsed */
+/* device block of the previous run, keyed by its content hash */
+struct block_ref {
+    uint64_t hash;
+    uint32_t index; /* device of the previous snapshot */
+};
+/* (pointer, length) window into the input, it is never NUL-terminated */
+struct view {
+    const char *ptr;
+    size_t len;
 };
 /* variables for playing with device lists */
-struct ibdevice *dev_temp = NULL, *dev_list = NULL;
+__thread struct ibdevice *dev_temp = NULL, *dev_list = NULL, *dev_tail = NULL;
+/* finalized topology, built from the device list once parsing is done */
+struct topo_graph graph;
+/* previous run for --incremental, mapped from its snapshot, and its device blocks */
+struct topo_graph prev_graph;
+struct topo_snapshot prev_snap;
+struct hashmap *prev_blocks = NULL;
+struct hashmap *prev_guids = NULL; /* GUID index of the previous snapshot, struct topo_guid_ref */
+/* -f -: dump written while stdin is read */
+struct stream *stream = NULL;
+
+struct server *server = NULL;
+/* devices and connections of the current parse live here and are released together */
+__thread struct arena *arena = NULL;
 /* file handle for topology file */
 FILE *th;
+/* byte range of the topology file parsed by one -j worker */
+struct parse_chunk {
+    pthread_t thread;
+    const char *begin;
+    const char *end;
+    /* worker results, handed over to the main thread when the worker is done */
+    struct ibdevice *dev_list;
+    struct ibdevice *dev_tail;
+    struct arena *arena;
+    struct guid_map *map;
+    unsigned int device_counter;
+    long int line_counter;
+    unsigned int blocks_reused;
+    unsigned int malformed_values;
+    struct parse_stats stats;
+};
 
-extern void save_device_info(char key[], char value[]);
+extern void save_device_info(const char key[], uint32_t index);
 
 //
-int guid_compare(const void *a, const void *b, void *udata) {
+static inline bool guid_equal(const struct guid *a, const struct guid *b) {
+    return a->key == b->key && a->type == b->type;
+}
+
+/* GUIDs are dense in their low bits, so they are spread with the 64-bit finalizer of MurmurHash3 */
+static inline uint64_t guid_hash(const struct guid *g) {
+    uint64_t h = g->key ^ ((uint64_t) (unsigned char) g->type << 56);
+    h ^= h >> 33;
+    h *= UINT64_C(0xff51afd7ed558ccd);
+    h ^= h >> 33;
+    h *= UINT64_C(0xc4ceb9fe1a85ec53);
+    h ^= h >> 33;
+    return h;
+}
+
+/* the GUID table is looked up for every link, its hash and compare are inlined */
+HASHMAP_DEFINE(guid_map, struct guid, uint32_t, guid_hash, guid_equal)
+
+int block_ref_compare(const void *a, const void *b, void *udata) {
     (void)udata;
-    const struct guid *ua = a;
-    const struct guid *ub = b;
-    return strcmp(ua->key, ub->key);
+    const struct block_ref *ba = a;
+    const struct block_ref *bb = b;
+    return (ba->hash == bb->hash) ? 0 : (ba->hash < bb->hash) ? -1 : 1;
+}
+
+/* the key is a content hash already */
+uint64_t block_ref_hash(const void *item, uint64_t seed0, uint64_t seed1) {
+    (void)seed1;
+    return ((const struct block_ref *) item)->hash ^ seed0;
+}
+
+/* content hash of a device block, 0 is kept for "unknown" */
+uint64_t block_hash(const char *p, size_t len) {
+    uint64_t h = hashmap_murmur(p, len, 0, 0);
+    return h ? h : 1;
+}
+
+/* decoding node GUID string "S-<16 hex digits>" into GUID table key */
+bool decode_node_guid(const char *s, struct guid *g) {
+    uint64_t key;
+    if (strnlen(s, HEX_DIGITS + 3) != HEX_DIGITS + 2 || s[1] != '-' || !hex16_decode(s + 2, &key)) {
+        return false;
+    }
+    g->key = key;
+    g->type = s[0];
+    return true;
+}
+
+/* make a view over len bytes starting at ptr */
+struct view make_view(const char *ptr, size_t len) {
+    struct view v = {ptr, len};
+    return v;
+}
+
+/* trim trailing whitespace of the view */
+struct view view_trim(struct view v) {
+    while (v.len > 0 && isspace((unsigned char) v.ptr[v.len - 1])) {
+        v.len--;
+    }
+    return v;
+}
+
+/* check if view begins with prefix */
+bool view_starts_with(struct view v, const char *prefix) {
+    size_t prefix_sz = strlen(prefix);
+    return v.len >= prefix_sz && !memcmp(v.ptr, prefix, prefix_sz);
+}
+
+/* strtok() for views: returns the next token of rest and moves rest past its delimiter,
+ * token.ptr is NULL when nothing is left
+ * */
+struct view view_tok(struct view *rest, const char *delims) {
+    struct view token = {NULL, 0};
+    size_t i = 0;
+    while (i < rest->len && strchr(delims, rest->ptr[i])) {
+        i++;
+    }
+    if (i == rest->len) {
+        *rest = make_view(rest->ptr + rest->len, 0);
+        return token;
+    }
+    token.ptr = rest->ptr + i;
+    while (i < rest->len && !strchr(delims, rest->ptr[i])) {
+        i++;
+    }
+    token.len = (size_t) (rest->ptr + i - token.ptr);
+    if (i < rest->len) {
+        i++; /* swallow the delimiter as strtok does */
+    }
+    *rest = make_view(rest->ptr + i, rest->len - i);
+    return token;
 }
 
-uint64_t guid_hash(const void *item, uint64_t seed0, uint64_t seed1) {
-    const struct guid *g = item;
-    return hashmap_sip(g->key, strlen(g->key), seed0, seed1);
+/* strtoull() for views */
+uint64_t view_strtoull(struct view v, int base) {
+    uint64_t retval = 0;
+    size_t i = 0;
+    while (i < v.len && isspace((unsigned char) v.ptr[i])) {
+        i++;
+    }
+    if (i < v.len && (v.ptr[i] == '+' || v.ptr[i] == '-')) {
+        i++;
+    }
+    if (base == 16 && i + 1 < v.len && v.ptr[i] == '0' && (v.ptr[i + 1] == 'x' || v.ptr[i + 1] == 'X')) {
+        i += 2;
+    }
+    for (; i < v.len; i++) {
+        int digit;
+        char c = v.ptr[i];
+        if (c >= '0' && c <= '9') {
+            digit = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            digit = c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            digit = c - 'A' + 10;
+        } else {
+            break;
+        }
+        if (digit >= base) {
+            break;
+        }
+        retval = retval * base + digit;
+    }
+    return retval;
 }
 
-/* trim string */
-char *trim(char *s) {
-    char *ptr;
-    if (!s)
-        return NULL;   // handle NULL string
-    if (!*s)
-        return s;      // handle empty string
-    for (ptr = s + strlen(s) - 1; (ptr >= s) && isspace(*ptr); --ptr);
-    ptr[1] = '\0';
-    return s;
+/* copy view into dst of given size the way snprintf(dst, size, "%s") does */
+void view_copy(char *dst, size_t size, struct view v) {
+    if (size == 0) {
+        return;
+    }
+    if (v.len > size - 1) {
+        v.len = size - 1;
+    }
+    memcpy(dst, v.ptr, v.len);
+    dst[v.len] = '\0';
 }
 
 /* check if file exits */
@@ -126,9 +354,10 @@ int file_exists(char *path) {
 }
 
 /* skip empty or commented lines to save time */
-bool skip_line(const char *line) {
+bool skip_line(struct view line) {
     bool retval = false;
-    if (line[0] == '#' || line[0] == '\n' || (line[0] == '\r' && line[1] == '\n')) {
+    if (line.len == 0 || line.ptr[0] == '#' || line.ptr[0] == '\n' ||
+        (line.ptr[0] == '\r' && line.len > 1 && line.ptr[1] == '\n')) {
         retval = true;
     }
     return retval;
@@ -137,28 +366,23 @@ bool skip_line(const char *line) {
 /* print usage and exit */
 void print_usage() {
     printf("Usage:\n\t%16s -f <topology file> --parse topology file\n"
+           "\t%16s -f - -- read topology from stdin, the dump is written while reading\n"
+           "\t%16s -f <topology file>.gz|.zst -- gzip or zstd compressed topology file is decompressed while parsing\n"
+           "\t%16s --mmap -f <topology file> -- parse topology file mapped into memory\n"
+           "\t%16s -j <threads> -f <topology file> -- parse mapped topology file with several threads\n"
+           "\t%16s --incremental -f <topology file> -- parse only device blocks changed since the last run\n"
+           "\t%16s --stats=json|text -f <topology file> -- report time of each phase and counters of the parse\n"
+           "\t%16s --serve <socket> -f <topology file> -- keep the topology in memory and answer queries "
+           "(guid, neighbors, lid, dump) on a Unix socket\n"
+           "\t%16s --watch -f <topology file> -- parse the file again whenever it is rewritten\n"
+           "\t%16s --path <GUID>,<GUID> -- print a shortest path between two devices of the parsed topology\n"
+           "\t%16s --hops [-j <threads>] -- hop counts between all switches of the parsed topology\n"
            "\t%16s -p -- print parsed topology\n"
-           "\t%16s -h -- print usage and exit\n", PROGNAME, PROGNAME, PROGNAME);
+           "\t%16s -h -- print usage and exit\n", PROGNAME, PROGNAME, PROGNAME, PROGNAME, PROGNAME, PROGNAME,
+           PROGNAME, PROGNAME, PROGNAME, PROGNAME, PROGNAME, PROGNAME, PROGNAME);
     exit(EXIT_SUCCESS);
 }
 
-/* remove custom character from string */
-char *remove_char(char *s, int ch) {
-    unsigned int i, j;
-    size_t len = strlen(s);
-
-    for (i = 0; i < len; i++) {
-        if (s[i] == ch) {
-            for (j = i; j < len; j++) {
-                s[j] = s[j + 1];
-            }
-            len--;
-            i--;
-        }
-    }
-    return s;
-}
-
 /* print message and exit */
 void die(const char *msg) {
     printf("%s\n", msg);
@@ -195,44 +419,18 @@ void dump_connections(struct connection *p) {
 }
 
 /* draws output as it is requested in the task description */
-void draw_output(struct ibdevice *p, FILE *desc) {
-    char *value = NULL;
-    struct guid *Guid, g;
+void draw_output(const struct topo_graph *g, FILE *desc) {
     if (desc == NULL) {
         desc = stdout;
     }
-    while (p != NULL) {
-        if (p->vid == 0x0 && p->did == 0x0 && p->sysimgguid == 0x0 && p->devguid == 0x0 && p->connections == NULL) {
-            return;
-        }
-        fprintf(desc, "%s:\n", (p->device_type == SW) ? "Switch" : "Host");
-        fprintf(desc, "sysimgguid: 0x%lx\n", p->sysimgguid);
-        fprintf(desc, "%s: 0x%lx",
-                (p->device_type == SW) ? "switch_id: " : "port_id: ", p->devguid);
-        if (p->device_type == SW) {
-            fprintf(desc, "(%lx)\n", p->portGUIDHex);
-        } else {
-            fprintf(desc, "\n");
-        }
-        struct connection *cp = p->connections->next;
-        while (cp != NULL) {
-            bzero(g.key, sizeof(g.key));
-            strncpy(g.key, cp->nodeGUIDHex, GUID_LEN);
-            Guid = hashmap_get(map,&g);
-            if (NULL != Guid) {
-                value = Guid->value;
-            }
-            fprintf(desc, "\tConnected to %s: %s=%s",
-                    (cp->nodeGUIDHex[0] == 'S') ? "switch" : "host",
-                    (cp->nodeGUIDHex[0] == 'S') ? "switchguid" : "caguid",
-                    value);
-
-            fprintf(desc, ", port=%d\n", cp->rport);
-            cp = cp->next;
-        }
-
-        fprintf(desc, "\n");
-        p = p->next;
+    /* whatever the stream holds goes first, the dump is written to its descriptor directly */
+    fflush(desc);
+    if (render_threads == 0) {
+        long int cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        render_threads = (cpus > 0) ? (unsigned int) cpus : 1;
+    }
+    if (!topo_render(g, fileno(desc), render_threads)) {
+        die("Could not write the topology\n");
     }
 }
 
@@ -274,122 +472,366 @@ __attribute__((unused)) void dump_devices(struct ibdevice *p) {
     }
 }
 
-/* preparing memory for devices */
-void create_ibdevice_list() {
-    dev_list = (struct ibdevice *) malloc(sizeof(struct ibdevice));
-    if (!dev_list) {
+/* allocate zeroed record from the arena of the current parse */
+void *alloc_record(size_t size) {
+    void *record = arena_alloc(arena, size);
+    if (!record) {
         die("Cannot allocate memory!");
     }
+    return record;
+}
+
+/* preparing memory for devices */
+void create_ibdevice_list() {
+    dev_list = dev_tail = (struct ibdevice *) alloc_record(sizeof(struct ibdevice));
+}
+
+/* fixed-width part of the record of device d */
+void set_topo_node(struct topo_node *node, const struct ibdevice *d) {
+    node->sysimgguid = (uint64_t) d->sysimgguid;
+    node->devguid = (uint64_t) d->devguid;
+    node->portguid = (uint64_t) d->portGUIDHex;
+    node->block_hash = d->block_hash;
+    node->vid = (uint32_t) d->vid;
+    node->did = (uint32_t) d->did;
+    node->ports_total = d->ports_total;
+    node->base_port_no = d->base_port_no;
+    node->lid = d->lid;
+    node->lmc = d->lmc;
+    node->type = (uint8_t) d->device_type;
+    node->base_port_type = (uint8_t) d->base_port_type;
 }
 
-/* copying linked list with connections data */
-struct connection *copy_connections(struct connection *c) {
-    if (c == NULL) {
-        return c;
+/* -f -: handing device d over to the stream, the records of the parse are not needed after that */
+void stream_ibdevice(struct ibdevice *d) {
+    struct topo_node node;
+    struct guid g;
+    struct stream_key key = {0, 0};
+    struct connection *cp;
+    uint32_t n = 0;
+    memset(&node, 0, sizeof(node));
+    set_topo_node(&node, d);
+    for (cp = d->connections ? d->connections->next : NULL; cp != NULL; cp = cp->next) {
+        n++;
+    }
+    struct topo_edge *edges = (struct topo_edge *) alloc_record(n * sizeof(struct topo_edge));
+    struct stream_key *keys = (struct stream_key *) alloc_record(n * sizeof(struct stream_key));
+    n = 0;
+    for (cp = d->connections ? d->connections->next : NULL; cp != NULL; cp = cp->next, n++) {
+        memset(&g, 0, sizeof(g));
+        if (decode_node_guid(cp->nodeGUIDHex, &g)) {
+            keys[n].guid = g.key;
+            keys[n].type = g.type;
+        }
+        edges[n].rport = cp->rport;
+        edges[n].remote_type = (uint8_t) ((cp->nodeGUIDHex[0] == 'S') ? SW : CADAPTER);
+    }
+    memset(&g, 0, sizeof(g));
+    if (decode_node_guid(d->nodeGUIDHex, &g)) {
+        key.guid = g.key;
+        key.type = g.type;
     }
-    struct connection *targetList = (struct connection *) malloc(sizeof(struct connection));
-    if (!targetList) {
-        die("Cannot allocate memory");
+    if (!stream_add(stream, &node, key, edges, keys, n)) {
+        die("Could not write the topology\n");
     }
-    targetList->lport = c->lport;
-    targetList->rport = c->rport;
-    targetList->llid = c->llid;
-    targetList->llmc = c->llmc;
-    targetList->rlid = c->rlid;
-    targetList->device_type = c->device_type;
-    strncpy(targetList->nodeGUIDHex, c->nodeGUIDHex, GUID_LEN);
-    strncpy(targetList->portGUIDHex, c->portGUIDHex, GUID_LEN);
-    strncpy(targetList->node_desc, c->node_desc, NODE_DESC_LEN);
-    strncpy(targetList->widthspeed, c->widthspeed, WSPEED_LEN);
-    targetList->next = copy_connections(c->next);
-    return targetList;
+    arena_reset(arena);
 }
 
-/* adding device to the list */
+/* adding device to the list, the arena keeps owning its memory, so it is just handed over */
 void add_ibdevice() {
     if (!dev_temp ||
-        (dev_temp->vid == 0x0 && dev_temp->did == 0x0 && dev_temp->sysimgguid == 0x0 && dev_temp->devguid == 0x0 &&
-         dev_temp->connections == NULL)) {
+        (!dev_temp->reused && dev_temp->vid == 0x0 && dev_temp->did == 0x0 && dev_temp->sysimgguid == 0x0 &&
+         dev_temp->devguid == 0x0 && dev_temp->connections == NULL)) {
         return;
     }
-    struct ibdevice *last = dev_list;
-    struct ibdevice *new_node = (struct ibdevice *) malloc(sizeof(struct ibdevice));
-    if (!new_node) {
-        die("Cannot allocate memory");
+    struct ibdevice *new_node = dev_temp;
+    dev_temp = NULL;
+    if (stream) {
+        stream_ibdevice(new_node);
+        device_counter++;
+        return;
     }
 
-    memcpy(new_node, dev_temp, sizeof(struct ibdevice));
-    if (new_node->connections != NULL) {
-        new_node->connections = copy_connections(dev_temp->connections);
-    }
     new_node->next = NULL;
     if (dev_list == NULL) {
-        dev_list = new_node;
+        dev_list = dev_tail = new_node;
         return;
     }
-    while (last->next != NULL) {
-        last = last->next;
-    }
-    last->next = new_node;
+    dev_tail->next = new_node;
+    dev_tail = new_node;
     //
     device_counter++;
+}
+
+/* speeds already pooled, a fabric has only a few of them */
+#define SPEED_CACHE_SIZE 8
+struct speed_cache {
+    char speed[SPEED_CACHE_SIZE][WSPEED_LEN + 1];
+    uint32_t offset[SPEED_CACHE_SIZE];
+    int count;
+};
+
+static uint32_t pool_speed(struct string_pool *pool, struct speed_cache *cache, const char *speed) {
+    for (int i = 0; i < cache->count; i++) {
+        if (!strcmp(cache->speed[i], speed)) {
+            return cache->offset[i];
+        }
+    }
+    uint32_t offset = string_pool_add(pool, speed);
+    if (cache->count < SPEED_CACHE_SIZE) {
+        strcpy(cache->speed[cache->count], speed);
+        cache->offset[cache->count++] = offset;
+    }
+    return offset;
+}
+
+/* pooling the strings of a link. The strings of a resolved remote device are pooled with its node already,
+ * so its name and description are taken from there, as is a port GUID that is the name without the
+ * "S-"/"H-" prefix, only the other strings are looked up in the pool
+ * */
+static void pool_edge_strings(struct string_pool *pool, struct speed_cache *speeds, const struct topo_node *peer,
+                              const struct connection *cp, struct topo_edge *edge) {
+    if (peer && !strcmp(string_pool_str(pool, peer->name), cp->nodeGUIDHex)) {
+        edge->node_guid = peer->name;
+        if (cp->portGUIDHex[0] == '\0') {
+            edge->port_guid = 0;
+        } else if (!strcmp(string_pool_str(pool, peer->name) + 2, cp->portGUIDHex)) {
+            edge->port_guid = peer->name + 2;
+        } else {
+            edge->port_guid = string_pool_add(pool, cp->portGUIDHex);
+        }
+    } else {
+        edge->node_guid = string_pool_add(pool, cp->nodeGUIDHex);
+        edge->port_guid = string_pool_add(pool, cp->portGUIDHex);
+    }
+    if (peer && !strcmp(string_pool_str(pool, peer->desc), cp->node_desc)) {
+        edge->desc = peer->desc;
+    } else {
+        edge->desc = string_pool_add(pool, cp->node_desc);
+    }
+    edge->speed = pool_speed(pool, speeds, cp->widthspeed);
+}
+
+/* --incremental: device of the previous snapshot as seen from the graph being built */
+struct prev_device {
+    int32_t index; /* device of the graph taken from it, -1 if its block is gone or has changed */
+    bool shadowed; /* a parsed block has the same GUID, links to it are resolved again */
+};
+
+/* device index of a link to the node GUID string s, -1 if the topology does not describe it.
+ * Parsed devices are in the GUID table, with --incremental those taken from the previous snapshot are found
+ * through its GUID index instead, the later device wins as later lines do
+ * */
+static int32_t resolve_link(const char *s, const struct prev_device *prev, uint32_t ndevices) {
+    struct guid key;
+    int32_t peer = -1;
+    memset(&key, 0, sizeof(key));
+    if (!decode_node_guid(s, &key)) {
+        return -1;
+    }
+    uint32_t *index = guid_map_get(map, &key);
+    if (index != NULL && *index < ndevices) {
+        peer = (int32_t) *index;
+    }
+    if (prev) {
+        const struct topo_guid_ref *ref = guid_index_find(prev_guids, &prev_graph, key.key, key.type);
+        /* the table only holds names of the exact form, as a link to a shorter one was not resolved */
+        if (ref && prev[ref->index].index > peer &&
+            strlen(TOPO_STR(&prev_graph, prev_graph.nodes[ref->index].name)) == HEX_DIGITS + 2) {
+            peer = prev[ref->index].index;
+        }
+    }
+    return peer;
+}
+
+/* finalizing the parse: device list is turned into CSR graph with links resolved to device indices.
+ * The strings of all devices are pooled first, so that links can share them with the devices they lead to.
+ * With --incremental the nodes and links of unchanged blocks are copied from the previous snapshot with its
+ * strings, which the pool starts with, only links to devices that are gone, changed or parsed are resolved again.
+ * Strings replaced by later runs stay in the pool until they make up a quarter of it, it is built from scratch then
+ * */
+void build_topology_graph(struct ibdevice *p, struct topo_graph *g) {
+    struct guid key;
+    struct ibdevice *d;
+    struct connection *cp;
+    struct speed_cache speeds = {.count = 0};
+    struct prev_device *prev = NULL;
+    bool repool = false;
+    uint32_t n = 0, e = 0;
+    if (prev_guids) {
+        prev = malloc(prev_graph.ndevices * sizeof(struct prev_device) + 1);
+        if (!prev) {
+            die("Cannot allocate memory!");
+        }
+        for (uint32_t i = 0; i < prev_graph.ndevices; i++) {
+            prev[i].index = -1;
+            prev[i].shadowed = false;
+        }
+        repool = prev_graph.strings_appended > prev_graph.strings_size / 4;
+    }
+    struct string_pool *pool = (prev && !repool) ? string_pool_new_from(prev_graph.strings, prev_graph.strings_size)
+                                                 : string_pool_new();
+    if (!pool) {
+        die("Cannot allocate memory!");
+    }
+    for (d = p; d != NULL; d = d->next) {
+        if (d->reused) {
+            n += d->reused_count;
+            e += prev_graph.offsets[d->prev_index + d->reused_count] - prev_graph.offsets[d->prev_index];
+            continue;
+        }
+        n++;
+        for (cp = d->connections ? d->connections->next : NULL; cp != NULL; cp = cp->next) {
+            e++;
+        }
+    }
+    g->ndevices = n;
+    g->nedges = e;
+    g->nodes = (struct topo_node *) alloc_record(n * sizeof(struct topo_node));
+    g->offsets = (uint32_t *) alloc_record((n + 1) * sizeof(uint32_t));
+    g->edges = (struct topo_edge *) alloc_record(e * sizeof(struct topo_edge));
+    n = e = 0;
+    for (d = p; d != NULL; d = d->next) {
+        if (d->reused) {
+            uint32_t first = d->prev_index, base = prev_graph.offsets[first];
+            memcpy(&g->nodes[n], &prev_graph.nodes[first], d->reused_count * sizeof(struct topo_node));
+            for (uint32_t i = first; i < first + d->reused_count; i++, n++) {
+                if (repool) {
+                    g->nodes[n].name = string_pool_add(pool, TOPO_STR(&prev_graph, g->nodes[n].name));
+                    g->nodes[n].desc = string_pool_add(pool, TOPO_STR(&prev_graph, g->nodes[n].desc));
+                }
+                g->offsets[n] = e + prev_graph.offsets[i] - base;
+                prev[i].index = (int32_t) n;
+            }
+            e += prev_graph.offsets[first + d->reused_count] - base;
+            continue;
+        }
+        struct topo_node *node = &g->nodes[n];
+        set_topo_node(node, d);
+        node->name = string_pool_add(pool, d->nodeGUIDHex);
+        node->desc = string_pool_add(pool, d->node_desc);
+        if (prev) {
+            memset(&key, 0, sizeof(key));
+            const struct topo_guid_ref *ref = decode_node_guid(d->nodeGUIDHex, &key) ?
+                                              guid_index_find(prev_guids, &prev_graph, key.key, key.type) : NULL;
+            if (ref) {
+                prev[ref->index].shadowed = true;
+            }
+        }
+        g->offsets[n++] = e;
+        for (cp = d->connections ? d->connections->next : NULL; cp != NULL; cp = cp->next) {
+            e++;
+        }
+    }
+    g->offsets[n] = e;
+    e = 0;
+    for (d = p; d != NULL; d = d->next) {
+        if (d->reused) {
+            const struct topo_edge *pe = &prev_graph.edges[prev_graph.offsets[d->prev_index]];
+            const struct topo_edge *pend = &prev_graph.edges[prev_graph.offsets[d->prev_index + d->reused_count]];
+            memcpy(&g->edges[e], pe, (size_t) (pend - pe) * sizeof(struct topo_edge));
+            for (; pe < pend; pe++, e++) {
+                struct topo_edge *edge = &g->edges[e];
+                if (pe->peer >= 0 && prev[pe->peer].index >= 0 && !prev[pe->peer].shadowed) {
+                    edge->peer = prev[pe->peer].index;
+                } else {
+                    edge->peer = resolve_link(TOPO_STR(&prev_graph, pe->node_guid), prev, g->ndevices);
+                }
+                if (repool) {
+                    edge->node_guid = string_pool_add(pool, TOPO_STR(&prev_graph, pe->node_guid));
+                    edge->port_guid = string_pool_add(pool, TOPO_STR(&prev_graph, pe->port_guid));
+                    edge->desc = string_pool_add(pool, TOPO_STR(&prev_graph, pe->desc));
+                    edge->speed = pool_speed(pool, &speeds, TOPO_STR(&prev_graph, pe->speed));
+                }
+            }
+            continue;
+        }
+        for (cp = d->connections ? d->connections->next : NULL; cp != NULL; cp = cp->next, e++) {
+            struct topo_edge *edge = &g->edges[e];
+            edge->peer = resolve_link(cp->nodeGUIDHex, prev, g->ndevices);
+            edge->lport = cp->lport;
+            edge->rport = cp->rport;
+            edge->llid = cp->llid;
+            edge->llmc = cp->llmc;
+            edge->rlid = cp->rlid;
+            pool_edge_strings(pool, &speeds, edge->peer >= 0 ? &g->nodes[edge->peer] : NULL, cp, edge);
+            edge->remote_type = (uint8_t) ((cp->nodeGUIDHex[0] == 'S') ? SW : CADAPTER);
+        }
+    }
+    if (string_pool_oom(pool)) {
+        die("Cannot allocate memory!");
+    }
+    g->strings = string_pool_release(pool, &g->strings_size);
+    g->strings_appended = (prev && !repool) ? prev_graph.strings_appended + (g->strings_size - prev_graph.strings_size)
+                                            : 0;
+    FREE(prev);
+}
 
-    FREE(dev_temp->connections);
-    FREE(dev_temp);
+/* decoding the hex value of an attribute, a malformed one is told about and left out
+ * instead of being taken as far as it goes
+ * */
+bool decode_hex_value(const char *param, struct view v, uint64_t *out) {
+    while (v.len > 0 && isspace((unsigned char) v.ptr[0])) {
+        v = make_view(v.ptr + 1, v.len - 1);
+    }
+    if (hex_decode(v.ptr, v.len, out)) {
+        return true;
+    }
+    if (malformed_values++ < MALFORMED_SHOWN) {
+        fprintf(stderr, "\nMalformed %s value \"%.*s\"\n", param, (int) v.len, v.ptr);
+    }
+    return false;
 }
 
 /* getting parameters separated by '=' in  from topology file */
-int64_t get_param_val(char *line, const char *param) {
-    size_t param_sz = strlen(param);
-    size_t line_sz = strlen(line);
+int64_t get_param_val(struct view line, const char *param) {
     int64_t retval = -1;
-    if (line_sz < param_sz) {
-        retval = -1;
-    } else if (!memcmp(line, param, param_sz)) {
+    uint64_t val;
+    if (view_starts_with(line, param)) {
         const char *delim = "=";
-        char *token = strtok(line, delim);
-        if (!token) {
+        struct view token = view_tok(&line, delim);
+        if (!token.ptr) {
             return -1;
         }
-        token = strtok(NULL, delim);
-        if (0 != strcmp(token, "")) {
-            retval = (int64_t) strtoull(token, NULL, 16);
+        token = view_tok(&line, delim);
+        if (decode_hex_value(param, token.ptr ? token : make_view(line.ptr, 0), &val)) {
+            retval = (int64_t) val;
         }
     }
     return retval;
 }
 
 /* getting pair of switch and port GUIDS from topology file for each device */
-int64_t *get_switch_port_guid_hex(char *line) {
-    static int64_t retval[2] = {-1, -1};
-    if (!memcmp(line, "switchguid", 10)) {
+bool get_switch_port_guid_hex(struct view line, int64_t retval[2]) {
+    retval[0] = retval[1] = -1;
+    if (view_starts_with(line, "switchguid")) {
         const char *delim = "=";
-        char *token = strtok(line, delim);
-        if (!token) {
-            return NULL;
+        struct view token = view_tok(&line, delim);
+        if (!token.ptr) {
+            return false;
         }
-        token = strtok(NULL, delim);
-        if (!token) {
-            return NULL;
+        token = view_tok(&line, delim);
+        if (!token.ptr) {
+            return false;
         }
-        char *swguid = strtok(token, "(");
-        if (swguid) {
-            retval[0] = (int64_t) strtoul(swguid, NULL, 16);
+        uint64_t val;
+        struct view swguid = view_tok(&token, "(");
+        if (swguid.ptr && decode_hex_value("switchguid", swguid, &val)) {
+            retval[0] = (int64_t) val;
         }
-        char *portguid = strtok(NULL, "(");
-        if (portguid) {
-            remove_char(portguid, ')');
-            retval[1] = (int64_t) strtoul(portguid, NULL, 16);
+        struct view portguid = view_tok(&token, ")");
+        if (portguid.ptr && decode_hex_value("switchguid", portguid, &val)) {
+            retval[1] = (int64_t) val;
         }
-        return retval;
+        return true;
     }
-    return NULL;
+    return false;
 }
 
 /* getting identificators for each device from topology file */
-void scan_device_ids(char *line) {
+void scan_device_ids(struct view line) {
     int64_t sysimgguid = 0, caguid = 0;
-    int64_t *switch_port_guids;
+    int64_t switch_port_guids[2];
 
     int venid = (int) get_param_val(line, "vendid");
     if (venid != -1) {
@@ -409,14 +851,13 @@ void scan_device_ids(char *line) {
         debug_print("-> sysimgguid: 0x%lx\n", dev_temp->sysimgguid);
     }
 
-    switch_port_guids = get_switch_port_guid_hex(line);
-    if (switch_port_guids) {
-        if (*switch_port_guids != -1) {
-            dev_temp->devguid = *switch_port_guids;
+    if (get_switch_port_guid_hex(line, switch_port_guids)) {
+        if (switch_port_guids[0] != -1) {
+            dev_temp->devguid = switch_port_guids[0];
             dev_temp->device_type = SW;
         }
-        if (*(switch_port_guids + 1) != -1) {
-            dev_temp->portGUIDHex = *(switch_port_guids + 1);
+        if (switch_port_guids[1] != -1) {
+            dev_temp->portGUIDHex = switch_port_guids[1];
         }
         debug_print("-> switchguid: 0x%lx(%lx)\n", dev_temp->devguid, dev_temp->portGUIDHex);
     }
@@ -429,188 +870,323 @@ void scan_device_ids(char *line) {
     }
 }
 
-/* getting device data from topology file */
-void scan_device_desc(char *line) {
-    int val = 0;
-    char *tmp;
-    const char *delim = "#";
-    char value[VALUE_LEN + 1] = {0};
-    if (memcmp(line, "Switch", 6) && memcmp(line, "Ca", 2)) {
-        return;
-    }
-    char *first_part = strtok(line, delim);
-    if (first_part) {
-        val = sscanf(line, ((dev_temp->device_type == SW)) ? SW_SSCANF_FMT : (dev_temp->device_type == CADAPTER)
-                                                                             ? CA_SSCANF_FMT : " ",
-                     &dev_temp->ports_total, dev_temp->nodeGUIDHex);
-        if (val == 2) {
-            remove_char(dev_temp->nodeGUIDHex, '"');
-            debug_print("-> %s %d\t\"%s\"\t\t#", (dev_temp->device_type == SW) ? "Switch" : "Ca",
-                        dev_temp->ports_total, dev_temp->nodeGUIDHex);
-
-            if (dev_temp->device_type == SW) {
-                snprintf(value, VALUE_LEN, "0x%lx(%lx)", dev_temp->devguid, dev_temp->portGUIDHex);
-            } else {
-                snprintf(value, VALUE_LEN, "0x%lx", dev_temp->devguid);
+/* how a token of the part after '#' is stored into the record */
+typedef enum {
+    TK_SKIP, TK_INT, TK_STR, TK_PORT_TYPE
+} TOKEN_KIND;
+
+/* destination of a token, tokens after '#' are positional */
+struct token_slot {
+    TOKEN_KIND kind;
+    void *dst;
+    size_t size; /* size of TK_STR destination */
+};
+
+/* states of the line tokenizers */
+typedef enum {
+    ST_LPORT,     /* inside [lport] */
+    ST_LOCAL,     /* between [lport] and "nodeGUID", (portGUID) of adapter ports is here */
+    ST_PORTGUID,  /* inside (portGUID) */
+    ST_NODEGUID,  /* inside "nodeGUID" */
+    ST_RPORT_OPEN,/* right after "nodeGUID", expecting [rport] */
+    ST_RPORT,     /* inside [rport] */
+    ST_REMOTE,    /* after [rport], (portGUID) of switch ports is here */
+    ST_KEYWORD,   /* "Switch" or "Ca" of device line */
+    ST_PORTS,     /* number of ports of device line */
+    ST_NAME,      /* "nodeGUID" of device line */
+    ST_HEAD_END,  /* skipping until '#' */
+    ST_GAP,       /* between tokens after '#' */
+    ST_QUOTED,    /* inside quoted token after '#' */
+    ST_WORD,      /* inside bare token after '#' */
+    ST_DONE
+} TOKENIZER_STATE;
+
+/* store one token into its slot */
+void commit_token(const struct token_slot *slot, const char *p, size_t len) {
+    switch (slot->kind) {
+        case TK_INT:
+            /* anything but plain digits is read as far as it goes */
+            if (!dec_decode(p, len, (int *) slot->dst)) {
+                *(int *) slot->dst = (int) view_strtoull(make_view(p, len), 10);
+            }
+            break;
+        case TK_STR:
+            view_copy(slot->dst, slot->size, make_view(p, len));
+            break;
+        case TK_PORT_TYPE:
+            if (len >= 8 && !memcmp(p, "enhanced", 8)) {
+                *(PORT_TYPE *) slot->dst = ENHANCED;
+            } else if (len >= 4 && !memcmp(p, "base", 4)) {
+                *(PORT_TYPE *) slot->dst = BASE;
             }
+            break;
+        default:
+            break;
+    }
+}
+
+/* next '"' of the part of the line after '#' at or after i, len if there is none */
+size_t find_quote(const char *p, size_t len, size_t i) {
+    if (p >= line_scan.ptr && p + len <= line_scan.ptr + line_scan.len) {
+        size_t base = (size_t) (p - line_scan.ptr);
+        size_t q = scan_find(&line_scan, SCAN_BIT(SCAN_QUOTE), base + i) - base;
+        return (q < len) ? q : len;
+    }
+    const char *q = memchr(p + i, '"', len - i);
+    return q ? (size_t) (q - p) : len;
+}
 
-            save_device_info(dev_temp->nodeGUIDHex, value);
+/* tokenize the part of the line after '#' into slots, quoted tokens may contain spaces */
+void tokenize_trailer(const char *p, size_t len, const struct token_slot *slots, int nslots) {
+    TOKENIZER_STATE state = ST_GAP;
+    size_t start = 0;
+    int slot = 0;
+    for (size_t i = 0; i < len && slot < nslots; i++) {
+        char ch = p[i];
+        switch (state) {
+            case ST_GAP:
+                if (ch == '"') {
+                    start = i + 1;
+                    state = ST_QUOTED;
+                } else if (ch != ' ' && ch != '\t') {
+                    start = i;
+                    state = ST_WORD;
+                }
+                break;
+            case ST_QUOTED:
+                i = find_quote(p, len, i);
+                if (i < len) {
+                    commit_token(&slots[slot++], p + start, i - start);
+                    state = ST_GAP;
+                }
+                break;
+            case ST_WORD:
+                if (ch == ' ' || ch == '\t') {
+                    commit_token(&slots[slot++], p + start, i - start);
+                    state = ST_GAP;
+                }
+                break;
+            default:
+                break;
         }
     }
-    char *second_part = strtok(NULL, delim);
-    if (second_part) {
-        strtok(second_part, "\"");
-        tmp = strtok(NULL, "\"");
-        if (tmp) {
-            snprintf(dev_temp->node_desc, NODE_DESC_LEN, "%s", tmp);
-            debug_print(" \"%s\"", dev_temp->node_desc);
+    if ((state == ST_WORD || state == ST_QUOTED) && slot < nslots) {
+        commit_token(&slots[slot], p + start, len - start);
+    }
+}
+
+/* getting device data from topology file,
+ * the line is "Switch|Ca\t<ports> \"<nodeGUID>\"\t\t# \"<desc>\" [enhanced|base port <n> lid <n> lmc <n>]"
+ * */
+void scan_device_desc(struct view line) {
+    if (!view_starts_with(line, "Switch") && !view_starts_with(line, "Ca")) {
+        return;
+    }
+    const char *keyword = (dev_temp->device_type == SW) ? "Switch" : "Ca";
+    const char *p = line.ptr;
+    TOKENIZER_STATE state = view_starts_with(line, keyword) ? ST_KEYWORD : ST_HEAD_END;
+    size_t i = strlen(keyword), start = 0;
+    bool have_ports = false, have_name = false;
+    if (state == ST_HEAD_END) {
+        i = 0;
+    }
+    scan_line(&line_scan, line.ptr, line.len);
+    dev_temp->ports_total = 0;
+    for (; i < line.len && state != ST_DONE; i++) {
+        char ch = p[i];
+        switch (state) {
+            case ST_KEYWORD:
+                if (isdigit((unsigned char) ch)) {
+                    dev_temp->ports_total = ch - '0';
+                    have_ports = true;
+                    state = ST_PORTS;
+                } else if (ch != ' ' && ch != '\t') {
+                    state = ST_HEAD_END;
+                    i--;
+                }
+                break;
+            case ST_PORTS:
+                if (isdigit((unsigned char) ch)) {
+                    dev_temp->ports_total = dev_temp->ports_total * 10 + ch - '0';
+                } else if (ch == ' ' || ch == '\t') {
+                    state = ST_GAP;
+                } else {
+                    state = ST_HEAD_END;
+                    i--;
+                }
+                break;
+            case ST_GAP: /* before the name */
+                if (ch == '#') {
+                    state = ST_DONE;
+                } else if (ch != ' ' && ch != '\t') {
+                    start = (ch == '"') ? i + 1 : i;
+                    state = ST_NAME;
+                }
+                break;
+            case ST_NAME:
+                if (ch == '"' || ch == ' ' || ch == '\t' || ch == '#') {
+                    view_copy(dev_temp->nodeGUIDHex, sizeof(dev_temp->nodeGUIDHex), make_view(p + start, i - start));
+                    have_name = true;
+                    state = (ch == '#') ? ST_DONE : ST_HEAD_END;
+                }
+                break;
+            case ST_HEAD_END:
+                i = scan_find(&line_scan, SCAN_BIT(SCAN_HASH), i);
+                if (i < line.len) {
+                    state = ST_DONE;
+                }
+                break;
+            default:
+                break;
         }
+    }
+    if (state == ST_NAME) {
+        view_copy(dev_temp->nodeGUIDHex, sizeof(dev_temp->nodeGUIDHex), make_view(p + start, i - start));
+        have_name = true;
+    }
+    if (have_ports && have_name) {
+        debug_print("-> %s %d\t\"%s\"\t\t#", (dev_temp->device_type == SW) ? "Switch" : "Ca",
+                    dev_temp->ports_total, dev_temp->nodeGUIDHex);
 
+        /* dev_temp is going to be the next device of the list */
+        save_device_info(dev_temp->nodeGUIDHex, device_counter);
+    }
+    if (state == ST_DONE) {
         if (dev_temp->device_type == SW) {
-            tmp = strtok(NULL, "\"");
-            tmp = strtok(tmp, " ");
-            if (tmp) {
-                if (0 == strncmp(tmp, "enhanced", 8)) {
-                    dev_temp->base_port_type = ENHANCED;
-                } else if (0 == strncmp(tmp, "base", 4)) {
-                    dev_temp->base_port_type = BASE;
-                }
-                debug_print(" %s port", (dev_temp->base_port_type == BASE) ? "base" : "enhanced");
-            }
-            tmp = strtok(NULL, " "); // skip "port"
-            tmp = strtok(NULL, " ");
-            if (tmp) {
-                dev_temp->base_port_no = (int) strtol(tmp, NULL, 10);
-                debug_print(" %d lid", dev_temp->base_port_no);
-            }
-            tmp = strtok(NULL, " "); // skip "lid"
-            tmp = strtok(NULL, " ");
-            if (tmp) {
-                dev_temp->lid = (int) strtol(tmp, NULL, 10);
-                debug_print(" %d lmc", dev_temp->lid);
-            }
-            tmp = strtok(NULL, " "); // skip "lmc"
-            tmp = strtok(NULL, " ");
-            if (tmp) {
-                dev_temp->lmc = (int) strtol(tmp, NULL, 10);
-                debug_print(" %d\n", dev_temp->lmc);
-            }
+            const struct token_slot slots[] = {
+                    {TK_STR,       dev_temp->node_desc,       NODE_DESC_LEN},
+                    {TK_PORT_TYPE, &dev_temp->base_port_type, 0},
+                    {TK_SKIP, NULL, 0}, /* "port" */
+                    {TK_INT,       &dev_temp->base_port_no,   0},
+                    {TK_SKIP, NULL, 0}, /* "lid" */
+                    {TK_INT,       &dev_temp->lid,            0},
+                    {TK_SKIP, NULL, 0}, /* "lmc" */
+                    {TK_INT,       &dev_temp->lmc,            0},
+            };
+            tokenize_trailer(p + i, line.len - i, slots, sizeof(slots) / sizeof(slots[0]));
+            debug_print(" \"%s\" %s port %d lid %d lmc %d\n", dev_temp->node_desc,
+                        (dev_temp->base_port_type == BASE) ? "base" : "enhanced",
+                        dev_temp->base_port_no, dev_temp->lid, dev_temp->lmc);
         } else {
-            debug_print("%s", "\n");
+            const struct token_slot slots[] = {
+                    {TK_STR, dev_temp->node_desc, NODE_DESC_LEN},
+            };
+            tokenize_trailer(p + i, line.len - i, slots, 1);
+            debug_print(" \"%s\"\n", dev_temp->node_desc);
         }
     }
 }
 
-/* parsing connections for each device */
-void scan_network_connections(char *line) {
-    int val;
-    char *tmp;
-
-    const char *delim = "#";
-    if (line[0] != '[') {
+/* parsing connections for each device, in one pass over the line:
+ * switch port:  "[lport]\t\"<nodeGUID>\"[rport](portGUID)\t\t# \"<desc>\" lid <n> <widthspeed>"
+ * adapter port: "[lport](portGUID) \t\"<nodeGUID>\"[rport]\t\t# lid <n> lmc <n> \"<desc>\" lid <n> <widthspeed>"
+ * */
+void scan_network_connections(struct view line) {
+    if (line.len == 0 || line.ptr[0] != '[') {
         return;
     }
     //
-    struct connection *last = dev_temp->connections;
-    struct connection *new_node = (struct connection *) malloc(sizeof(struct connection));
-    if (!new_node) {
-        die("Cannot allocate memory");
-    }
+    struct connection *new_node = (struct connection *) alloc_record(sizeof(struct connection));
     //
-    char *first_part = strtok(line, delim);
-    char *second_part = strtok(NULL, delim);
-
-    if (first_part) {
-        if (dev_temp->device_type == SW) {
-            val = sscanf(line, SW_SSCANF_CON_FMT, &new_node->lport, new_node->nodeGUIDHex,
-                         &new_node->rport, new_node->portGUIDHex);
-            if (val > 0) {
-                debug_print("-> [%d]\t%s[%d]", new_node->lport, new_node->nodeGUIDHex,
-                            new_node->rport);
-                if (new_node->portGUIDHex[0] != '\0') {
-                    debug_print("%s", new_node->portGUIDHex);
+    const char *p = line.ptr;
+    TOKENIZER_STATE state = ST_LPORT, paren_state = ST_LOCAL;
+    size_t i = 1, j, start = 0;
+    scan_line(&line_scan, line.ptr, line.len);
+    /* the tokenizer jumps from one structural character to the next, i is the first byte not looked at */
+    while (i < line.len && state != ST_DONE) {
+        switch (state) {
+            case ST_LPORT:
+            case ST_RPORT:
+                for (j = i; j < line.len && isdigit((unsigned char) p[j]); j++) {
+                    int *port = (state == ST_LPORT) ? &new_node->lport : &new_node->rport;
+                    *port = *port * 10 + p[j] - '0';
                 }
-                debug_print("\t\t#%s", " ");
-            }
-        } else if (dev_temp->device_type == CADAPTER) {
-            val = sscanf(line, CA_SSCANF_CON_FMT, &new_node->lport, new_node->portGUIDHex,
-                         new_node->nodeGUIDHex, &new_node->rport);
-            if (val == 4) {
-                debug_print("-> [%d]%s \t%s[%d]", new_node->lport, new_node->portGUIDHex,
-                            new_node->nodeGUIDHex, new_node->rport);
-            }
-            debug_print("\t\t#%s", " ");
+                if (j < line.len) {
+                    state = (p[j] != ']') ? ST_HEAD_END : (state == ST_LPORT) ? ST_LOCAL : ST_REMOTE;
+                }
+                i = j + 1;
+                break;
+            case ST_LOCAL:
+            case ST_REMOTE:
+                /* the node GUID is looked for left of the remote port only */
+                j = scan_find(&line_scan, SCAN_BIT(SCAN_LPAREN) | SCAN_BIT(SCAN_HASH) |
+                                          ((state == ST_LOCAL) ? SCAN_BIT(SCAN_QUOTE) : 0), i);
+                if (j < line.len && p[j] == '(') {
+                    paren_state = state;
+                    state = ST_PORTGUID;
+                } else if (j < line.len && p[j] == '"') {
+                    state = ST_NODEGUID;
+                } else if (j < line.len) {
+                    state = ST_DONE;
+                }
+                i = start = j + 1;
+                break;
+            case ST_PORTGUID:
+                j = scan_find(&line_scan, SCAN_BIT(SCAN_RPAREN), i);
+                if (j < line.len) {
+                    view_copy(new_node->portGUIDHex, sizeof(new_node->portGUIDHex), make_view(p + start, j - start));
+                    state = paren_state;
+                }
+                i = j + 1;
+                break;
+            case ST_NODEGUID:
+                j = scan_find(&line_scan, SCAN_BIT(SCAN_QUOTE), i);
+                if (j < line.len) {
+                    view_copy(new_node->nodeGUIDHex, sizeof(new_node->nodeGUIDHex), make_view(p + start, j - start));
+                    state = ST_RPORT_OPEN;
+                }
+                i = j + 1;
+                break;
+            case ST_RPORT_OPEN:
+                state = (p[i] == '[') ? ST_RPORT : ST_HEAD_END;
+                i++;
+                break;
+            case ST_HEAD_END:
+                j = scan_find(&line_scan, SCAN_BIT(SCAN_HASH), i);
+                if (j < line.len) {
+                    state = ST_DONE;
+                }
+                i = j + 1;
+                break;
+            default:
+                break;
         }
-        remove_char(new_node->nodeGUIDHex, '"');
-        remove_char(new_node->portGUIDHex, '(');
-        remove_char(new_node->portGUIDHex, ')');
     }
 
-    if (second_part) {
+    if (state == ST_DONE) {
         if (dev_temp->device_type == SW) {
-            strtok(second_part, "\"");
-            tmp = strtok(NULL, "\"");
-            if (tmp) {
-                snprintf(new_node->node_desc, NODE_DESC_LEN, "%s", tmp);
-            }
-            debug_print("\"%s\"", new_node->node_desc);
-            tmp = strtok(NULL, "\"");
-            tmp = strtok(tmp, " ");
-
-            if (tmp) {
-                new_node->llid = (int) strtoul(strtok(NULL, " "), NULL, 10);
-                debug_print(" lid %d", new_node->llid);
-            }
-            tmp = strtok(NULL, " ");
-            if (tmp) {
-                snprintf(new_node->widthspeed, WSPEED_LEN, "%s", tmp);
-            }
-            debug_print(" %s\n", new_node->widthspeed);
+            const struct token_slot slots[] = {
+                    {TK_STR, new_node->node_desc,  NODE_DESC_LEN},
+                    {TK_SKIP, NULL, 0}, /* "lid" */
+                    {TK_INT, &new_node->llid,      0},
+                    {TK_STR, new_node->widthspeed, WSPEED_LEN},
+            };
+            tokenize_trailer(p + i, line.len - i, slots, sizeof(slots) / sizeof(slots[0]));
         } else if (dev_temp->device_type == CADAPTER) {
-            tmp = strtok(second_part, " ");
-            debug_print("%s ", tmp);
-            tmp = strtok(NULL, " ");
-            if (tmp) {
-                new_node->llid = (int) strtoul(tmp, NULL, 10);
-            }
-            debug_print("%s ", tmp);
-            tmp = strtok(NULL, " ");
-            debug_print("%s ", tmp);
-            tmp = strtok(NULL, " ");
-            if (tmp) {
-                new_node->llmc = (int) strtoul(tmp, NULL, 10);
-            }
-            debug_print("%s ", tmp);
-            tmp = strtok(NULL, " ");
-            if (tmp) {
-                snprintf(new_node->node_desc, NODE_DESC_LEN, "%s", tmp);
-            }
-            debug_print("%s ", tmp);
-            tmp = strtok(NULL, " ");
-            debug_print("%s ", tmp);
-            tmp = strtok(NULL, " ");
-            if (tmp) {
-                new_node->rlid = (int) strtoul(tmp, NULL, 10);
-            }
-            debug_print("%s ", tmp);
-            tmp = strtok(NULL, " ");
-            if (tmp) {
-                snprintf(new_node->widthspeed, WSPEED_LEN, "%s", tmp);
-            }
-            debug_print("%s\n", tmp);
+            const struct token_slot slots[] = {
+                    {TK_SKIP, NULL, 0}, /* "lid" */
+                    {TK_INT, &new_node->llid,      0},
+                    {TK_SKIP, NULL, 0}, /* "lmc" */
+                    {TK_INT, &new_node->llmc,      0},
+                    {TK_STR, new_node->node_desc,  NODE_DESC_LEN},
+                    {TK_SKIP, NULL, 0}, /* "lid" */
+                    {TK_INT, &new_node->rlid,      0},
+                    {TK_STR, new_node->widthspeed, WSPEED_LEN},
+            };
+            tokenize_trailer(p + i, line.len - i, slots, sizeof(slots) / sizeof(slots[0]));
         }
-        remove_char(new_node->node_desc, '"');
     }
+    debug_print("-> [%d](%s) \"%s\"[%d] # lid %d lmc %d \"%s\" lid %d %s\n", new_node->lport, new_node->portGUIDHex,
+                new_node->nodeGUIDHex, new_node->rport, new_node->llid, new_node->llmc, new_node->node_desc,
+                new_node->rlid, new_node->widthspeed);
     new_node->device_type = dev_temp->device_type;
     new_node->next = NULL;
     if (dev_temp->connections == NULL) {
-        dev_temp->connections = new_node;
+        dev_temp->connections = dev_temp->connections_tail = new_node;
         return;
     }
-    while (last->next != NULL) {
-        last = last->next;
-    }
-    last->next = new_node;
+    dev_temp->connections_tail->next = new_node;
+    dev_temp->connections_tail = new_node;
     dev_temp->conn_counter++;
 }
 
@@ -619,182 +1195,1219 @@ void read_topology_from_file(char *file_name) {
     char *line = NULL;
     size_t len = 0;
     ssize_t read;
-    FILE *file;
-    if (file_exists(file_name)) {
-        file = fopen(file_name, "r");
-        while ((read = getline(&line, &len, file)) != -1) {
-            printf("%s", line);
-        }
+    FILE *file = file_exists(file_name) ? fopen(file_name, "r") : NULL;
+    if (file == NULL) {
+        return;
+    }
+    while ((read = getline(&line, &len, file)) != -1) {
+        printf("%s", line);
     }
+    free(line);
     fclose(file);
 }
 
-/* Save parsed topology data here for further use */
+/* Save parsed topology data here for further use,
+ * the dump is written next to the old one and renamed over it, readers never see a partial dump
+ * */
 void dump_topology_to_file(char *file_name) {
     FILE *file;
-    file = fopen(file_name, "w");
+    char tmp_name[PATH_MAX];
+    if (snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", file_name) >= (int) sizeof(tmp_name)) {
+        die("Could not open the file\n");
+    }
+    file = fopen(tmp_name, "w");
     if (file == NULL) {
         die("Could not open the file\n");
     }
-    draw_output(dev_list->next, file);
-    fclose(file);
+    draw_output(&graph, file);
+    if (fclose(file) != 0 || rename(tmp_name, file_name) != 0) {
+        unlink(tmp_name);
+        die("Could not write the topology\n");
+    }
+}
+
+/* saving the snapshot and the GUID index next to it, the index of the previous snapshot is removed first
+ * so it is never read with the new one. Without an index readers build it from the snapshot
+ * */
+bool save_snapshot(const struct topo_graph *g) {
+    unlink(TOPOLOGY_GUIDS_NAME);
+    if (!snapshot_write(TOPOLOGY_SNAPSHOT_NAME, g)) {
+        return false;
+    }
+    guid_index_write(TOPOLOGY_GUIDS_NAME, g);
+    return true;
 }
 
 /* Saving each nodeGUID of device with it's identificators for further user */
-void save_device_info(char key[], char value[]) {
+void save_device_info(const char key[], uint32_t index) {
+    uint64_t t0 = phase_begin();
     struct guid g;
-    if ((key == NULL) || (0 == strcmp(key, "")) || 18 != strlen(key)) {
-        return;
+    memset(&g, 0, sizeof(g));
+    /* the stream resolves links itself, there is no GUID table then */
+    if ((key != NULL) && map != NULL && decode_node_guid(key, &g)) {
+        guid_map_set(map, &g, &index);
     }
-    bzero(g.key, sizeof(g.key));
-    bzero(g.value, sizeof(g.value));
-    strncpy(g.key, key, GUID_LEN); //key;
-    strncpy(g.value, value, VALUE_LEN); // value;
-    hashmap_set(map, &g);
+    phase_end(PHASE_HASH_INSERT, t0);
 }
 
 /* Parse each line and get appropriate data */
-void get_params(char *line) {
-    size_t line_sz = strlen(line);
-
-    char tmp_line[MAXLINE];
-    strncpy(tmp_line, line, line_sz);
-    tmp_line[line_sz] = '\0';
-
+void get_params(struct view line) {
     if (NULL == dev_temp) {
-        dev_temp = (struct ibdevice *) malloc(sizeof(struct ibdevice));
-        if (!dev_temp) {
-            die("Cannot allocate memory!");
-        }
-        dev_temp->next = NULL;
+        dev_temp = (struct ibdevice *) alloc_record(sizeof(struct ibdevice));
     }
     if (dev_temp->connections == NULL) {
-        dev_temp->connections = (struct connection *) malloc(sizeof(struct connection));
-        if (!dev_temp->connections) {
-            die("Cannot allocate memory!");
-        }
-        dev_temp->connections->next = NULL;
+        dev_temp->connections = dev_temp->connections_tail =
+                (struct connection *) alloc_record(sizeof(struct connection));
     }
 
-    scan_device_ids(tmp_line);
-    scan_device_desc(tmp_line);
-    scan_network_connections(tmp_line);
+    scan_device_ids(line);
+    scan_device_desc(line);
+    scan_network_connections(line);
 
 }
 
-/*show progress bar */
-void show_progress(long int current_bytes, long int maxsize) {
-    int progress = (int) (current_bytes * 100.0 / maxsize);
+/* the device block parsed last ends at end, its hash is kept with the device that is added now,
+ * a device spread over several blocks (those without ids and links are not added) is never reused
+ * */
+void finish_device_block(const char *end) {
+    if (dev_temp) {
+        uint64_t hash = 0;
+        if (block_start && end) {
+            hash = block_hash(block_start, (size_t) (end - block_start));
+        } else if (line_block.active) {
+            hash = block_hash(line_block.data, line_block.len);
+        }
+        dev_temp->block_hash = dev_temp->block_hashed ? 0 : hash;
+        dev_temp->block_hashed = true;
+    }
+    add_ibdevice();
+    block_start = NULL;
+    line_block.active = false;
+}
 
-    printf("\n\033[F");
-    /* As we always add a device to the list after loop completes, the device counter here will always be -1 than the real count, so adding +1 */
-    printf("Lines parsed: " BLU "%ld" RESET ", devices found: "BLU"%d"RESET", progress: "BLU"%3d%% "RESET"[",
-           line_counter, device_counter + 1, progress);
-    printf(GRNHB);
-    for (int i = 0; i < progress; i++) {
-        printf(" ");
-    }
-    printf(RESET"]\033[1C");
-    fflush(stdout);
+/* keeping a line read with getline() for the hash of its device block */
+void copy_block_line(struct view line) {
+    if (!line_block.active) {
+        return;
+    }
+    if (line_block.len + line.len > line_block.cap) {
+        size_t cap = line_block.cap ? line_block.cap : 4096;
+        while (cap < line_block.len + line.len) {
+            cap *= 2;
+        }
+        char *data = realloc(line_block.data, cap);
+        if (!data) {
+            die("Cannot allocate memory!");
+        }
+        line_block.data = data;
+        line_block.cap = cap;
+    }
+    memcpy(line_block.data + line_block.len, line.ptr, line.len);
+    line_block.len += line.len;
 }
 
-/* parsing topology file */
-void parse_topology_file(char *topo_filename) {
-    char *line = NULL;
-    long int fsize = 0, current_bytes = 0;
-    size_t len = 0;
+/* --incremental: an unchanged block stands for device index of the previous snapshot, the node and links
+ * of that device are copied from the snapshot when the graph is built. Unchanged parts of the file are blocks
+ * of consecutive devices of the snapshot, they share one entry of the device list
+ * */
+void reuse_device(uint32_t index) {
+    uint64_t t0 = phase_begin();
+    if (dev_tail && dev_tail->reused && dev_tail->prev_index + dev_tail->reused_count == index) {
+        dev_tail->reused_count++;
+        device_counter++;
+    } else {
+        dev_temp = (struct ibdevice *) alloc_record(sizeof(struct ibdevice));
+        dev_temp->reused = true;
+        dev_temp->prev_index = index;
+        dev_temp->reused_count = 1;
+        add_ibdevice();
+    }
+    phase_end(PHASE_LIST_BUILD, t0);
+    blocks_reused++;
+}
+
+/* handle one raw line of topology file, newline included */
+void parse_line(struct view line) {
+    uint64_t t0 = phase_begin();
+    if (stats_enabled) {
+        thread_stats.lines[stats_classify(line.ptr, line.len)]++;
+    }
+    if (skip_line(line)) {
+        phase_end(PHASE_CLASSIFY, t0);
+        return;
+    }
+    line_counter++;
+    line = view_trim(line);
+    phase_end(PHASE_CLASSIFY, t0);
+    if (view_starts_with(line, "vendid")) {
+        t0 = phase_begin();
+        finish_device_block(line.ptr);
+        block_start = hash_blocks ? line.ptr : NULL;
+        line_block.len = 0;
+        line_block.active = !hash_blocks;
+        debug_print("%s", "\n");
+        phase_end(PHASE_LIST_BUILD, t0);
+    }
+    t0 = phase_begin();
+    uint64_t inserts = thread_stats.phase_ns[PHASE_HASH_INSERT];
+    get_params(line);
+    /* hash inserts done by the scanners are not counted as tokenizing */
+    phase_end(PHASE_TOKENIZE, t0 + (thread_stats.phase_ns[PHASE_HASH_INSERT] - inserts));
+}
+
+/*show progress bar */
+void show_progress(long int current_bytes, long int maxsize, long int lines, unsigned int devices) {
+    int progress = (maxsize > 0) ? (int) (current_bytes * 100.0 / maxsize) : 100;
+    char bar[101];
+
+    if (maxsize <= 0) {
+        printf("\n\033[F");
+        printf("Lines parsed: " BLU "%ld" RESET ", devices found: "BLU"%u"RESET"\033[K", lines, devices);
+        fflush(stdout);
+        return;
+    }
+    if (progress > 100) {
+        progress = 100;
+    }
+    memset(bar, ' ', (size_t) progress);
+    bar[progress] = '\0';
+    printf("\n\033[F");
+    printf("Lines parsed: " BLU "%ld" RESET ", devices found: "BLU"%u"RESET", progress: "BLU"%3d%% "RESET"["
+           GRNHB "%s" RESET"]\033[1C", lines, devices, progress, bar);
+    fflush(stdout);
+}
+
+/* handing what the thread parsed since the last call over to the shared progress counters */
+void publish_progress() {
+    __atomic_fetch_add(&progress.bytes, unpublished_bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&progress.lines, line_counter - published_lines, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&progress.devices, device_counter - published_devices, __ATOMIC_RELAXED);
+    unpublished_bytes = 0;
+    published_lines = line_counter;
+    published_devices = device_counter;
+}
+
+/* counting parsed bytes, the shared counters are touched once per PROGRESS_STEP only */
+void count_progress(size_t bytes) {
+    unpublished_bytes += (long int) bytes;
+    if (unpublished_bytes >= PROGRESS_STEP) {
+        publish_progress();
+    }
+}
+
+/* reporter thread, redraws the progress bar every PROGRESS_INTERVAL_MS until it is stopped */
+void *progress_reporter(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&reporter_lock);
+    while (!reporter_stop) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += PROGRESS_INTERVAL_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&reporter_wake, &reporter_lock, &deadline);
+        if (!reporter_stop) {
+            show_progress(__atomic_load_n(&progress.bytes, __ATOMIC_RELAXED), progress_total,
+                          __atomic_load_n(&progress.lines, __ATOMIC_RELAXED),
+                          __atomic_load_n(&progress.devices, __ATOMIC_RELAXED));
+        }
+    }
+    pthread_mutex_unlock(&reporter_lock);
+    return NULL;
+}
+
+/* starting the progress bar for a file of total bytes, cron and service runs do not get it */
+void start_progress(long int total) {
+    sigset_t all, saved;
+    memset(&progress, 0, sizeof(progress));
+    progress_total = total;
+    if (DEBUG || !isatty(STDOUT_FILENO)) {
+        return;
+    }
+    reporter_stop = false;
+    /* signals are handled by the main thread only */
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &saved);
+    reporter_running = (pthread_create(&reporter, NULL, progress_reporter, NULL) == 0);
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+}
+
+/* stopping the reporter and drawing the final state of the parse */
+void stop_progress() {
+    if (!reporter_running) {
+        return;
+    }
+    pthread_mutex_lock(&reporter_lock);
+    reporter_stop = true;
+    pthread_cond_signal(&reporter_wake);
+    pthread_mutex_unlock(&reporter_lock);
+    pthread_join(reporter, NULL);
+    reporter_running = false;
+    show_progress(progress_total, progress_total, line_counter, device_counter);
+}
+
+/* reading topology file line by line with getline() */
+void read_lines_stdio(char *topo_filename) {
+    long int fsize = 0;
     ssize_t read;
-    if (file_exists(topo_filename)) {
-        printf("File found: %s\n", topo_filename);
-        map = hashmap_new(sizeof(struct ibdevice), 0, 0, 0,
-                          guid_hash, guid_compare, NULL, NULL);
-        create_ibdevice_list();
-        th = fopen(topo_filename, "r");
-        fseek(th, 0L, SEEK_END);
+    th = strcmp(topo_filename, "-") ? fopen(topo_filename, "r") : stdin;
+    if (th == NULL) {
+        die("Could not open the file\n");
+    }
+    /* size of a pipe is not known, progress is shown without percents then */
+    if (fseek(th, 0L, SEEK_END) == 0) {
         fsize = ftell(th);
         fseek(th, 0L, SEEK_SET);
-        if (clock_gettime(CLOCK_REALTIME, &start) == -1) {
-            die("Could not engage the clock\n");
+    }
+    start_progress(fsize);
+    for (;;) {
+        uint64_t t0 = phase_begin();
+        read = getline(&stdio_line, &stdio_line_size, th);
+        phase_end(PHASE_IO, t0);
+        if (read == -1 || interrupted) {
+            break;
         }
+        parse_line(make_view(stdio_line, (size_t) read));
+        copy_block_line(make_view(stdio_line, (size_t) read));
+        count_progress((size_t) read);
+    }
+    if (th != stdin) {
+        fclose(th);
+    }
+    finish_device_block(NULL); /* Adding the last device, it ends at EOF */
+    if (!keep_warm) {
+        FREE(stdio_line);
+        stdio_line_size = 0;
+        FREE(line_block.data);
+        line_block.cap = 0;
+    }
+    stop_progress();
+}
 
-        while ((read = getline(&line, &len, th)) != -1) {
-            current_bytes += read;
-            if (skip_line(line)) {
-                continue;
-            }
-            line_counter++;
-            line = trim(line);
-            if (!memcmp(line, "vendid", 6)) {
-                add_ibdevice();
-                debug_print("%s", "\n");
+/* appending len bytes of a line split between two buffers of decompressed data */
+size_t join_split_line(size_t used, const char *p, size_t len) {
+    if (used + len + 1 > stdio_line_size) {
+        size_t size = stdio_line_size ? stdio_line_size : 4096;
+        while (size < used + len + 1) {
+            size *= 2;
+        }
+        char *line = realloc(stdio_line, size);
+        if (!line) {
+            die("Cannot allocate memory!");
+        }
+        stdio_line = line;
+        stdio_line_size = size;
+    }
+    memcpy(stdio_line + used, p, len);
+    return used + len;
+}
+
+/* reading a gzip or zstd file: a thread decompresses it into a ring of buffers while the lines
+ * of the buffers already filled are parsed, progress is counted in compressed bytes
+ * */
+void read_lines_compressed(char *topo_filename) {
+    const char *data;
+    size_t len, split = 0;
+    long int counted = 0;
+    struct decompress *d = decompress_open(topo_filename, input_compression);
+    if (!d) {
+        die("Could not open the file\n");
+    }
+    /* the buffers are reused, device blocks are copied for their hash as with getline() */
+    hash_blocks = false;
+    start_progress(decompress_size(d));
+    uint64_t t0 = phase_begin();
+    while (!interrupted && decompress_next(d, &data, &len)) {
+        const char *p = data, *end = data + len;
+        phase_end(PHASE_IO, t0);
+        while (p < end) {
+            const char *nl = memchr(p, '\n', (size_t) (end - p));
+            if (!nl) {
+                split = join_split_line(split, p, (size_t) (end - p));
+                break;
             }
-            get_params(line);
-            if (DEBUG == 0) {
-                show_progress(current_bytes, fsize);
+            struct view line = make_view(p, (size_t) (nl + 1 - p));
+            if (split) {
+                split = join_split_line(split, p, (size_t) (nl + 1 - p));
+                line = make_view(stdio_line, split);
+                split = 0;
             }
+            parse_line(line);
+            copy_block_line(line);
+            p = nl + 1;
+        }
+        long int consumed = decompress_consumed(d);
+        count_progress((size_t) (consumed - counted));
+        counted = consumed;
+        t0 = phase_begin();
+    }
+    phase_end(PHASE_IO, t0);
+    if (split && !interrupted) {
+        /* the last line has no newline */
+        parse_line(make_view(stdio_line, split));
+        copy_block_line(make_view(stdio_line, split));
+    }
+    finish_device_block(NULL); /* Adding the last device, it ends at EOF */
+    bool ok = decompress_close(d);
+    stop_progress();
+    if (!ok && !interrupted) {
+        die("\nCould not decompress the file, it is corrupt or truncated\n");
+    }
+}
+
+/* parse the lines of a memory range */
+void parse_buffer(const char *begin, const char *end) {
+    const char *p = begin;
+    hash_blocks = true;
+    while (p < end && !interrupted) {
+        const char *nl = memchr(p, '\n', (size_t) (end - p));
+        size_t len = nl ? (size_t) (nl - p) + 1 : (size_t) (end - p);
+        parse_line(make_view(p, len));
+        p += len;
+        count_progress(len);
+    }
+}
+
+/* find the first line starting with "vendid" at or after p, devices blocks of the file begin there */
+const char *snap_to_device_block(const char *base, const char *p, const char *eof) {
+    if (p >= eof) {
+        return eof;
+    }
+    /* 'v' is rare in the file apart from the "vendid" and "devid" lines, it is looked for instead of
+     * going through the file line by line
+     * */
+    while ((p = memchr(p, 'v', (size_t) (eof - p))) != NULL) {
+        if ((p == base || p[-1] == '\n') && eof - p >= 6 && !memcmp(p, "vendid", 6)) {
+            return p;
         }
-        add_ibdevice(); /* Adding the last device after EOF */
-        if (clock_gettime(CLOCK_REALTIME, &end) == -1) {
+        p++;
+    }
+    return eof;
+}
+
+/* --incremental: the range is walked block by block, blocks with the same content as in the previous
+ * snapshot are taken from there and only new or changed ones go through the scanners.
+ * Unchanged parts of the file follow the snapshot device by device, so the device after the last reused one
+ * is tried before the blocks of the snapshot are looked up
+ * */
+void parse_buffer_incremental(const char *begin, const char *end, const char *base) {
+    const char *p = snap_to_device_block(base, begin, end);
+    parse_buffer(begin, p); /* anything before the first device */
+    while (p < end && !interrupted) {
+        const char *nl = memchr(p, '\n', (size_t) (end - p));
+        const char *next = nl ? snap_to_device_block(base, nl + 1, end) : end;
+        struct block_ref key = {.hash = block_hash(p, (size_t) (next - p))};
+        const struct block_ref *ref = NULL;
+        uint32_t following = (dev_tail && dev_tail->reused) ? dev_tail->prev_index + dev_tail->reused_count : 0;
+        if (following > 0 && following < prev_graph.ndevices && prev_graph.nodes[following].block_hash == key.hash) {
+            key.index = following;
+            ref = &key;
+        } else {
+            ref = hashmap_get(prev_blocks, &key);
+        }
+        if (ref) {
+            uint64_t t0 = phase_begin();
+            finish_device_block(p);
+            phase_end(PHASE_LIST_BUILD, t0);
+            reuse_device(ref->index);
+            count_progress((size_t) (next - p));
+        } else {
+            parse_buffer(p, next);
+        }
+        p = next;
+    }
+}
+
+/* -j worker: parse a range of device blocks into thread-local list and hash table */
+void *parse_chunk_worker(void *arg) {
+    struct parse_chunk *chunk = arg;
+    map = chunk->map;
+    arena = chunk->arena;
+    create_ibdevice_list();
+    if (prev_blocks) {
+        parse_buffer_incremental(chunk->begin, chunk->end, chunk->begin);
+    } else {
+        parse_buffer(chunk->begin, chunk->end);
+    }
+    finish_device_block(chunk->end); /* Adding the last device of the range */
+    publish_progress();
+    chunk->stats = thread_stats;
+    chunk->dev_list = dev_list;
+    chunk->dev_tail = dev_tail;
+    chunk->device_counter = device_counter;
+    chunk->line_counter = line_counter;
+    chunk->blocks_reused = blocks_reused;
+    chunk->malformed_values = malformed_values;
+    return NULL;
+}
+
+/* split the mapped file into ranges at device block boundaries, parse them in parallel and
+ * merge the results in file order, so the output is the same as of a single-threaded run
+ * */
+void parse_buffer_threaded(const char *base, const char *eof, unsigned int nchunks) {
+    sigset_t all, saved;
+    size_t size = (size_t) (eof - base);
+    struct parse_chunk *chunks = calloc(nchunks, sizeof(struct parse_chunk));
+    if (!chunks) {
+        die("Cannot allocate memory!");
+    }
+    for (unsigned int i = 0; i < nchunks; i++) {
+        chunks[i].begin = (i == 0) ? base : chunks[i - 1].end;
+        chunks[i].end = (i == nchunks - 1) ? eof : snap_to_device_block(base, base + size / nchunks * (i + 1), eof);
+        if (chunks[i].end < chunks[i].begin) {
+            chunks[i].end = chunks[i].begin;
+        }
+        /* created before the workers start, each one only fills its own */
+        chunks[i].map = guid_map_new(0);
+        chunks[i].arena = arena_new(0);
+        if (!chunks[i].map || !chunks[i].arena ||
+            !guid_map_reserve(chunks[i].map, (size_t) (chunks[i].end - chunks[i].begin) / BYTES_PER_DEVICE)) {
+            die("Cannot allocate memory!");
+        }
+    }
+    /* signals are handled by the main thread only */
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &saved);
+    for (unsigned int i = 0; i < nchunks; i++) {
+        if (pthread_create(&chunks[i].thread, NULL, parse_chunk_worker, &chunks[i]) != 0) {
+            die("Could not start parser thread\n");
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+    size_t nguids = 0;
+    for (unsigned int i = 0; i < nchunks; i++) {
+        pthread_join(chunks[i].thread, NULL);
+        uint64_t t0 = phase_begin();
+        if (chunks[i].dev_list->next != NULL) {
+            dev_tail->next = chunks[i].dev_list->next;
+            dev_tail = chunks[i].dev_tail;
+        }
+        arena_adopt(arena, chunks[i].arena);
+        /* device positions are shifted by the number of devices of the chunks before */
+        size_t iter = 0;
+        struct guid *key;
+        uint32_t *index;
+        while (guid_map_iter(chunks[i].map, &iter, &key, &index)) {
+            *index += device_counter;
+        }
+        nguids += guid_map_count(chunks[i].map);
+        if (stats_enabled) {
+            struct hashmap_stats hs;
+            guid_map_stats(chunks[i].map, &hs);
+            worker_map_resizes += hs.resizes;
+            stats_add(&thread_stats, &chunks[i].stats);
+        }
+        device_counter += chunks[i].device_counter;
+        line_counter += chunks[i].line_counter;
+        blocks_reused += chunks[i].blocks_reused;
+        malformed_values += chunks[i].malformed_values;
+        phase_end(PHASE_LIST_BUILD, t0);
+    }
+    /* the GUID tables of the chunks are merged into the one of the main thread, sized for all of them,
+     * later chunks overwrite earlier ones, as later lines do in a single-threaded run
+     * */
+    uint64_t t0 = phase_begin();
+    if (!guid_map_reserve(map, guid_map_count(map) + nguids)) {
+        die("Cannot allocate memory!");
+    }
+    for (unsigned int i = 0; i < nchunks; i++) {
+        size_t iter = 0;
+        struct guid *key;
+        uint32_t *index;
+        while (guid_map_iter(chunks[i].map, &iter, &key, &index)) {
+            guid_map_set(map, key, index);
+        }
+        guid_map_free(chunks[i].map);
+    }
+    phase_end(PHASE_LIST_BUILD, t0);
+    FREE(chunks);
+}
+
+/* reading topology file through a read-only mapping, lines are handed to the scanners in place */
+void read_lines_mmap(char *topo_filename) {
+    struct stat st;
+    uint64_t t0 = phase_begin();
+    int fd = open(topo_filename, O_RDONLY);
+    if (fd == -1) {
+        die("Could not open the file\n");
+    }
+    if (fstat(fd, &st) == -1) {
+        die("Could not stat the file\n");
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        phase_end(PHASE_IO, t0);
+        return;
+    }
+    const char *base = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED) {
+        die("Could not map the file\n");
+    }
+    close(fd);
+
+    start_progress(st.st_size);
+    if (parse_threads > 1) {
+        madvise((void *) base, (size_t) st.st_size, MADV_WILLNEED);
+        phase_end(PHASE_IO, t0);
+        parse_buffer_threaded(base, base + st.st_size, parse_threads);
+    } else {
+        madvise((void *) base, (size_t) st.st_size, MADV_SEQUENTIAL);
+        phase_end(PHASE_IO, t0);
+        if (prev_blocks) {
+            parse_buffer_incremental(base, base + st.st_size, base);
+        } else {
+            parse_buffer(base, base + st.st_size);
+        }
+        finish_device_block(base + st.st_size); /* Adding the last device, it ends at EOF */
+    }
+    stop_progress();
+    munmap((void *) base, (size_t) st.st_size);
+}
+
+/* --incremental: device blocks of the previous run are looked up by content hash in its snapshot,
+ * false if there is no usable snapshot and the whole file has to be parsed.
+ * Links of reused blocks keep their peers and only links to other devices are resolved again, through the
+ * GUID index of the snapshot, so the snapshot is not used if the index does not hold each of its devices once
+ * */
+bool load_previous_blocks() {
+    uint32_t named = 0;
+    if (!snapshot_map(TOPOLOGY_SNAPSHOT_NAME, &prev_graph, &prev_snap)) {
+        return false;
+    }
+    prev_guids = guid_index_map(TOPOLOGY_GUIDS_NAME, &prev_graph);
+    if (!prev_guids) {
+        prev_guids = guid_index_build(&prev_graph);
+    }
+    if (!prev_guids) {
+        die("Cannot allocate memory!");
+    }
+    for (uint32_t i = 0; i < prev_graph.ndevices; i++) {
+        if (prev_graph.nodes[i].name != 0) {
+            named++;
+        }
+    }
+    if (hashmap_count(prev_guids) != named) {
+        hashmap_free(prev_guids);
+        prev_guids = NULL;
+        snapshot_unmap(&prev_snap);
+        memset(&prev_graph, 0, sizeof(prev_graph));
+        return false;
+    }
+    prev_blocks = hashmap_new(sizeof(struct block_ref), 0, 0, 0,
+                              block_ref_hash, block_ref_compare, NULL, NULL);
+    struct block_ref *refs = malloc(prev_graph.ndevices * sizeof(struct block_ref) + 1);
+    if (!prev_blocks || !refs) {
+        die("Cannot allocate memory!");
+    }
+    size_t nrefs = 0;
+    for (uint32_t i = 0; i < prev_graph.ndevices; i++) {
+        struct block_ref ref = {.hash = prev_graph.nodes[i].block_hash, .index = i};
+        if (ref.hash != 0) {
+            refs[nrefs++] = ref;
+        }
+    }
+    if (!hashmap_build_bulk(prev_blocks, refs, nrefs)) {
+        die("Cannot allocate memory!");
+    }
+    FREE(refs);
+    return true;
+}
+
+void free_previous_blocks() {
+    if (prev_blocks) {
+        hashmap_free(prev_blocks);
+        hashmap_free(prev_guids);
+        prev_blocks = NULL;
+        prev_guids = NULL;
+        snapshot_unmap(&prev_snap);
+        memset(&prev_graph, 0, sizeof(prev_graph));
+    }
+}
+
+/* --stats: time of the phases and counters of the parse just done */
+void report_stats(const char *topo_filename) {
+    struct stats_report r;
+    struct stat st;
+    struct timespec now;
+    memset(&r, 0, sizeof(r));
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    r.file = topo_filename;
+    r.mode = (input_compression == COMPRESS_GZIP) ? "gzip" : (input_compression == COMPRESS_ZSTD) ? "zstd" :
+             incremental ? "incremental" : (parse_threads > 1) ? "threads" : use_mmap ? "mmap" : "stdio";
+    r.threads = parse_threads;
+    r.total_ns = (uint64_t) (now.tv_sec - start.tv_sec) * 1000000000u + (uint64_t) now.tv_nsec - (uint64_t) start.tv_nsec;
+    r.analysis_ns = (uint64_t) (end.tv_sec - start.tv_sec) * 1000000000u + (uint64_t) end.tv_nsec - (uint64_t) start.tv_nsec;
+    r.parse = thread_stats;
+    r.input_bytes = (stat(topo_filename, &st) == 0) ? (long int) st.st_size : 0;
+    r.devices = device_counter;
+    r.links = graph.nedges;
+    for (uint32_t i = 0; i < graph.nedges; i++) {
+        if (graph.edges[i].peer < 0) {
+            r.unresolved_links++;
+        }
+    }
+    r.blocks_reused = blocks_reused;
+    r.malformed_values = malformed_values;
+    r.arena_bytes = arena_bytes(arena);
+    r.string_bytes = graph.strings_size;
+    if (map) {
+        guid_map_stats(map, &r.guid_map);
+    }
+    r.guid_map.resizes += worker_map_resizes;
+    if (stats_json) {
+        stats_print_json(stdout, &r);
+    } else {
+        stats_print_text(stdout, &r);
+    }
+}
+
+/* -f -: reading stdin, e.g. "ibnetdiscover | topo_parser -f -", and writing the dump on the way,
+ * devices come out in the order their peers become known, only those still waiting are kept
+ * */
+void parse_topology_stream() {
+    struct stream_stats ss;
+    int fd = open(TOPOLOGY_DUMP_NAME, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        die("Could not open the file\n");
+    }
+    /* a snapshot of an older run would not match the dump any more */
+    unlink(TOPOLOGY_SNAPSHOT_NAME);
+    unlink(TOPOLOGY_GUIDS_NAME);
+    stream = stream_new(fd);
+    arena = arena_new(0);
+    if (!stream || !arena) {
+        die("Cannot allocate memory!");
+    }
+    printf("Reading topology from stdin\n");
+    if (clock_gettime(CLOCK_MONOTONIC, &start) == -1) {
+        die("Could not engage the clock\n");
+    }
+    read_lines_stdio("-");
+    stream_get_stats(stream, &ss);
+    uint64_t t0 = phase_begin();
+    bool written = stream_finish(stream);
+    phase_end(PHASE_RENDER, t0);
+    stream = NULL;
+    if (clock_gettime(CLOCK_MONOTONIC, &end) == -1) {
+        die("Could not engage the clock\n");
+    }
+    if (close(fd) == -1 || !written) {
+        die("Could not write the topology\n");
+    }
+    printf("\n");
+    printf("Streamed %zu devices, at most %zu devices were waiting for %zu links\n", ss.devices,
+           ss.peak_waiting_devices, ss.peak_waiting_links);
+    if (malformed_values) {
+        printf("Left out %u malformed ids and GUIDs\n", malformed_values);
+    }
+    double duration = (end.tv_sec - start.tv_sec) + (double) (end.tv_nsec - start.tv_nsec) / (double) BILLION;
+    printf("Topology analysis took %f seconds\n", duration);
+    if (stats_enabled) {
+        report_stats("-");
+    }
+    arena_free(arena);
+    arena = NULL;
+}
+
+/* counters of the previous parse, --serve parses the file again in the same process */
+void reset_parse_state() {
+    device_counter = 0;
+    line_counter = 0;
+    blocks_reused = 0;
+    malformed_values = 0;
+    unpublished_bytes = 0;
+    published_lines = 0;
+    published_devices = 0;
+    worker_map_resizes = 0;
+    memset(&thread_stats, 0, sizeof(thread_stats));
+}
+
+/* parsing topology file */
+void parse_topology_file(char *topo_filename) {
+    reset_parse_state();
+    if (file_exists(topo_filename)) {
+        printf("File found: %s\n", topo_filename);
+        /* a warm table and arena are left empty by the previous parse */
+        if (!map) {
+            map = guid_map_new(0);
+        }
+        if (!arena) {
+            arena = arena_new(0);
+        }
+        if (!map || !arena) {
+            die("Cannot allocate memory!");
+        }
+        create_ibdevice_list();
+        if (clock_gettime(CLOCK_MONOTONIC, &start) == -1) {
+            die("Could not engage the clock\n");
+        }
+
+        input_compression = compress_type(topo_filename);
+        /* the table is sized once for as many devices as the file could hold instead of
+         * growing through the parse, compressed files do not tell how much they hold
+         * */
+        struct stat st;
+        if (input_compression == COMPRESS_NONE && stat(topo_filename, &st) == 0 &&
+            !guid_map_reserve(map, (size_t) st.st_size / BYTES_PER_DEVICE)) {
+            die("Cannot allocate memory!");
+        }
+        if (!compress_supported(input_compression)) {
+            die("zstd input needs " PROGNAME " built with WITH_ZSTD=1\n");
+        }
+        if (incremental && input_compression != COMPRESS_NONE) {
+            printf("Compressed input is parsed whole\n");
+        } else if (incremental && !load_previous_blocks()) {
+            printf("No usable snapshot %s, parsing the whole file\n", TOPOLOGY_SNAPSHOT_NAME);
+        }
+        /* decompressed data is read in order, --mmap and -j do not apply to it */
+        if (input_compression != COMPRESS_NONE) {
+            read_lines_compressed(topo_filename);
+        } else if (use_mmap || parse_threads > 1 || incremental) {
+            read_lines_mmap(topo_filename);
+        } else {
+            read_lines_stdio(topo_filename);
+        }
+        uint64_t t0 = phase_begin();
+        build_topology_graph(dev_list->next, &graph);
+        phase_end(PHASE_GRAPH_BUILD, t0);
+        if (clock_gettime(CLOCK_MONOTONIC, &end) == -1) {
             die("Could not engage the clock\n");
         }
-        fclose(th);
         printf("\n");
+        if (prev_blocks) {
+            printf("Reused %u of %u device blocks\n", blocks_reused, device_counter);
+        }
+        if (malformed_values) {
+            printf("Left out %u malformed ids and GUIDs\n", malformed_values);
+        }
+        /* the snapshot is going to be replaced */
+        free_previous_blocks();
         /* Dumping data here to use it later */
+        t0 = phase_begin();
         dump_topology_to_file(TOPOLOGY_DUMP_NAME);
-        FREE(line);
-        FREE(dev_list);
+        phase_end(PHASE_RENDER, t0);
+        t0 = phase_begin();
+        if (!save_snapshot(&graph)) {
+            printf("Could not save topology snapshot %s\n", TOPOLOGY_SNAPSHOT_NAME);
+        }
+        phase_end(PHASE_SNAPSHOT, t0);
         double duration = (end.tv_sec - start.tv_sec) + (double) (end.tv_nsec - start.tv_nsec) / (double) BILLION;
         printf("Topology analysis took %f seconds\n", duration);
+        if (stats_enabled) {
+            report_stats(topo_filename);
+        }
+        /* all devices and connections go away at once */
+        if (keep_warm) {
+            arena_rewind(arena);
+        } else {
+            arena_free(arena);
+            arena = NULL;
+        }
+        dev_list = dev_temp = dev_tail = NULL;
+        free((char *) graph.strings);
+        memset(&graph, 0, sizeof(graph));
     } else {
         printf("File not found: %s\n", topo_filename);
     }
-    if (map) {
-        hashmap_free(map);
+    if (map && keep_warm) {
+        /* the buckets stay allocated, the next parse of a file of the same size does not resize */
+        guid_map_clear(map, true);
+    } else if (map) {
+        guid_map_free(map);
+        map = NULL;
+    }
+}
+
+/* the topology file is the same as when it was looked at before */
+bool same_file_state(const struct stat *a, const struct stat *b) {
+    return a->st_ino == b->st_ino && a->st_size == b->st_size &&
+           a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+long int ms_since(const struct timespec *t) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - t->tv_sec) * 1000 + (now.tv_nsec - t->tv_nsec) / 1000000;
+}
+
+/* system calls are not restarted, so a loop blocked in one gets to check the flag */
+void catch_signals(void (*handler)(int)) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+}
+
+/* leaving after a signal stopped the loops, the devices read up to it are saved by then */
+void exit_interrupted() {
+    printf(RESET"\nCaught interrupt/terminating signal %d\n", (int) interrupted);
+    if (server) {
+        serve_close(server);
+        server = NULL;
+    }
+    die("Bye!\n");
+}
+
+/* --serve: parsing the changed file again in a child process, which saves the snapshot and exits,
+ * so the daemon keeps answering meanwhile and a parse that dies takes only the child with it
+ * */
+pid_t start_reparse(char *topo_filename) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        /* the daemon stops it, nothing half-parsed is saved then */
+        catch_signals(SIG_DFL);
+        if (!file_exists(topo_filename)) {
+            exit(EXIT_FAILURE);
+        }
+        parse_topology_file(topo_filename);
+        exit(EXIT_SUCCESS);
+    }
+    return pid;
+}
+
+/* --serve: the file is parsed once and its snapshot is kept mapped, queries are answered from it
+ * over the socket. A changed file is parsed again once it stopped changing for SERVE_CHECK_MS,
+ * queries keep getting the previous topology until the new snapshot is there, and after a
+ * parse that failed
+ * */
+void serve_topology(char *topo_filename, const char *socket_path) {
+    struct topo_graph g;
+    struct topo_snapshot snap;
+    struct stat parsed, seen, now, pending;
+    struct timespec checked;
+    pid_t reparse = -1;
+    if (!strcmp(topo_filename, "-") || stat(topo_filename, &parsed) == -1) {
+        die("--serve needs an existing topology file\n");
+    }
+    keep_warm = true;
+    parse_topology_file(topo_filename);
+    if (!snapshot_map(TOPOLOGY_SNAPSHOT_NAME, &g, &snap)) {
+        die("Could not map topology snapshot\n");
+    }
+    server = serve_open(socket_path);
+    if (!server) {
+        die("Could not listen on the socket, its path may be taken by a file or a running server\n");
+    }
+    if (!serve_set_graph(server, &g, guid_index_map(TOPOLOGY_GUIDS_NAME, &g))) {
+        die("Cannot allocate memory!");
+    }
+    /* clients going away in the middle of a reply must not stop the daemon */
+    signal(SIGPIPE, SIG_IGN);
+    printf("Serving %u devices on %s\n", g.ndevices, socket_path);
+    fflush(stdout);
+    seen = parsed;
+    clock_gettime(CLOCK_MONOTONIC, &checked);
+    while (!interrupted && serve_wait(server, SERVE_CHECK_MS) >= 0) {
+        if (reparse > 0) {
+            int status = 0;
+            pid_t done = waitpid(reparse, &status, WNOHANG);
+            if (done == 0) {
+                continue;
+            }
+            reparse = -1;
+            parsed = pending;
+            struct topo_graph next;
+            struct topo_snapshot next_snap = {NULL, 0};
+            if (done == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS ||
+                !snapshot_map(TOPOLOGY_SNAPSHOT_NAME, &next, &next_snap) ||
+                !serve_set_graph(server, &next, guid_index_map(TOPOLOGY_GUIDS_NAME, &next))) {
+                printf("Could not load the new topology, serving the previous one\n");
+                snapshot_unmap(&next_snap);
+                fflush(stdout);
+                continue;
+            }
+            snapshot_unmap(&snap);
+            snap = next_snap;
+            printf("Serving %u devices on %s\n", next.ndevices, socket_path);
+            fflush(stdout);
+        }
+        if (ms_since(&checked) < SERVE_CHECK_MS) {
+            continue;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &checked);
+        if (stat(topo_filename, &now) == -1 || same_file_state(&now, &parsed)) {
+            continue;
+        }
+        /* the file is still being written while it keeps changing */
+        if (!same_file_state(&now, &seen)) {
+            seen = now;
+            continue;
+        }
+        pending = now;
+        reparse = start_reparse(topo_filename);
+        if (reparse == -1) {
+            printf("Could not start parsing the new topology, trying again later\n");
+            fflush(stdout);
+        }
+    }
+    if (reparse > 0) {
+        kill(reparse, SIGKILL);
+        waitpid(reparse, NULL, 0);
+    }
+    if (interrupted) {
+        exit_interrupted();
     }
+    die("Could not accept on the socket\n");
 }
 
-/* read saved topology data from saved file and dump the output
- * function is incomplete due to some questions regard to task
+/* --watch: the file is parsed again each time it is rewritten, e.g. by a discovery job,
+ * the parse starts once the writer has left the file alone for WATCH_SETTLE_MS
+ * */
+void watch_topology(char *topo_filename) {
+    if (!strcmp(topo_filename, "-")) {
+        die("--watch needs a topology file\n");
+    }
+    struct watch *w = watch_new(topo_filename);
+    if (!w) {
+        die("Could not watch the file\n");
+    }
+    keep_warm = true;
+    parse_topology_file(topo_filename);
+    while (!interrupted) {
+        printf("Watching %s\n", topo_filename);
+        fflush(stdout);
+        int changed = watch_wait(w, WATCH_SETTLE_MS);
+        if (changed < 0) {
+            die("Could not watch the file\n");
+        }
+        if (changed > 0 && !interrupted) {
+            parse_topology_file(topo_filename);
+        }
+    }
+    watch_free(w);
+    exit_interrupted();
+}
+
+/* read saved topology data and dump the output,
+ * the binary snapshot is rendered in place, text dump is the fallback for older runs
  * */
 void print_topology() {
+    struct topo_graph g;
+    struct topo_snapshot snap;
+    if (snapshot_map(TOPOLOGY_SNAPSHOT_NAME, &g, &snap)) {
+        draw_output(&g, stdout);
+        snapshot_unmap(&snap);
+        return;
+    }
     read_topology_from_file(TOPOLOGY_DUMP_NAME);
 }
+/* device of g with node GUID name, the last one as links resolve to it, false if there is none.
+ * It is looked up in the GUID index of g if there is one, g is searched otherwise
+ * */
+bool find_device(const struct topo_graph *g, struct hashmap *guids, const char *name, uint32_t *index) {
+    struct guid key, other;
+    bool found = false;
+    memset(&key, 0, sizeof(key));
+    if (!decode_node_guid(name, &key)) {
+        return false;
+    }
+    const struct topo_guid_ref *ref = guids ? guid_index_find(guids, g, key.key, key.type) : NULL;
+    if (ref) {
+        *index = ref->index;
+        return true;
+    }
+    for (uint32_t i = 0; i < g->ndevices; i++) {
+        memset(&other, 0, sizeof(other));
+        if (decode_node_guid(TOPO_STR(g, g->nodes[i].name), &other) && guid_equal(&key, &other)) {
+            *index = i;
+            found = true;
+        }
+    }
+    return found;
+}
+
+/* --path: shortest path between two devices of the saved topology, "<GUID>,<GUID>" */
+void print_path(const char *pair) {
+    struct topo_graph g;
+    struct topo_snapshot snap;
+    char from_name[GUID_LEN], to_name[GUID_LEN];
+    uint32_t from, to;
+    const char *comma = strchr(pair, ',');
+    if (!comma || (size_t) (comma - pair) >= sizeof(from_name) || strlen(comma + 1) >= sizeof(to_name)) {
+        die("--path needs two node GUIDs, e.g. S-0002c90000000001,H-0002c90000000002\n");
+    }
+    memcpy(from_name, pair, (size_t) (comma - pair));
+    from_name[comma - pair] = '\0';
+    strcpy(to_name, comma + 1);
+    if (!snapshot_map(TOPOLOGY_SNAPSHOT_NAME, &g, &snap)) {
+        die("No parsed topology, run with -f first\n");
+    }
+    struct hashmap *guids = guid_index_map(TOPOLOGY_GUIDS_NAME, &g);
+    if (!find_device(&g, guids, from_name, &from) || !find_device(&g, guids, to_name, &to)) {
+        die("No such device in the topology\n");
+    }
+    hashmap_free(guids);
+    uint32_t *path = malloc((size_t) g.ndevices * sizeof(uint32_t));
+    if (!path) {
+        die("Cannot allocate memory!");
+    }
+    int64_t hops = topo_shortest_path(&g, from, to, path);
+    if (hops < 0) {
+        printf("No path from %s to %s\n", from_name, to_name);
+    } else {
+        printf("Path from %s to %s, %ld hops:\n", from_name, to_name, (long int) hops);
+        for (int64_t i = 0; i <= hops; i++) {
+            const struct topo_node *node = &g.nodes[path[i]];
+            printf("\t\"%s\"\t# \"%s\"\n", TOPO_STR(&g, node->name), TOPO_STR(&g, node->desc));
+        }
+    }
+    free(path);
+    snapshot_unmap(&snap);
+}
+
+/* --hops: hop counts between all pairs of switches of the saved topology, summarized over
+ * pairs of leaf switches, the ones adapters are connected to
+ * */
+void print_hop_matrix() {
+    struct topo_graph g;
+    struct topo_snapshot snap;
+    struct hop_matrix m;
+    struct timespec t0, t1;
+    size_t histogram[HOP_UNREACHABLE + 1];
+    size_t pairs = 0, total_hops = 0;
+    uint32_t nleaves = 0, diameter = 0;
+    if (!snapshot_map(TOPOLOGY_SNAPSHOT_NAME, &g, &snap)) {
+        die("No parsed topology, run with -f first\n");
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (!hop_matrix_build(&g, parse_threads, &m)) {
+        die("Cannot allocate memory!");
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    uint32_t *leaves = malloc(((size_t) m.nswitches + 1) * sizeof(uint32_t));
+    if (!leaves) {
+        die("Cannot allocate memory!");
+    }
+    for (uint32_t i = 0; i < m.nswitches; i++) {
+        uint32_t d = m.switches[i];
+        for (uint32_t e = g.offsets[d]; e < g.offsets[d + 1]; e++) {
+            if (g.edges[e].remote_type == CADAPTER) {
+                leaves[nleaves++] = i;
+                break;
+            }
+        }
+    }
+    memset(histogram, 0, sizeof(histogram));
+    for (uint32_t i = 0; i < nleaves; i++) {
+        for (uint32_t j = i + 1; j < nleaves; j++) {
+            uint8_t h = hop_matrix_get(&m, leaves[i], leaves[j]);
+            histogram[h]++;
+            if (h != HOP_UNREACHABLE) {
+                pairs++;
+                total_hops += h;
+                diameter = (h > diameter) ? h : diameter;
+            }
+        }
+    }
+    double duration = (t1.tv_sec - t0.tv_sec) + (double) (t1.tv_nsec - t0.tv_nsec) / (double) BILLION;
+    printf("Hop matrix of %u switches (%zu bytes) took %f seconds with %u threads\n", m.nswitches,
+           (size_t) m.nswitches * m.nswitches, duration, parse_threads);
+    printf("Leaf switches: %u, connected leaf pairs: %zu, unreachable: %zu\n", nleaves, pairs,
+           histogram[HOP_UNREACHABLE]);
+    if (pairs) {
+        printf("Hops between leaves: max %u, average %.3f\n", diameter, (double) total_hops / (double) pairs);
+        for (uint32_t h = 0; h < HOP_UNREACHABLE; h++) {
+            if (histogram[h]) {
+                printf("\t%3u hops: %zu pairs\n", h, histogram[h]);
+            }
+        }
+    }
+    free(leaves);
+    hop_matrix_free(&m);
+    snapshot_unmap(&snap);
+}
+
 /* checking if opt is valid */
 bool is_valid_opt(const char *opts) {
     return (opts != NULL);
 }
 
+/* only the flag is set here, the parse, stream, serve and watch loops check it and stop,
+ * the devices read up to then are saved as at the end of the file. A second signal does not wait
+ * */
 void sighandler(int signum) {
-    printf(RESET"Caught interrupt/terminating signal %d\nSaving what is possible...\n", signum);
-    dump_topology_to_file(TOPOLOGY_DUMP_NAME);
-    die("Bye!\n");
+    if (interrupted) {
+        _exit(EXIT_FAILURE);
+    }
+    interrupted = signum;
 }
 
 /* main function */
 int main(int argc, char **argv) {
     int opt = 0;
     int long_index = 0;
+    char *topo_filename = NULL;
+    char *socket_path = NULL;
+    char *path_pair = NULL;
+    bool print = false;
+    bool watch = false;
+    bool hops = false;
     static struct option long_options[] = {
             {"help",     no_argument,       0, 'h'},
             {"parse",    no_argument,       0, 'p'},
             {"topofile", required_argument, 0, 'f'},
+            {"mmap",     no_argument,       0, OPT_MMAP},
+            {"jobs",     required_argument, 0, 'j'},
+            {"incremental", no_argument,    0, OPT_INCREMENTAL},
+            {"stats",    required_argument, 0, OPT_STATS},
+            {"serve",    required_argument, 0, OPT_SERVE},
+            {"path",     required_argument, 0, OPT_PATH},
+            {"hops",     no_argument,       0, OPT_HOPS},
+            {"watch",    no_argument,       0, OPT_WATCH},
             {0, 0,                          0, 0}
     };
-    signal(SIGINT, sighandler);
-    signal(SIGTERM, sighandler);
-    while ((opt = getopt_long(argc, argv, "hpf:", long_options, &long_index)) != -1) {
+    catch_signals(sighandler);
+    while ((opt = getopt_long(argc, argv, "hpf:j:", long_options, &long_index)) != -1) {
         switch (opt) {
             case 'h' :
                 print_usage();
                 break;
             case 'p' :
-                print_topology();
+                print = true;
                 break;
             case 'f' :
                 if (!is_valid_opt(optarg)) {
                     print_usage();
                 }
-                parse_topology_file(optarg);
+                topo_filename = optarg;
+                break;
+            case 'j' :
+                parse_threads = (unsigned int) strtoul(optarg, NULL, 10);
+                if (parse_threads == 0) {
+                    print_usage();
+                }
+                render_threads = parse_threads;
+                break;
+            case OPT_MMAP :
+                use_mmap = true;
+                break;
+            case OPT_INCREMENTAL :
+                incremental = true;
+                break;
+            case OPT_STATS :
+                if (strcmp(optarg, "json") != 0 && strcmp(optarg, "text") != 0) {
+                    print_usage();
+                }
+                stats_enabled = true;
+                stats_json = (strcmp(optarg, "json") == 0);
+                break;
+            case OPT_SERVE :
+                socket_path = optarg;
+                break;
+            case OPT_PATH :
+                path_pair = optarg;
+                break;
+            case OPT_HOPS :
+                hops = true;
+                break;
+            case OPT_WATCH :
+                watch = true;
                 break;
             default:
                 print_usage();
@@ -804,6 +2417,36 @@ int main(int argc, char **argv) {
     if (argc == 1 || (argc > 1 && argv[1][0] != '-')) {
         print_usage();
     }
+    /* options may come in any order, so act only when all of them are known */
+    if (socket_path) {
+        if (!topo_filename) {
+            print_usage();
+        }
+        serve_topology(topo_filename, socket_path);
+    } else if (watch) {
+        if (!topo_filename) {
+            print_usage();
+        }
+        watch_topology(topo_filename);
+    } else if (topo_filename && !strcmp(topo_filename, "-")) {
+        parse_topology_stream();
+    } else if (topo_filename) {
+        parse_topology_file(topo_filename);
+    }
+    /* nothing is saved after the parse, the signals end the queries below right away */
+    catch_signals(SIG_DFL);
+    if (interrupted) {
+        exit_interrupted();
+    }
+    if (print) {
+        print_topology();
+    }
+    if (path_pair) {
+        print_path(path_pair);
+    }
+    if (hops) {
+        print_hop_matrix();
+    }
 
     return 0;
 }
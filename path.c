@@ -0,0 +1,245 @@
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include "path.h"
+
+#define NO_PARENT UINT32_MAX
+
+#define HOP_BATCH 64 /* sources searched from at once, one bit of a word each */
+
+/* switch-only copy of the graph the hop matrix is computed on, switch i is reached over links
+ * from the switches in[off[i]] .. in[off[i + 1] - 1]
+ * */
+struct switch_graph {
+    uint32_t n;
+    uint32_t *off;
+    uint32_t *in;
+};
+
+/* batches of HOP_BATCH rows of the hop matrix are handed out to the threads one at a time */
+struct hop_job {
+    const struct switch_graph *sg;
+    uint8_t *hops;
+    uint32_t next_batch;
+    bool oom;
+};
+
+int64_t topo_shortest_path(const struct topo_graph *g, uint32_t from, uint32_t to, uint32_t *path) {
+    int64_t hops = -1;
+    uint32_t *parent, *queue, head = 0, tail = 0;
+    if (from >= g->ndevices || to >= g->ndevices) {
+        return -1;
+    }
+    if (from == to) {
+        path[0] = from;
+        return 0;
+    }
+    parent = malloc((size_t) g->ndevices * sizeof(uint32_t));
+    queue = malloc((size_t) g->ndevices * sizeof(uint32_t));
+    if (!parent || !queue) {
+        free(parent);
+        free(queue);
+        return -1;
+    }
+    memset(parent, 0xff, (size_t) g->ndevices * sizeof(uint32_t));
+    parent[from] = from;
+    queue[tail++] = from;
+    while (head < tail && parent[to] == NO_PARENT) {
+        uint32_t u = queue[head++];
+        /* adapters do not forward, only the first device of the path may be one */
+        if (u != from && g->nodes[u].type != SW) {
+            continue;
+        }
+        for (uint32_t e = g->offsets[u]; e < g->offsets[u + 1]; e++) {
+            int32_t v = g->edges[e].peer;
+            if (v >= 0 && parent[v] == NO_PARENT) {
+                parent[v] = u;
+                queue[tail++] = (uint32_t) v;
+            }
+        }
+    }
+    if (parent[to] != NO_PARENT) {
+        uint32_t len = 0;
+        for (uint32_t v = to; v != from; v = parent[v]) {
+            path[len++] = v;
+        }
+        path[len++] = from;
+        /* the walk went from the end back to the start */
+        for (uint32_t i = 0; i < len / 2; i++) {
+            uint32_t t = path[i];
+            path[i] = path[len - 1 - i];
+            path[len - 1 - i] = t;
+        }
+        hops = len - 1;
+    }
+    free(parent);
+    free(queue);
+    return hops;
+}
+
+static bool build_switch_graph(const struct topo_graph *g, struct hop_matrix *m, struct switch_graph *sg) {
+    uint32_t *index = malloc((size_t) g->ndevices * sizeof(uint32_t));
+    uint32_t n = 0;
+    if (!index) {
+        return false;
+    }
+    for (uint32_t i = 0; i < g->ndevices; i++) {
+        index[i] = (g->nodes[i].type == SW) ? n++ : NO_PARENT;
+    }
+    m->nswitches = sg->n = n;
+    m->switches = malloc(((size_t) n + 1) * sizeof(uint32_t));
+    sg->off = calloc((size_t) n + 2, sizeof(uint32_t));
+    if (!m->switches || !sg->off) {
+        free(index);
+        return false;
+    }
+    /* links are turned around, in-degrees are counted first and the offsets are their sums */
+    for (uint32_t i = 0; i < g->ndevices; i++) {
+        for (uint32_t e = g->offsets[i]; e < g->offsets[i + 1] && index[i] != NO_PARENT; e++) {
+            int32_t v = g->edges[e].peer;
+            if (v >= 0 && index[v] != NO_PARENT && (uint32_t) v != i) {
+                sg->off[index[v] + 2]++;
+            }
+        }
+    }
+    for (uint32_t i = 2; i < n + 2; i++) {
+        sg->off[i] += sg->off[i - 1];
+    }
+    sg->in = malloc(((size_t) sg->off[n + 1] + 1) * sizeof(uint32_t));
+    if (!sg->in) {
+        free(index);
+        return false;
+    }
+    for (uint32_t i = 0; i < g->ndevices; i++) {
+        if (index[i] == NO_PARENT) {
+            continue;
+        }
+        m->switches[index[i]] = i;
+        for (uint32_t e = g->offsets[i]; e < g->offsets[i + 1]; e++) {
+            int32_t v = g->edges[e].peer;
+            if (v >= 0 && index[v] != NO_PARENT && (uint32_t) v != i) {
+                sg->in[sg->off[index[v] + 1]++] = index[i];
+            }
+        }
+    }
+    free(index);
+    return true;
+}
+
+/* breadth-first search from HOP_BATCH switches at once: bit k of a word stands for source
+ * first + k, a level takes one pass over the links for all of them
+ * */
+static void search_batch(const struct switch_graph *sg, uint8_t *hops, uint32_t first,
+                         uint64_t *seen, uint64_t *frontier, uint64_t *next) {
+    uint32_t nsources = (sg->n - first < HOP_BATCH) ? sg->n - first : HOP_BATCH;
+    memset(hops + (size_t) first * sg->n, HOP_UNREACHABLE, (size_t) nsources * sg->n);
+    memset(seen, 0, (size_t) sg->n * sizeof(uint64_t));
+    memset(frontier, 0, (size_t) sg->n * sizeof(uint64_t));
+    for (uint32_t k = 0; k < nsources; k++) {
+        seen[first + k] = frontier[first + k] = UINT64_C(1) << k;
+        hops[(size_t) (first + k) * sg->n + first + k] = 0;
+    }
+    /* farther switches do not fit into a byte, they stay unreachable */
+    for (uint32_t level = 1; level < HOP_UNREACHABLE; level++) {
+        bool grown = false;
+        for (uint32_t v = 0; v < sg->n; v++) {
+            uint64_t reached = 0;
+            for (uint32_t e = sg->off[v]; e < sg->off[v + 1]; e++) {
+                reached |= frontier[sg->in[e]];
+            }
+            reached &= ~seen[v];
+            next[v] = reached;
+            if (!reached) {
+                continue;
+            }
+            seen[v] |= reached;
+            grown = true;
+            while (reached) {
+                int k = __builtin_ctzll(reached);
+                hops[(size_t) (first + (uint32_t) k) * sg->n + v] = (uint8_t) level;
+                reached &= reached - 1;
+            }
+        }
+        if (!grown) {
+            break;
+        }
+        uint64_t *t = frontier;
+        frontier = next;
+        next = t;
+    }
+}
+
+static void *hop_worker(void *arg) {
+    struct hop_job *job = arg;
+    const struct switch_graph *sg = job->sg;
+    uint64_t *words = malloc(((size_t) sg->n * 3 + 1) * sizeof(uint64_t));
+    if (!words) {
+        __atomic_store_n(&job->oom, true, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    for (;;) {
+        uint32_t batch = __atomic_fetch_add(&job->next_batch, 1, __ATOMIC_RELAXED);
+        if ((uint64_t) batch * HOP_BATCH >= sg->n || __atomic_load_n(&job->oom, __ATOMIC_RELAXED)) {
+            break;
+        }
+        search_batch(sg, job->hops, batch * HOP_BATCH, words, words + sg->n, words + 2 * (size_t) sg->n);
+    }
+    free(words);
+    return NULL;
+}
+
+/* hop_matrix_build computes hops between all pairs of switches of g with up to threads threads,
+ * links through adapters are not taken, false if memory ran out
+ * */
+bool hop_matrix_build(const struct topo_graph *g, unsigned int threads, struct hop_matrix *m) {
+    struct switch_graph sg = {0, NULL, NULL};
+    struct hop_job job;
+    memset(m, 0, sizeof(*m));
+    bool ok = build_switch_graph(g, m, &sg);
+    if (ok) {
+        m->hops = malloc((size_t) m->nswitches * m->nswitches + 1);
+        ok = (m->hops != NULL);
+    }
+    if (ok) {
+        job.sg = &sg;
+        job.hops = m->hops;
+        job.next_batch = 0;
+        job.oom = false;
+        if (threads < 1) {
+            threads = 1;
+        }
+        if (threads > m->nswitches / HOP_BATCH + 1) {
+            threads = m->nswitches / HOP_BATCH + 1;
+        }
+        pthread_t tids[threads];
+        unsigned int started = 0;
+        sigset_t all, saved;
+        /* signals are handled by the main thread only */
+        sigfillset(&all);
+        pthread_sigmask(SIG_BLOCK, &all, &saved);
+        for (; started < threads - 1; started++) {
+            if (pthread_create(&tids[started], NULL, hop_worker, &job) != 0) {
+                break;
+            }
+        }
+        pthread_sigmask(SIG_SETMASK, &saved, NULL);
+        hop_worker(&job);
+        for (unsigned int i = 0; i < started; i++) {
+            pthread_join(tids[i], NULL);
+        }
+        ok = !job.oom;
+    }
+    free(sg.off);
+    free(sg.in);
+    if (!ok) {
+        hop_matrix_free(m);
+    }
+    return ok;
+}
+
+void hop_matrix_free(struct hop_matrix *m) {
+    free(m->switches);
+    free(m->hops);
+    memset(m, 0, sizeof(*m));
+}
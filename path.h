@@ -0,0 +1,34 @@
+#ifndef PATH_H
+#define PATH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "topo.h"
+
+#define HOP_UNREACHABLE 255 /* hop count of switches not connected to each other */
+
+/* topo_shortest_path finds a path with the fewest links from device from to device to,
+ * traffic goes through switches only, adapters are the ends of a path.
+ * path gets the devices of the path from from to to, it has room for g->ndevices entries,
+ * the number of links is returned, -1 if to cannot be reached
+ * */
+int64_t topo_shortest_path(const struct topo_graph *g, uint32_t from, uint32_t to, uint32_t *path);
+
+/* hop counts between all pairs of switches, row i holds the hops from switch i,
+ * switches[i] is the device of switch i in the graph
+ * */
+struct hop_matrix {
+    uint32_t nswitches;
+    uint32_t *switches;
+    uint8_t *hops; /* nswitches * nswitches, HOP_UNREACHABLE if there is no path */
+};
+
+bool hop_matrix_build(const struct topo_graph *g, unsigned int threads, struct hop_matrix *m);
+
+static inline uint8_t hop_matrix_get(const struct hop_matrix *m, uint32_t from, uint32_t to) {
+    return m->hops[(size_t) from * m->nswitches + to];
+}
+
+void hop_matrix_free(struct hop_matrix *m);
+
+#endif
@@ -0,0 +1,241 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "render.h"
+
+#define PIECE_DEVICES 8192 /* devices formatted into one buffer */
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+/* text of devices first .. last - 1, the buffer is sized for the longest possible text up front */
+struct piece {
+    pthread_t thread;
+    const struct topo_graph *g;
+    uint32_t first;
+    uint32_t last;
+    char *data;
+    size_t len;
+    size_t cap;
+};
+
+static inline char *put_str(char *p, const char *s, size_t len) {
+    memcpy(p, s, len);
+    return p + len;
+}
+
+#define PUT_LIT(p, s) put_str((p), (s), sizeof(s) - 1)
+
+/* as "%lx" */
+static inline char *put_hex(char *p, uint64_t v) {
+    static const char digits[] = "0123456789abcdef";
+    char tmp[16];
+    int n = 0;
+    do {
+        tmp[n++] = digits[v & 0xf];
+        v >>= 4;
+    } while (v);
+    while (n) {
+        *p++ = tmp[--n];
+    }
+    return p;
+}
+
+/* as "%d" */
+static inline char *put_int(char *p, int32_t v) {
+    char tmp[10];
+    int n = 0;
+    uint32_t u = (uint32_t) v;
+    if (v < 0) {
+        *p++ = '-';
+        u = 0u - u;
+    }
+    do {
+        tmp[n++] = (char) ('0' + u % 10);
+        u /= 10;
+    } while (u);
+    while (n) {
+        *p++ = tmp[--n];
+    }
+    return p;
+}
+
+/* peer of the last resolved link before device first, a link nobody describes is printed with it */
+const struct topo_node *topo_carried_peer(const struct topo_graph *g, uint32_t first) {
+    for (uint32_t e = g->offsets[first]; e > 0; e--) {
+        if (g->edges[e - 1].peer >= 0) {
+            return &g->nodes[g->edges[e - 1].peer];
+        }
+    }
+    return NULL;
+}
+
+/* topo_render_device formats node with its links into p, which has room for
+ * RENDER_DEVICE_MAX_TEXT + nedges * RENDER_EDGE_MAX_TEXT bytes, and returns the end of the text.
+ * Peers of the links are nodes[edges[e].peer], *carry is the peer of the last resolved link
+ * formatted before, a link that is not resolved is printed with it
+ * */
+char *topo_render_device(char *p, const struct topo_node *node, const struct topo_edge *edges, uint32_t nedges,
+                         const struct topo_node *nodes, const struct topo_node **carry) {
+    const struct topo_node *value = *carry;
+    if (node->type == SW) {
+        p = PUT_LIT(p, "Switch:\nsysimgguid: 0x");
+        p = put_hex(p, node->sysimgguid);
+        p = PUT_LIT(p, "\nswitch_id: : 0x");
+        p = put_hex(p, node->devguid);
+        *p++ = '(';
+        p = put_hex(p, node->portguid);
+        p = PUT_LIT(p, ")\n");
+    } else {
+        p = PUT_LIT(p, "Host:\nsysimgguid: 0x");
+        p = put_hex(p, node->sysimgguid);
+        p = PUT_LIT(p, "\nport_id: : 0x");
+        p = put_hex(p, node->devguid);
+        *p++ = '\n';
+    }
+    for (uint32_t e = 0; e < nedges; e++) {
+        const struct topo_edge *cp = &edges[e];
+        if (cp->peer >= 0) {
+            value = &nodes[cp->peer];
+        }
+        if (cp->remote_type == SW) {
+            p = PUT_LIT(p, "\tConnected to switch: switchguid=");
+        } else {
+            p = PUT_LIT(p, "\tConnected to host: caguid=");
+        }
+        if (value == NULL) {
+            p = PUT_LIT(p, "(null)");
+        } else {
+            p = PUT_LIT(p, "0x");
+            p = put_hex(p, value->devguid);
+            if (value->type == SW) {
+                *p++ = '(';
+                p = put_hex(p, value->portguid);
+                *p++ = ')';
+            }
+        }
+        p = PUT_LIT(p, ", port=");
+        p = put_int(p, cp->rport);
+        *p++ = '\n';
+    }
+    *p++ = '\n';
+    *carry = value;
+    return p;
+}
+
+static void render_piece(struct piece *pc) {
+    const struct topo_graph *g = pc->g;
+    const struct topo_node *carry = topo_carried_peer(g, pc->first);
+    char *p = pc->data;
+    for (uint32_t i = pc->first; i < pc->last; i++) {
+        p = topo_render_device(p, &g->nodes[i], &g->edges[g->offsets[i]], g->offsets[i + 1] - g->offsets[i],
+                               g->nodes, &carry);
+    }
+    pc->len = (size_t) (p - pc->data);
+}
+
+static void *render_worker(void *arg) {
+    render_piece(arg);
+    return NULL;
+}
+
+/* writing all the buffers, short writes continue where they stopped */
+static bool write_pieces(int fd, struct piece *pieces, unsigned int n) {
+    struct iovec iov[n];
+    unsigned int first = 0;
+    for (unsigned int i = 0; i < n; i++) {
+        iov[i].iov_base = pieces[i].data;
+        iov[i].iov_len = pieces[i].len;
+    }
+    while (first < n) {
+        int cnt = (int) ((n - first > IOV_MAX) ? IOV_MAX : n - first);
+        ssize_t written = writev(fd, iov + first, cnt);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        while (first < n && (size_t) written >= iov[first].iov_len) {
+            written -= (ssize_t) iov[first].iov_len;
+            first++;
+        }
+        if (first < n) {
+            iov[first].iov_base = (char *) iov[first].iov_base + written;
+            iov[first].iov_len -= (size_t) written;
+        }
+    }
+    return true;
+}
+
+/* the graph is cut into pieces of PIECE_DEVICES devices, rounds of up to threads pieces are
+ * formatted in parallel and written before the next round, so memory stays bounded
+ * */
+bool topo_render(const struct topo_graph *g, int fd, unsigned int threads) {
+    bool ok = true;
+    if (threads < 1) {
+        threads = 1;
+    }
+    struct piece *pieces = calloc(threads, sizeof(struct piece));
+    if (!pieces) {
+        return false;
+    }
+    for (uint32_t next = 0; next < g->ndevices && ok;) {
+        unsigned int n = 0;
+        for (; n < threads && next < g->ndevices; n++) {
+            struct piece *pc = &pieces[n];
+            pc->g = g;
+            pc->first = next;
+            pc->last = (g->ndevices - next > PIECE_DEVICES) ? next + PIECE_DEVICES : g->ndevices;
+            next = pc->last;
+            size_t need = (size_t) (pc->last - pc->first) * RENDER_DEVICE_MAX_TEXT +
+                          (size_t) (g->offsets[pc->last] - g->offsets[pc->first]) * RENDER_EDGE_MAX_TEXT;
+            if (need > pc->cap) {
+                free(pc->data);
+                pc->data = malloc(need);
+                pc->cap = pc->data ? need : 0;
+                if (!pc->data) {
+                    ok = false;
+                    break;
+                }
+            }
+        }
+        if (!ok) {
+            break;
+        }
+        if (n == 1) {
+            render_piece(&pieces[0]);
+        } else {
+            sigset_t all, saved;
+            unsigned int started;
+            /* signals are handled by the main thread only */
+            sigfillset(&all);
+            pthread_sigmask(SIG_BLOCK, &all, &saved);
+            for (started = 0; started < n; started++) {
+                if (pthread_create(&pieces[started].thread, NULL, render_worker, &pieces[started]) != 0) {
+                    break;
+                }
+            }
+            pthread_sigmask(SIG_SETMASK, &saved, NULL);
+            for (unsigned int i = started; i < n; i++) {
+                render_piece(&pieces[i]);
+            }
+            for (unsigned int i = 0; i < started; i++) {
+                pthread_join(pieces[i].thread, NULL);
+            }
+        }
+        ok = write_pieces(fd, pieces, n);
+    }
+    for (unsigned int i = 0; i < threads; i++) {
+        free(pieces[i].data);
+    }
+    free(pieces);
+    return ok;
+}
@@ -0,0 +1,21 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <stdbool.h>
+#include "topo.h"
+
+/* writing the text dump of g to fd, parts of the graph are formatted by up to
+ * threads threads at once and written in order, false if writing failed
+ * */
+bool topo_render(const struct topo_graph *g, int fd, unsigned int threads);
+
+#define RENDER_DEVICE_MAX_TEXT 128 /* longest text of a device header, its trailing empty line included */
+#define RENDER_EDGE_MAX_TEXT 128 /* longest text of a link */
+
+char *topo_render_device(char *p, const struct topo_node *node, const struct topo_edge *edges, uint32_t nedges,
+                         const struct topo_node *nodes, const struct topo_node **carry);
+
+/* carry to start formatting device first of g with, as the whole dump would have it */
+const struct topo_node *topo_carried_peer(const struct topo_graph *g, uint32_t first);
+
+#endif
@@ -0,0 +1,167 @@
+#include <string.h>
+#include "scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+/* structural character of each SCAN_CHAR */
+static const char scan_chars[SCAN_KINDS] = {'\n', '#', '"', '[', ']', '(', ')', '='};
+
+static void block_detect(const char *p, struct scan_masks *m);
+
+/* the first call picks the implementation */
+static void (*block_fn)(const char *p, struct scan_masks *m) = block_detect;
+
+static int kind_of(char ch) {
+    for (int k = 0; k < SCAN_KINDS; k++) {
+        if (ch == scan_chars[k]) {
+            return k;
+        }
+    }
+    return -1;
+}
+
+static void block_scalar(const char *p, struct scan_masks *m) {
+    memset(m, 0, sizeof(*m));
+    for (int i = 0; i < SCAN_BLOCK; i++) {
+        int k = kind_of(p[i]);
+        if (k >= 0) {
+            m->bits[k] |= UINT64_C(1) << i;
+        }
+    }
+}
+
+#ifdef SCAN_X86
+__attribute__((target("sse2")))
+static void block_sse2(const char *p, struct scan_masks *m) {
+    __m128i v0 = _mm_loadu_si128((const __m128i *) p);
+    __m128i v1 = _mm_loadu_si128((const __m128i *) (p + 16));
+    __m128i v2 = _mm_loadu_si128((const __m128i *) (p + 32));
+    __m128i v3 = _mm_loadu_si128((const __m128i *) (p + 48));
+    for (int k = 0; k < SCAN_KINDS; k++) {
+        __m128i c = _mm_set1_epi8(scan_chars[k]);
+        uint64_t m0 = (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v0, c));
+        uint64_t m1 = (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v1, c));
+        uint64_t m2 = (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v2, c));
+        uint64_t m3 = (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v3, c));
+        m->bits[k] = m0 | m1 << 16 | m2 << 32 | m3 << 48;
+    }
+}
+
+__attribute__((target("avx2")))
+static void block_avx2(const char *p, struct scan_masks *m) {
+    __m256i lo = _mm256_loadu_si256((const __m256i *) p);
+    __m256i hi = _mm256_loadu_si256((const __m256i *) (p + 32));
+    for (int k = 0; k < SCAN_KINDS; k++) {
+        __m256i c = _mm256_set1_epi8(scan_chars[k]);
+        uint64_t mlo = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, c));
+        uint64_t mhi = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, c));
+        m->bits[k] = mlo | mhi << 32;
+    }
+}
+#endif
+
+/* the fastest implementation the CPU runs */
+SCAN_IMPL scan_best(void) {
+#ifdef SCAN_X86
+    if (__builtin_cpu_supports("avx2")) {
+        return SCAN_AVX2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return SCAN_SSE2;
+    }
+#endif
+    return SCAN_SCALAR;
+}
+
+/* scan_use switches the block scanner to impl, false if the CPU does not run it */
+bool scan_use(SCAN_IMPL impl) {
+    void (*fn)(const char *p, struct scan_masks *m) = block_scalar;
+#ifdef SCAN_X86
+    if (impl == SCAN_AVX2 && __builtin_cpu_supports("avx2")) {
+        fn = block_avx2;
+    } else if (impl == SCAN_SSE2 && __builtin_cpu_supports("sse2")) {
+        fn = block_sse2;
+    } else if (impl != SCAN_SCALAR) {
+        return false;
+    }
+#else
+    if (impl != SCAN_SCALAR) {
+        return false;
+    }
+#endif
+    __atomic_store_n(&block_fn, fn, __ATOMIC_RELAXED);
+    return true;
+}
+
+const char *scan_name(SCAN_IMPL impl) {
+    return (impl == SCAN_AVX2) ? "avx2" : (impl == SCAN_SSE2) ? "sse2" : "scalar";
+}
+
+static void block_detect(const char *p, struct scan_masks *m) {
+    scan_use(scan_best());
+    scan_block(p, m);
+}
+
+/* scan_block fills m for the SCAN_BLOCK bytes at p, all of them have to be readable */
+void scan_block(const char *p, struct scan_masks *m) {
+    __atomic_load_n(&block_fn, __ATOMIC_RELAXED)(p, m);
+}
+
+/* scan_line indexes the structural characters of len bytes at p, the last block is copied
+ * so nothing past the line is read
+ * */
+void scan_line(struct scan_line *sl, const char *p, size_t len) {
+    void (*fn)(const char *p, struct scan_masks *m) = __atomic_load_n(&block_fn, __ATOMIC_RELAXED);
+    size_t full = len / SCAN_BLOCK;
+    sl->ptr = p;
+    sl->len = len;
+    sl->nblocks = 0;
+    if (len > SCAN_LINE_BLOCKS * SCAN_BLOCK) {
+        return;
+    }
+    for (size_t b = 0; b < full; b++) {
+        fn(p + b * SCAN_BLOCK, &sl->blocks[b]);
+    }
+    if (len % SCAN_BLOCK) {
+        char tail[SCAN_BLOCK];
+        memset(tail, 0, sizeof(tail));
+        memcpy(tail, p + full * SCAN_BLOCK, len % SCAN_BLOCK);
+        fn(tail, &sl->blocks[full]);
+    }
+    sl->nblocks = (uint32_t) ((len + SCAN_BLOCK - 1) / SCAN_BLOCK);
+}
+
+/* scan_find returns the position of the first character of the kinds set (SCAN_BIT()s) at or after from,
+ * the length of the line if there is none
+ * */
+size_t scan_find(const struct scan_line *sl, unsigned int kinds, size_t from) {
+    kinds &= SCAN_BIT(SCAN_KINDS) - 1;
+    if (from >= sl->len) {
+        return sl->len;
+    }
+    if (sl->nblocks == 0) {
+        for (size_t i = from; i < sl->len; i++) {
+            int k = kind_of(sl->ptr[i]);
+            if (k >= 0 && (kinds & SCAN_BIT(k))) {
+                return i;
+            }
+        }
+        return sl->len;
+    }
+    for (size_t b = from / SCAN_BLOCK; b < sl->nblocks; b++) {
+        uint64_t m = 0;
+        for (unsigned int set = kinds; set; set &= set - 1) {
+            m |= sl->blocks[b].bits[__builtin_ctz(set)];
+        }
+        if (b == from / SCAN_BLOCK) {
+            m &= ~UINT64_C(0) << (from % SCAN_BLOCK);
+        }
+        if (m) {
+            return b * SCAN_BLOCK + (size_t) __builtin_ctzll(m);
+        }
+    }
+    return sl->len;
+}
@@ -0,0 +1,51 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* structural characters of the topology format */
+typedef enum {
+    SCAN_NEWLINE, SCAN_HASH, SCAN_QUOTE, SCAN_LBRACKET, SCAN_RBRACKET, SCAN_LPAREN, SCAN_RPAREN, SCAN_EQUALS,
+    SCAN_KINDS
+} SCAN_CHAR;
+
+#define SCAN_BIT(kind) (1u << (kind))
+#define SCAN_BLOCK 64
+
+/* positions of the structural characters in a block of SCAN_BLOCK bytes, bit i of bits[kind]
+ * is set if byte i is that character
+ * */
+struct scan_masks {
+    uint64_t bits[SCAN_KINDS];
+};
+
+/* implementations of the block scanner, the best one the CPU has is used */
+typedef enum {
+    SCAN_SCALAR, SCAN_SSE2, SCAN_AVX2
+} SCAN_IMPL;
+
+SCAN_IMPL scan_best(void);
+
+bool scan_use(SCAN_IMPL impl);
+
+const char *scan_name(SCAN_IMPL impl);
+
+void scan_block(const char *p, struct scan_masks *m);
+
+/* masks of a line, lines longer than SCAN_LINE_BLOCKS blocks are searched byte by byte */
+#define SCAN_LINE_BLOCKS 8
+
+struct scan_line {
+    const char *ptr;
+    size_t len;
+    uint32_t nblocks; /* 0 if the line was too long to be indexed */
+    struct scan_masks blocks[SCAN_LINE_BLOCKS];
+};
+
+void scan_line(struct scan_line *sl, const char *p, size_t len);
+
+size_t scan_find(const struct scan_line *sl, unsigned int kinds, size_t from);
+
+#endif
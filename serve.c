@@ -0,0 +1,416 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include "hash.h"
+#include "render.h"
+#include "path.h"
+#include "serve.h"
+
+#define SERVE_BACKLOG 64
+#define SERVE_QUERY_MAX 256 /* longest query line */
+#define SERVE_IO_TIMEOUT_MS 1000 /* a client that stalls longer is dropped */
+#define SERVE_BACKOFF_MS 100 /* pause before accepting again when out of descriptors or memory */
+
+/* device of the graph by a LID of it */
+struct lid_ref {
+    int32_t lid;
+    uint32_t index;
+};
+
+struct server {
+    int fd;
+    char path[sizeof(((struct sockaddr_un *) 0)->sun_path)];
+    struct topo_graph graph; /* owned by the caller */
+    struct hashmap *nodes; /* GUID index of the graph, struct topo_guid_ref */
+    bool nodes_mapped; /* the index was saved with the snapshot, it is not known to be up to date */
+    struct hashmap *lids;
+};
+
+/* reply being put together before it is written */
+struct reply {
+    char *data;
+    size_t len;
+    size_t cap;
+    bool oom;
+};
+
+static uint64_t lid_ref_hash(const void *item, uint64_t seed0, uint64_t seed1) {
+    const struct lid_ref *r = item;
+    return hashmap_murmur(&r->lid, sizeof(r->lid), seed0, seed1);
+}
+
+static int lid_ref_compare(const void *a, const void *b, void *udata) {
+    const struct lid_ref *ra = a;
+    const struct lid_ref *rb = b;
+    (void)udata;
+    return (ra->lid > rb->lid) - (ra->lid < rb->lid);
+}
+
+/* "S-<hex>", "H-<hex>", "0x<hex>" or "<hex>", type is 0 if the GUID does not tell it */
+static bool parse_guid(const char *s, uint64_t *guid, char *type) {
+    char *end;
+    *type = 0;
+    if ((s[0] == 'S' || s[0] == 'H') && s[1] == '-') {
+        *type = s[0];
+        s += 2;
+    } else if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
+        s += 2;
+    }
+    if (!isxdigit((unsigned char) s[0])) {
+        return false;
+    }
+    errno = 0;
+    *guid = strtoull(s, &end, 16);
+    return *end == '\0' && errno == 0;
+}
+
+/* clearing the path of the socket: a socket left behind by a daemon that did not exit cleanly
+ * is removed, nobody accepts on it any more. Anything else there is left alone, false then
+ * */
+static bool remove_stale_socket(const struct sockaddr_un *addr) {
+    struct stat st;
+    if (lstat(addr->sun_path, &st) == -1) {
+        return errno == ENOENT;
+    }
+    if (!S_ISSOCK(st.st_mode)) {
+        return false;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return false;
+    }
+    bool stale = connect(fd, (const struct sockaddr *) addr, sizeof(*addr)) == -1 && errno == ECONNREFUSED;
+    close(fd);
+    return stale && unlink(addr->sun_path) == 0;
+}
+
+/* serve_open listens on a new socket at path, NULL if it cannot or the path is taken */
+struct server *serve_open(const char *path) {
+    struct sockaddr_un addr;
+    struct server *s;
+    memset(&addr, 0, sizeof(addr));
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        return NULL;
+    }
+    s = calloc(1, sizeof(struct server));
+    if (!s) {
+        return NULL;
+    }
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    strcpy(s->path, path);
+    s->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (s->fd == -1) {
+        free(s);
+        return NULL;
+    }
+    if (!remove_stale_socket(&addr) || bind(s->fd, (struct sockaddr *) &addr, sizeof(addr)) == -1 ||
+        listen(s->fd, SERVE_BACKLOG) == -1) {
+        close(s->fd);
+        free(s);
+        return NULL;
+    }
+    return s;
+}
+
+/* serve_set_graph starts answering from g, which has to stay valid until the next call.
+ * guids is the GUID index of g mapped with guid_index_map(), the server owns it from then on,
+ * it is built from g if NULL. false if the lookup tables could not be built, the previous graph is kept then
+ * */
+bool serve_set_graph(struct server *s, const struct topo_graph *g, struct hashmap *guids) {
+    struct hashmap *nodes = guids ? guids : guid_index_build(g);
+    struct hashmap *lids = hashmap_new(sizeof(struct lid_ref), 0, 0, 0,
+                                       lid_ref_hash, lid_ref_compare, NULL, NULL);
+    if (!nodes || !lids || !hashmap_reserve(lids, g->ndevices)) {
+        goto fail;
+    }
+    for (uint32_t i = 0; i < g->ndevices; i++) {
+        const struct topo_node *node = &g->nodes[i];
+        /* the last device with a LID wins, as links of the dump resolve to it */
+        if (node->type == SW) {
+            struct lid_ref lr = {.lid = node->lid, .index = i};
+            if (lr.lid > 0) {
+                hashmap_set(lids, &lr);
+            }
+            continue;
+        }
+        /* adapters have a LID per port, it is the local LID of the link */
+        for (uint32_t e = g->offsets[i]; e < g->offsets[i + 1]; e++) {
+            struct lid_ref lr = {.lid = g->edges[e].llid, .index = i};
+            if (lr.lid > 0) {
+                hashmap_set(lids, &lr);
+            }
+        }
+    }
+    if (hashmap_oom(lids)) {
+        goto fail;
+    }
+    if (s->nodes) {
+        hashmap_free(s->nodes);
+        hashmap_free(s->lids);
+    }
+    s->nodes = nodes;
+    s->nodes_mapped = (guids != NULL);
+    s->lids = lids;
+    s->graph = *g;
+    return true;
+fail:
+    if (nodes) {
+        hashmap_free(nodes);
+    }
+    if (lids) {
+        hashmap_free(lids);
+    }
+    return false;
+}
+
+static char *reply_reserve(struct reply *r, size_t size) {
+    if (r->oom) {
+        return NULL;
+    }
+    if (r->cap - r->len < size) {
+        size_t cap = r->cap ? r->cap : 4096;
+        while (cap - r->len < size) {
+            cap *= 2;
+        }
+        char *data = realloc(r->data, cap);
+        if (!data) {
+            r->oom = true;
+            return NULL;
+        }
+        r->data = data;
+        r->cap = cap;
+    }
+    return r->data + r->len;
+}
+
+static void reply_printf(struct reply *r, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void reply_printf(struct reply *r, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+    char *p = (n >= 0) ? reply_reserve(r, (size_t) n + 1) : NULL;
+    if (!p) {
+        return;
+    }
+    va_start(ap, fmt);
+    vsnprintf(p, (size_t) n + 1, fmt, ap);
+    va_end(ap);
+    r->len += (size_t) n;
+}
+
+static void reply_device(struct reply *r, const struct topo_graph *g, uint32_t i) {
+    uint32_t nedges = g->offsets[i + 1] - g->offsets[i];
+    const struct topo_node *carry = topo_carried_peer(g, i);
+    char *p = reply_reserve(r, RENDER_DEVICE_MAX_TEXT + (size_t) nedges * RENDER_EDGE_MAX_TEXT);
+    if (!p) {
+        return;
+    }
+    char *end = topo_render_device(p, &g->nodes[i], &g->edges[g->offsets[i]], nedges, g->nodes, &carry);
+    r->len += (size_t) (end - p);
+}
+
+static void reply_neighbors(struct reply *r, const struct topo_graph *g, uint32_t i) {
+    for (uint32_t e = g->offsets[i]; e < g->offsets[i + 1]; e++) {
+        const struct topo_edge *edge = &g->edges[e];
+        /* lines of switches carry the LID of the peer only, lines of adapters both */
+        int32_t lid = (g->nodes[i].type == SW) ? edge->llid : edge->rlid;
+        reply_printf(r, "[%d]\t\"%s\"[%d]\t# \"%s\" lid %d %s\n", edge->lport, TOPO_STR(g, edge->node_guid),
+                     edge->rport, TOPO_STR(g, edge->desc), lid, TOPO_STR(g, edge->speed));
+    }
+}
+
+static void reply_path(struct reply *r, const struct topo_graph *g, uint32_t from, uint32_t to) {
+    uint32_t *path = malloc((size_t) g->ndevices * sizeof(uint32_t));
+    int64_t hops = path ? topo_shortest_path(g, from, to, path) : -1;
+    if (hops < 0) {
+        reply_printf(r, "error: no path\n");
+    } else {
+        reply_printf(r, "hops %ld\n", (long int) hops);
+        for (int64_t i = 0; i <= hops; i++) {
+            const struct topo_node *node = &g->nodes[path[i]];
+            reply_printf(r, "\"%s\"\t# \"%s\"\n", TOPO_STR(g, node->name), TOPO_STR(g, node->desc));
+        }
+    }
+    free(path);
+}
+
+/* device of a GUID in the index, a GUID without type may be a switch or an adapter, switches are tried first */
+static const struct topo_guid_ref *lookup_device(struct server *s, uint64_t guid, char type) {
+    const struct topo_guid_ref *found = NULL;
+    if (type) {
+        return guid_index_find(s->nodes, &s->graph, guid, type);
+    }
+    found = guid_index_find(s->nodes, &s->graph, guid, 'S');
+    if (!found) {
+        found = guid_index_find(s->nodes, &s->graph, guid, 'H');
+    }
+    return found;
+}
+
+/* device of a GUID. A mapped index that was left stale misses devices of the graph, it is replaced
+ * by one built from the graph then, so the answer is the same as of --path, which searches the graph
+ * */
+static const struct topo_guid_ref *find_device(struct server *s, const char *arg) {
+    uint64_t guid;
+    char type;
+    if (!parse_guid(arg, &guid, &type)) {
+        return NULL;
+    }
+    const struct topo_guid_ref *found = lookup_device(s, guid, type);
+    if (!found && s->nodes_mapped) {
+        struct hashmap *built = guid_index_build(&s->graph);
+        if (built) {
+            hashmap_free(s->nodes);
+            s->nodes = built;
+            s->nodes_mapped = false;
+            found = lookup_device(s, guid, type);
+        }
+    }
+    return found;
+}
+
+static bool write_all(int fd, const char *p, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno != EINTR) {
+            return false;
+        }
+        if (n > 0) {
+            p += n;
+            len -= (size_t) n;
+        }
+    }
+    return true;
+}
+
+/* reading the query line, false if the client sent none */
+static bool read_query(int fd, char *query, size_t size) {
+    size_t len = 0;
+    while (len < size - 1) {
+        ssize_t n = read(fd, query + len, size - 1 - len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        len += (size_t) n;
+        if (memchr(query, '\n', len)) {
+            break;
+        }
+    }
+    query[len] = '\0';
+    query[strcspn(query, "\r\n")] = '\0';
+    return len > 0;
+}
+
+static void answer(struct server *s, int fd) {
+    char query[SERVE_QUERY_MAX];
+    struct reply r = {NULL, 0, 0, false};
+    const struct topo_graph *g = &s->graph;
+    if (!read_query(fd, query, sizeof(query))) {
+        return;
+    }
+    char *arg = strchr(query, ' ');
+    if (arg) {
+        *arg++ = '\0';
+        arg += strspn(arg, " ");
+    }
+    if (!strcmp(query, "dump") && !arg) {
+        topo_render(g, fd, 1);
+        return;
+    }
+    if ((!strcmp(query, "guid") || !strcmp(query, "neighbors")) && arg) {
+        const struct topo_guid_ref *ref = find_device(s, arg);
+        if (!ref) {
+            reply_printf(&r, "error: no device %s\n", arg);
+        } else if (query[0] == 'g') {
+            reply_device(&r, g, ref->index);
+        } else {
+            reply_neighbors(&r, g, ref->index);
+        }
+    } else if (!strcmp(query, "path") && arg && strchr(arg, ' ')) {
+        char *to = strchr(arg, ' ');
+        *to++ = '\0';
+        to += strspn(to, " ");
+        const struct topo_guid_ref *a = find_device(s, arg);
+        const struct topo_guid_ref *b = find_device(s, to);
+        if (!a || !b) {
+            reply_printf(&r, "error: no device %s\n", a ? to : arg);
+        } else {
+            reply_path(&r, g, a->index, b->index);
+        }
+    } else if (!strcmp(query, "lid") && arg) {
+        char *end;
+        struct lid_ref key = {.lid = (int32_t) strtol(arg, &end, 0), .index = 0};
+        const struct lid_ref *ref = (*end == '\0' && end != arg) ? hashmap_get(s->lids, &key) : NULL;
+        if (!ref) {
+            reply_printf(&r, "error: no device with lid %s\n", arg);
+        } else {
+            reply_device(&r, g, ref->index);
+        }
+    } else {
+        reply_printf(&r, "error: unknown query, expected guid <GUID>, neighbors <GUID>, lid <LID>, "
+                        "path <GUID> <GUID> or dump\n");
+    }
+    if (r.oom) {
+        static const char msg[] = "error: out of memory\n";
+        write_all(fd, msg, sizeof(msg) - 1);
+    } else {
+        write_all(fd, r.data, r.len);
+    }
+    free(r.data);
+}
+
+/* serve_wait answers the next client if one connects within timeout_ms,
+ * 1 if a query was answered, 0 on timeout, signal or a temporary failure, -1 if the socket failed
+ * */
+int serve_wait(struct server *s, int timeout_ms) {
+    struct pollfd pfd = {.fd = s->fd, .events = POLLIN, .revents = 0};
+    struct timeval tv = {SERVE_IO_TIMEOUT_MS / 1000, (SERVE_IO_TIMEOUT_MS % 1000) * 1000};
+    int n = poll(&pfd, 1, timeout_ms);
+    if (n <= 0) {
+        return (n == 0 || errno == EINTR) ? 0 : -1;
+    }
+    int fd = accept4(s->fd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd == -1) {
+        /* out of descriptors or memory for now, the client is taken once some are given back */
+        if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+            poll(NULL, 0, SERVE_BACKOFF_MS);
+            return 0;
+        }
+        return (errno == EINTR || errno == ECONNABORTED || errno == EAGAIN || errno == EPROTO) ? 0 : -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    if (s->nodes) {
+        answer(s, fd);
+    }
+    close(fd);
+    return 1;
+}
+
+/* serve_close stops serving and removes the socket */
+void serve_close(struct server *s) {
+    close(s->fd);
+    unlink(s->path);
+    if (s->nodes) {
+        hashmap_free(s->nodes);
+        hashmap_free(s->lids);
+    }
+    free(s);
+}
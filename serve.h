@@ -0,0 +1,26 @@
+#ifndef SERVE_H
+#define SERVE_H
+
+#include <stdbool.h>
+#include "topo.h"
+
+/* queries about a parsed topology answered over a Unix domain socket, one query line per connection:
+ *   guid <GUID>       text of the device, as in the dump
+ *   neighbors <GUID>  links of the device, one per line: [lport]\t"<peer GUID>"[rport]\t# "<peer desc>" lid <peer LID> <speed>
+ *   lid <LID>         text of the device the LID belongs to
+ *   path <GUID> <GUID>  line "hops <n>", then the devices of a shortest path, one per line: "<GUID>"\t# "<desc>"
+ *   dump              the whole text dump
+ * GUIDs are given as in the topology file, "S-<hex>" or "H-<hex>", or as "0x<hex>".
+ * A query that cannot be answered gets a single "error: ..." line.
+ * */
+struct server;
+
+struct server *serve_open(const char *path);
+
+bool serve_set_graph(struct server *s, const struct topo_graph *g, struct hashmap *guids);
+
+int serve_wait(struct server *s, int timeout_ms);
+
+void serve_close(struct server *s);
+
+#endif
@@ -0,0 +1,116 @@
+#include <string.h>
+#include <time.h>
+#include "stats.h"
+
+bool stats_enabled = false;
+__thread struct parse_stats thread_stats;
+
+static const char *phase_names[PHASE_COUNT] = {
+        "io", "classify", "tokenize", "hash_insert", "list_build", "graph_build", "render", "snapshot"
+};
+
+static const char *line_names[LINE_COUNT] = {
+        "blank", "comment", "attribute", "node", "link", "other"
+};
+
+/* monotonic time in nanoseconds */
+uint64_t stats_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+/* kind of a raw line, newline included */
+STATS_LINE stats_classify(const char *line, size_t len) {
+    if (len == 0 || line[0] == '\n' || line[0] == '\r') {
+        return LINE_BLANK;
+    }
+    if (line[0] == '#') {
+        return LINE_COMMENT;
+    }
+    if (line[0] == '[') {
+        return LINE_LINK;
+    }
+    if ((len >= 6 && !memcmp(line, "Switch", 6)) || (len >= 2 && !memcmp(line, "Ca", 2))) {
+        return LINE_NODE;
+    }
+    if (memchr(line, '=', len)) {
+        return LINE_ATTRIBUTE;
+    }
+    return LINE_OTHER;
+}
+
+void stats_add(struct parse_stats *dst, const struct parse_stats *src) {
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        dst->phase_ns[i] += src->phase_ns[i];
+    }
+    for (int i = 0; i < LINE_COUNT; i++) {
+        dst->lines[i] += src->lines[i];
+    }
+}
+
+static long int total_lines(const struct stats_report *r) {
+    long int total = 0;
+    for (int i = 0; i < LINE_COUNT; i++) {
+        total += r->parse.lines[i];
+    }
+    return total;
+}
+
+static void print_json_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (; s && *s; s++) {
+        unsigned char c = (unsigned char) *s;
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+/* one JSON object on one line, phase times are in nanoseconds */
+void stats_print_json(FILE *out, const struct stats_report *r) {
+    fprintf(out, "{\"file\":");
+    print_json_string(out, r->file);
+    fprintf(out, ",\"mode\":\"%s\",\"threads\":%u,\"total_ns\":%llu,\"analysis_ns\":%llu,\"phases_ns\":{",
+            r->mode, r->threads, (unsigned long long) r->total_ns, (unsigned long long) r->analysis_ns);
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        fprintf(out, "%s\"%s\":%llu", i ? "," : "", phase_names[i], (unsigned long long) r->parse.phase_ns[i]);
+    }
+    fprintf(out, "},\"lines\":{\"total\":%ld", total_lines(r));
+    for (int i = 0; i < LINE_COUNT; i++) {
+        fprintf(out, ",\"%s\":%ld", line_names[i], r->parse.lines[i]);
+    }
+    fprintf(out, "},\"devices\":%u,\"links\":%u,\"unresolved_links\":%u,\"blocks_reused\":%u,\"malformed\":%u,"
+                 "\"bytes\":{\"input\":%ld,\"arena\":%zu,\"strings\":%zu,\"hashmap\":%zu},"
+                 "\"hashmap\":{\"count\":%zu,\"buckets\":%zu,\"resizes\":%zu,\"max_probe\":%zu,\"avg_probe\":%.3f}}\n",
+            r->devices, r->links, r->unresolved_links, r->blocks_reused, r->malformed_values,
+            r->input_bytes, r->arena_bytes, r->string_bytes, r->guid_map.memory,
+            r->guid_map.count, r->guid_map.nbuckets, r->guid_map.resizes, r->guid_map.max_probe,
+            r->guid_map.avg_probe);
+}
+
+void stats_print_text(FILE *out, const struct stats_report *r) {
+    fprintf(out, "Statistics of %s (%s, %u thread%s)\n", r->file, r->mode, r->threads, (r->threads == 1) ? "" : "s");
+    fprintf(out, "  %-16s %12.3f ms\n", "total", (double) r->total_ns / 1e6);
+    fprintf(out, "  %-16s %12.3f ms\n", "analysis", (double) r->analysis_ns / 1e6);
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        fprintf(out, "  %-16s %12.3f ms\n", phase_names[i], (double) r->parse.phase_ns[i] / 1e6);
+    }
+    fprintf(out, "  %-16s %12ld\n", "lines", total_lines(r));
+    for (int i = 0; i < LINE_COUNT; i++) {
+        fprintf(out, "    %-14s %12ld\n", line_names[i], r->parse.lines[i]);
+    }
+    fprintf(out, "  %-16s %12u\n  %-16s %12u\n  %-16s %12u\n  %-16s %12u\n  %-16s %12u\n", "devices", r->devices,
+            "links", r->links, "unresolved links", r->unresolved_links, "blocks reused", r->blocks_reused,
+            "malformed", r->malformed_values);
+    fprintf(out, "  %-16s %12ld\n  %-16s %12zu\n  %-16s %12zu\n  %-16s %12zu\n", "input bytes", r->input_bytes,
+            "arena bytes", r->arena_bytes, "string bytes", r->string_bytes, "hashmap bytes", r->guid_map.memory);
+    fprintf(out, "  %-16s %12zu\n  %-16s %12zu\n  %-16s %12zu\n  %-16s %12.3f\n", "hashmap buckets",
+            r->guid_map.nbuckets, "hashmap resizes", r->guid_map.resizes, "max probe", r->guid_map.max_probe,
+            "avg probe", r->guid_map.avg_probe);
+}
@@ -0,0 +1,76 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "hash.h"
+
+/* phases of a run, parse phases are added up over all parser threads */
+typedef enum {
+    PHASE_IO,          /* reading or mapping the file */
+    PHASE_CLASSIFY,    /* skipping, trimming and sorting out lines */
+    PHASE_TOKENIZE,    /* scanners, without their hash inserts */
+    PHASE_HASH_INSERT, /* GUID table inserts */
+    PHASE_LIST_BUILD,  /* adding devices to the list, merging -j results */
+    PHASE_GRAPH_BUILD, /* device list into CSR graph */
+    PHASE_RENDER,      /* text dump */
+    PHASE_SNAPSHOT,    /* binary snapshot */
+    PHASE_COUNT
+} STATS_PHASE;
+
+/* kinds of lines of a topology file */
+typedef enum {
+    LINE_BLANK, LINE_COMMENT, LINE_ATTRIBUTE, LINE_NODE, LINE_LINK, LINE_OTHER, LINE_COUNT
+} STATS_LINE;
+
+/* counters of one parser thread */
+struct parse_stats {
+    uint64_t phase_ns[PHASE_COUNT];
+    long int lines[LINE_COUNT];
+};
+
+/* everything --stats reports about a run */
+struct stats_report {
+    const char *file;
+    const char *mode;
+    unsigned int threads;
+    uint64_t total_ns;
+    uint64_t analysis_ns; /* parse and graph build, the "Topology analysis took" time */
+    struct parse_stats parse;
+    long int input_bytes;
+    unsigned int devices;
+    unsigned int links;
+    unsigned int unresolved_links;
+    unsigned int blocks_reused;
+    unsigned int malformed_values; /* ids and GUIDs left out */
+    size_t arena_bytes;
+    size_t string_bytes;
+    struct hashmap_stats guid_map;
+};
+
+/* set by --stats, the clock is not read otherwise */
+extern bool stats_enabled;
+extern __thread struct parse_stats thread_stats;
+
+uint64_t stats_clock(void);
+
+static inline uint64_t phase_begin(void) {
+    return stats_enabled ? stats_clock() : 0;
+}
+
+static inline void phase_end(STATS_PHASE phase, uint64_t t0) {
+    if (stats_enabled) {
+        thread_stats.phase_ns[phase] += stats_clock() - t0;
+    }
+}
+
+STATS_LINE stats_classify(const char *line, size_t len);
+
+void stats_add(struct parse_stats *dst, const struct parse_stats *src);
+
+void stats_print_json(FILE *out, const struct stats_report *r);
+
+void stats_print_text(FILE *out, const struct stats_report *r);
+
+#endif
@@ -0,0 +1,338 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "hash.h"
+#include "render.h"
+#include "stream.h"
+
+#define STREAM_BUFFER (1024 * 1024)
+
+/* device whose links are not all resolved yet, peers[e] is the peer of link e */
+struct stream_device {
+    struct topo_node node;
+    uint32_t nedges;
+    uint32_t unresolved;
+    struct topo_edge *edges; /* peer is e once link e is resolved, -1 until then */
+    struct topo_node *peers;
+    struct stream_device *prev; /* devices waiting, in file order */
+    struct stream_device *next;
+};
+
+/* link e of dev waits for a device to appear */
+struct waiter {
+    struct stream_device *dev;
+    uint32_t edge;
+    struct waiter *next;
+};
+
+/* device links wait for, it is dropped when the device is seen */
+struct peer_entry {
+    struct stream_key key;
+    struct waiter *waiters;
+};
+
+/* device as the links pointing to it see it, kept once seen since link counts of the input
+ * are not symmetric and any later link may still point to it, the key is flattened into it
+ * */
+struct peer_record {
+    uint64_t guid;
+    uint64_t devguid;
+    uint64_t portguid;
+    char key_type;
+    uint8_t type;
+};
+
+struct stream {
+    int fd;
+    bool failed;
+    struct hashmap *peers;
+    struct hashmap *seen;
+    struct stream_device *head;
+    struct stream_device *tail;
+    struct topo_node carry; /* peer of the last resolved link written */
+    bool have_carry;
+    char *buf;
+    size_t len;
+    size_t cap;
+    struct stream_stats stats;
+};
+
+static uint64_t peer_entry_hash(const void *item, uint64_t seed0, uint64_t seed1) {
+    const struct peer_entry *e = item;
+    (void)seed1;
+    uint64_t h = e->key.guid ^ seed0 ^ ((uint64_t) (unsigned char) e->key.type << 56);
+    h ^= h >> 33;
+    h *= UINT64_C(0xff51afd7ed558ccd);
+    h ^= h >> 33;
+    return h;
+}
+
+static int peer_entry_compare(const void *a, const void *b, void *udata) {
+    const struct peer_entry *ea = a;
+    const struct peer_entry *eb = b;
+    (void)udata;
+    if (ea->key.guid != eb->key.guid) {
+        return (ea->key.guid < eb->key.guid) ? -1 : 1;
+    }
+    return ea->key.type - eb->key.type;
+}
+
+static uint64_t peer_record_hash(const void *item, uint64_t seed0, uint64_t seed1) {
+    const struct peer_record *r = item;
+    (void)seed1;
+    uint64_t h = r->guid ^ seed0 ^ ((uint64_t) (unsigned char) r->key_type << 56);
+    h ^= h >> 33;
+    h *= UINT64_C(0xff51afd7ed558ccd);
+    h ^= h >> 33;
+    return h;
+}
+
+static int peer_record_compare(const void *a, const void *b, void *udata) {
+    const struct peer_record *ra = a;
+    const struct peer_record *rb = b;
+    (void)udata;
+    if (ra->guid != rb->guid) {
+        return (ra->guid < rb->guid) ? -1 : 1;
+    }
+    return ra->key_type - rb->key_type;
+}
+
+struct stream *stream_new(int fd) {
+    struct stream *s = calloc(1, sizeof(struct stream));
+    if (!s) {
+        return NULL;
+    }
+    s->fd = fd;
+    s->cap = STREAM_BUFFER;
+    s->buf = malloc(s->cap);
+    s->peers = hashmap_new(sizeof(struct peer_entry), 0, 0, 0, peer_entry_hash, peer_entry_compare, NULL, NULL);
+    s->seen = hashmap_new(sizeof(struct peer_record), 0, 0, 0, peer_record_hash, peer_record_compare, NULL, NULL);
+    if (!s->buf || !s->peers || !s->seen) {
+        free(s->buf);
+        hashmap_free(s->peers);
+        hashmap_free(s->seen);
+        free(s);
+        return NULL;
+    }
+    return s;
+}
+
+static void flush_buffer(struct stream *s) {
+    size_t off = 0;
+    while (off < s->len && !s->failed) {
+        ssize_t n = write(s->fd, s->buf + off, s->len - off);
+        if (n < 0 && errno != EINTR) {
+            s->failed = true;
+        } else if (n > 0) {
+            off += (size_t) n;
+        }
+    }
+    s->len = 0;
+}
+
+/* writing the device and forgetting it */
+static void emit(struct stream *s, struct stream_device *d) {
+    size_t need = RENDER_DEVICE_MAX_TEXT + (size_t) d->nedges * RENDER_EDGE_MAX_TEXT;
+    const struct topo_node *carry = s->have_carry ? &s->carry : NULL;
+    if (s->cap - s->len < need) {
+        flush_buffer(s);
+        if (need > s->cap) {
+            char *buf = realloc(s->buf, need);
+            if (!buf) {
+                s->failed = true;
+                return;
+            }
+            s->buf = buf;
+            s->cap = need;
+        }
+    }
+    char *end = topo_render_device(s->buf + s->len, &d->node, d->edges, d->nedges, d->peers, &carry);
+    s->len = (size_t) (end - s->buf);
+    if (carry && carry != &s->carry) {
+        s->carry = *carry;
+        s->have_carry = true;
+    }
+    if (d->prev || s->head == d) {
+        /* it was waiting */
+        if (d->prev) {
+            d->prev->next = d->next;
+        } else {
+            s->head = d->next;
+        }
+        if (d->next) {
+            d->next->prev = d->prev;
+        } else {
+            s->tail = d->prev;
+        }
+        s->stats.waiting_devices--;
+    }
+    free(d);
+}
+
+static void resolve(struct stream_device *d, uint32_t e, const struct peer_record *peer) {
+    d->peers[e].devguid = peer->devguid;
+    d->peers[e].portguid = peer->portguid;
+    d->peers[e].type = peer->type;
+    d->edges[e].peer = (int32_t) e;
+}
+
+static struct peer_entry *get_entry(struct stream *s, struct stream_key key) {
+    struct peer_entry probe;
+    memset(&probe, 0, sizeof(probe));
+    probe.key = key;
+    return hashmap_get(s->peers, &probe);
+}
+
+static struct peer_record *get_record(struct stream *s, struct stream_key key) {
+    struct peer_record probe;
+    memset(&probe, 0, sizeof(probe));
+    probe.guid = key.guid;
+    probe.key_type = key.type;
+    return hashmap_get(s->seen, &probe);
+}
+
+/* entry of key, created if nothing waits for the device yet, NULL when out of memory */
+static struct peer_entry *get_or_add_entry(struct stream *s, struct stream_key key) {
+    struct peer_entry *e = get_entry(s, key);
+    if (e) {
+        return e;
+    }
+    struct peer_entry fresh;
+    memset(&fresh, 0, sizeof(fresh));
+    fresh.key = key;
+    if (!hashmap_set(s->peers, &fresh) && hashmap_oom(s->peers)) {
+        return NULL;
+    }
+    if (hashmap_count(s->peers) > s->stats.peak_peers) {
+        s->stats.peak_peers = hashmap_count(s->peers);
+    }
+    return get_entry(s, key);
+}
+
+/* stream_add takes the next device of the file, links of edges point to the devices of
+ * link_keys, only rport and remote_type of the edges are used
+ * */
+bool stream_add(struct stream *s, const struct topo_node *node, struct stream_key key,
+                const struct topo_edge *edges, const struct stream_key *link_keys, uint32_t nedges) {
+    struct waiter *waiters = NULL;
+    struct peer_record self;
+    s->stats.devices++;
+    /* the device resolves the links waiting for it first, so links to itself resolve as well */
+    memset(&self, 0, sizeof(self));
+    if (key.type) {
+        self.guid = key.guid;
+        self.key_type = key.type;
+        self.devguid = node->devguid;
+        self.portguid = node->portguid;
+        self.type = node->type;
+        /* a later device with the same GUID replaces the one before, as in the GUID table of a
+         * file parse, links written already keep the one they were resolved to */
+        if (!hashmap_set(s->seen, &self) && hashmap_oom(s->seen)) {
+            return false;
+        }
+        struct peer_entry *e = get_entry(s, key);
+        if (e) {
+            waiters = e->waiters;
+            hashmap_delete(s->peers, e);
+        }
+    }
+    while (waiters) {
+        struct waiter *w = waiters;
+        waiters = w->next;
+        resolve(w->dev, w->edge, &self);
+        s->stats.waiting_links--;
+        if (--w->dev->unresolved == 0) {
+            emit(s, w->dev);
+        }
+        free(w);
+    }
+
+    struct stream_device *d = malloc(sizeof(struct stream_device) +
+                                     (size_t) nedges * (sizeof(struct topo_edge) + sizeof(struct topo_node)));
+    if (!d) {
+        return false;
+    }
+    memset(d, 0, sizeof(*d));
+    d->node = *node;
+    d->nedges = nedges;
+    d->peers = (struct topo_node *) (d + 1);
+    d->edges = (struct topo_edge *) (d->peers + nedges);
+    memset(d->peers, 0, (size_t) nedges * sizeof(struct topo_node));
+    memcpy(d->edges, edges, (size_t) nedges * sizeof(struct topo_edge));
+    for (uint32_t i = 0; i < nedges; i++) {
+        d->edges[i].peer = -1;
+        if (!link_keys[i].type) {
+            continue; /* nothing to wait for, it stays unresolved */
+        }
+        const struct peer_record *r = get_record(s, link_keys[i]);
+        if (r) {
+            resolve(d, i, r);
+            continue;
+        }
+        struct peer_entry *e = get_or_add_entry(s, link_keys[i]);
+        if (!e) {
+            free(d);
+            return false;
+        }
+        struct waiter *w = malloc(sizeof(struct waiter));
+        if (!w) {
+            free(d);
+            return false;
+        }
+        w->dev = d;
+        w->edge = i;
+        w->next = e->waiters;
+        e->waiters = w;
+        d->unresolved++;
+        s->stats.waiting_links++;
+    }
+    if (s->stats.waiting_links > s->stats.peak_waiting_links) {
+        s->stats.peak_waiting_links = s->stats.waiting_links;
+    }
+    if (d->unresolved == 0) {
+        emit(s, d);
+        return !s->failed;
+    }
+    d->prev = s->tail;
+    if (s->tail) {
+        s->tail->next = d;
+    } else {
+        s->head = d;
+    }
+    s->tail = d;
+    if (++s->stats.waiting_devices > s->stats.peak_waiting_devices) {
+        s->stats.peak_waiting_devices = s->stats.waiting_devices;
+    }
+    return !s->failed;
+}
+
+void stream_get_stats(struct stream *s, struct stream_stats *stats) {
+    *stats = s->stats;
+}
+
+/* stream_finish writes the devices still waiting, in file order, with links to devices
+ * the input never described left unresolved, and frees the stream
+ * */
+bool stream_finish(struct stream *s) {
+    size_t iter = 0;
+    void *item;
+    while (hashmap_iter(s->peers, &iter, &item)) {
+        struct waiter *w = ((struct peer_entry *) item)->waiters;
+        while (w) {
+            struct waiter *next = w->next;
+            free(w);
+            w = next;
+        }
+    }
+    hashmap_free(s->peers);
+    hashmap_free(s->seen);
+    while (s->head) {
+        emit(s, s->head);
+    }
+    flush_buffer(s);
+    bool ok = !s->failed;
+    free(s->buf);
+    free(s);
+    return ok;
+}
@@ -0,0 +1,39 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "topo.h"
+
+/* node GUID a device is known by, type is 0 if the GUID could not be read */
+struct stream_key {
+    uint64_t guid;
+    char type;
+};
+
+/* text dump written while the topology is being read: a device is written as soon as
+ * the devices its links point to are known, only devices waiting for peers are kept,
+ * of the others a record of what links print of them
+ * */
+struct stream;
+
+struct stream_stats {
+    size_t devices;
+    size_t waiting_devices;
+    size_t peak_waiting_devices;
+    size_t waiting_links;
+    size_t peak_waiting_links;
+    size_t peak_peers; /* devices links were waiting for at once */
+};
+
+struct stream *stream_new(int fd);
+
+bool stream_add(struct stream *s, const struct topo_node *node, struct stream_key key,
+                const struct topo_edge *edges, const struct stream_key *link_keys, uint32_t nedges);
+
+void stream_get_stats(struct stream *s, struct stream_stats *stats);
+
+bool stream_finish(struct stream *s);
+
+#endif
@@ -0,0 +1,417 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "hash.h"
+#include "digits.h"
+#include "topo.h"
+
+#define SNAPSHOT_MAGIC "TOPOSNAP"
+#define SNAPSHOT_VERSION 3
+#define SNAPSHOT_ALIGN 8
+
+/*
+ * Snapshot layout, all integers are in native byte order and every section
+ * starts at a SNAPSHOT_ALIGN boundary:
+ *
+ *   struct snapshot_header
+ *   struct topo_node  nodes[ndevices]
+ *   uint32_t          offsets[ndevices + 1]
+ *   struct topo_edge  edges[nedges]
+ *   char              strings[strings_size]
+ *
+ * The sections are the arrays of struct topo_graph as they are, so a mapped
+ * snapshot is used in place.
+ */
+struct snapshot_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t node_size;
+    uint32_t edge_size;
+    uint32_t ndevices;
+    uint32_t nedges;
+    uint64_t nodes_off;
+    uint64_t offsets_off;
+    uint64_t edges_off;
+    uint64_t strings_off;
+    uint64_t strings_size;
+    uint64_t strings_appended;
+    uint64_t file_size;
+};
+
+struct pool_entry {
+    uint64_t hash;
+    uint32_t offset;
+    uint32_t len;
+};
+
+struct string_pool {
+    char *data;
+    uint32_t size;
+    uint32_t cap;
+    bool oom;
+    struct hashmap *index;
+};
+
+static uint64_t pool_entry_hash(const void *item, uint64_t seed0, uint64_t seed1) {
+    (void) seed0;
+    (void) seed1;
+    return ((const struct pool_entry *) item)->hash;
+}
+
+static int pool_entry_compare(const void *a, const void *b, void *udata) {
+    const struct pool_entry *ea = a, *eb = b;
+    const struct string_pool *pool = udata;
+    if (ea->len != eb->len) {
+        return 1;
+    }
+    return memcmp(pool->data + ea->offset, pool->data + eb->offset, ea->len);
+}
+
+/* string_pool_new returns an empty pool holding only the empty string at offset 0 */
+struct string_pool *string_pool_new(void) {
+    return string_pool_new_from("", 1);
+}
+
+/* string_pool_new_from returns a pool starting with a copy of size bytes of pooled strings, which keep
+ * their offsets. They are not looked up by string_pool_add(), strings added later are pooled among themselves
+ * */
+struct string_pool *string_pool_new_from(const char *strings, uint32_t size) {
+    struct string_pool *pool = calloc(1, sizeof(struct string_pool));
+    if (!pool) {
+        return NULL;
+    }
+    pool->cap = 4096;
+    while (pool->cap < size + size / 16) {
+        pool->cap *= 2;
+    }
+    pool->data = malloc(pool->cap);
+    pool->index = hashmap_new(sizeof(struct pool_entry), 0, 0, 0,
+                              pool_entry_hash, pool_entry_compare, NULL, pool);
+    if (!pool->data || !pool->index) {
+        free(pool->data);
+        hashmap_free(pool->index);
+        free(pool);
+        return NULL;
+    }
+    memcpy(pool->data, strings, size);
+    pool->size = size;
+    return pool;
+}
+
+/* string_pool_add returns the offset of s in the pool, adding it if it is not there yet,
+ * on allocation failure 0 is returned and string_pool_oom() returns true
+ * */
+uint32_t string_pool_add(struct string_pool *pool, const char *s) {
+    struct pool_entry entry, *found;
+    size_t len = strlen(s);
+    if (len == 0) {
+        return 0;
+    }
+    if (pool->size + len + 1 > pool->cap) {
+        uint32_t cap = pool->cap;
+        while (pool->size + len + 1 > cap) {
+            cap *= 2;
+        }
+        char *data = realloc(pool->data, cap);
+        if (!data) {
+            pool->oom = true;
+            return 0;
+        }
+        pool->data = data;
+        pool->cap = cap;
+    }
+    /* the string is put at the end of the pool, it stays there only if it was not seen before */
+    memcpy(pool->data + pool->size, s, len + 1);
+    entry.hash = hashmap_murmur(s, len, 0, 0);
+    entry.offset = pool->size;
+    entry.len = (uint32_t) len;
+    found = hashmap_get(pool->index, &entry);
+    if (found) {
+        return found->offset;
+    }
+    hashmap_set(pool->index, &entry);
+    if (hashmap_oom(pool->index)) {
+        pool->oom = true;
+        return 0;
+    }
+    pool->size += (uint32_t) len + 1;
+    return entry.offset;
+}
+
+/* string_pool_str returns the string of the pool at offset, it is valid until the next string_pool_add() */
+const char *string_pool_str(const struct string_pool *pool, uint32_t offset) {
+    return pool->data + offset;
+}
+
+/* string_pool_oom returns true if adding a string to the pool has failed */
+bool string_pool_oom(struct string_pool *pool) {
+    return pool->oom;
+}
+
+/* string_pool_release frees the pool and returns its strings, which are to be released with free() */
+char *string_pool_release(struct string_pool *pool, uint32_t *size) {
+    char *data = pool->data;
+    *size = pool->size;
+    hashmap_free(pool->index);
+    free(pool);
+    return data;
+}
+
+static uint64_t align_up(uint64_t off) {
+    return (off + SNAPSHOT_ALIGN - 1) & ~(uint64_t) (SNAPSHOT_ALIGN - 1);
+}
+
+static bool write_section(FILE *file, uint64_t *pos, uint64_t off, const void *data, size_t size) {
+    static const char zeros[SNAPSHOT_ALIGN] = {0};
+    if (off > *pos && fwrite(zeros, 1, (size_t) (off - *pos), file) != off - *pos) {
+        return false;
+    }
+    if (size > 0 && fwrite(data, 1, size, file) != size) {
+        return false;
+    }
+    *pos = off + size;
+    return true;
+}
+
+/* snapshot_write saves the graph to file_name, the file is replaced atomically */
+bool snapshot_write(const char *file_name, const struct topo_graph *g) {
+    struct snapshot_header hdr;
+    char tmp_name[4096];
+    uint64_t pos = 0;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SNAPSHOT_MAGIC, sizeof(hdr.magic));
+    hdr.version = SNAPSHOT_VERSION;
+    hdr.header_size = sizeof(hdr);
+    hdr.node_size = sizeof(struct topo_node);
+    hdr.edge_size = sizeof(struct topo_edge);
+    hdr.ndevices = g->ndevices;
+    hdr.nedges = g->nedges;
+    hdr.nodes_off = align_up(sizeof(hdr));
+    hdr.offsets_off = align_up(hdr.nodes_off + (uint64_t) g->ndevices * sizeof(struct topo_node));
+    hdr.edges_off = align_up(hdr.offsets_off + ((uint64_t) g->ndevices + 1) * sizeof(uint32_t));
+    hdr.strings_off = align_up(hdr.edges_off + (uint64_t) g->nedges * sizeof(struct topo_edge));
+    hdr.strings_size = g->strings_size;
+    hdr.strings_appended = g->strings_appended;
+    hdr.file_size = hdr.strings_off + hdr.strings_size;
+
+    if (snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", file_name) >= (int) sizeof(tmp_name)) {
+        return false;
+    }
+    FILE *file = fopen(tmp_name, "w");
+    if (file == NULL) {
+        return false;
+    }
+    bool ok = write_section(file, &pos, 0, &hdr, sizeof(hdr)) &&
+              write_section(file, &pos, hdr.nodes_off, g->nodes, g->ndevices * sizeof(struct topo_node)) &&
+              write_section(file, &pos, hdr.offsets_off, g->offsets, (g->ndevices + 1) * sizeof(uint32_t)) &&
+              write_section(file, &pos, hdr.edges_off, g->edges, g->nedges * sizeof(struct topo_edge)) &&
+              write_section(file, &pos, hdr.strings_off, g->strings, g->strings_size);
+    if (fclose(file) != 0) {
+        ok = false;
+    }
+    if (!ok || rename(tmp_name, file_name) != 0) {
+        unlink(tmp_name);
+        return false;
+    }
+    return true;
+}
+
+/* checking that a mapped snapshot is complete and its indices stay inside of it */
+static bool snapshot_valid(const struct snapshot_header *hdr, size_t size) {
+    if (size < sizeof(*hdr) || memcmp(hdr->magic, SNAPSHOT_MAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->version != SNAPSHOT_VERSION || hdr->header_size != sizeof(*hdr) ||
+        hdr->node_size != sizeof(struct topo_node) || hdr->edge_size != sizeof(struct topo_edge) ||
+        hdr->file_size != size) {
+        return false;
+    }
+    if (hdr->nodes_off % SNAPSHOT_ALIGN || hdr->offsets_off % SNAPSHOT_ALIGN || hdr->edges_off % SNAPSHOT_ALIGN ||
+        hdr->nodes_off + (uint64_t) hdr->ndevices * sizeof(struct topo_node) > hdr->offsets_off ||
+        hdr->offsets_off + ((uint64_t) hdr->ndevices + 1) * sizeof(uint32_t) > hdr->edges_off ||
+        hdr->edges_off + (uint64_t) hdr->nedges * sizeof(struct topo_edge) > hdr->strings_off ||
+        hdr->strings_off + hdr->strings_size > size || hdr->strings_size == 0 || hdr->strings_size > UINT32_MAX ||
+        hdr->strings_appended > hdr->strings_size) {
+        return false;
+    }
+    const char *base = (const char *) hdr;
+    const struct topo_node *nodes = (const struct topo_node *) (base + hdr->nodes_off);
+    const uint32_t *offsets = (const uint32_t *) (base + hdr->offsets_off);
+    const struct topo_edge *edges = (const struct topo_edge *) (base + hdr->edges_off);
+    const char *strings = base + hdr->strings_off;
+    if (strings[hdr->strings_size - 1] != '\0' || offsets[0] != 0 || offsets[hdr->ndevices] != hdr->nedges) {
+        return false;
+    }
+    for (uint32_t i = 0; i < hdr->ndevices; i++) {
+        if (offsets[i] > offsets[i + 1] || nodes[i].name >= hdr->strings_size || nodes[i].desc >= hdr->strings_size) {
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < hdr->nedges; i++) {
+        const struct topo_edge *e = &edges[i];
+        if (e->peer < -1 || e->peer >= (int64_t) hdr->ndevices ||
+            e->node_guid >= hdr->strings_size || e->port_guid >= hdr->strings_size ||
+            e->desc >= hdr->strings_size || e->speed >= hdr->strings_size) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* snapshot_map maps snapshot file_name read-only and points the arrays of g into it,
+ * g stays valid until snapshot_unmap()
+ * */
+bool snapshot_map(const char *file_name, struct topo_graph *g, struct topo_snapshot *snap) {
+    struct stat st;
+    int fd = open(file_name, O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+    if (fstat(fd, &st) == -1 || st.st_size < (off_t) sizeof(struct snapshot_header)) {
+        close(fd);
+        return false;
+    }
+    void *base = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return false;
+    }
+    const struct snapshot_header *hdr = base;
+    if (!snapshot_valid(hdr, (size_t) st.st_size)) {
+        munmap(base, (size_t) st.st_size);
+        return false;
+    }
+    g->ndevices = hdr->ndevices;
+    g->nedges = hdr->nedges;
+    g->nodes = (struct topo_node *) ((char *) base + hdr->nodes_off);
+    g->offsets = (uint32_t *) ((char *) base + hdr->offsets_off);
+    g->edges = (struct topo_edge *) ((char *) base + hdr->edges_off);
+    g->strings = (const char *) base + hdr->strings_off;
+    g->strings_size = (uint32_t) hdr->strings_size;
+    g->strings_appended = (uint32_t) hdr->strings_appended;
+    snap->base = base;
+    snap->size = (size_t) st.st_size;
+    return true;
+}
+
+/* snapshot_unmap releases the mapping made by snapshot_map() */
+void snapshot_unmap(struct topo_snapshot *snap) {
+    if (snap->base) {
+        munmap(snap->base, snap->size);
+        snap->base = NULL;
+        snap->size = 0;
+    }
+}
+
+/* node GUID of a device name, "S-<hex>" or "H-<hex>" */
+static bool name_guid(const char *name, uint64_t *guid, char *type) {
+    if ((name[0] != 'S' && name[0] != 'H') || name[1] != '-' || !hex_decode(name + 2, strlen(name + 2), guid)) {
+        return false;
+    }
+    *type = name[0];
+    return true;
+}
+
+static uint64_t guid_ref_hash(const void *item, uint64_t seed0, uint64_t seed1) {
+    const struct topo_guid_ref *r = item;
+    return hashmap_murmur(&r->guid, sizeof(r->guid), seed0, seed1) ^ (uint64_t) (unsigned char) r->type;
+}
+
+static int guid_ref_compare(const void *a, const void *b, void *udata) {
+    const struct topo_guid_ref *ra = a;
+    const struct topo_guid_ref *rb = b;
+    (void)udata;
+    if (ra->guid != rb->guid) {
+        return (ra->guid < rb->guid) ? -1 : 1;
+    }
+    return ra->type - rb->type;
+}
+
+/* guid_index_build indexes the devices of g by node GUID, NULL if there is no memory for it.
+ * The last device with a GUID wins, as links of the dump resolve to it
+ * */
+struct hashmap *guid_index_build(const struct topo_graph *g) {
+    struct hashmap *index = hashmap_new(sizeof(struct topo_guid_ref), 0, 0, 0, guid_ref_hash, guid_ref_compare,
+                                        NULL, NULL);
+    if (!index || !hashmap_reserve(index, g->ndevices)) {
+        hashmap_free(index);
+        return NULL;
+    }
+    for (uint32_t i = 0; i < g->ndevices; i++) {
+        struct topo_guid_ref ref;
+        /* the padding is saved with the index too */
+        memset(&ref, 0, sizeof(ref));
+        ref.index = i;
+        if (name_guid(TOPO_STR(g, g->nodes[i].name), &ref.guid, &ref.type)) {
+            hashmap_set(index, &ref);
+        }
+    }
+    if (hashmap_oom(index)) {
+        hashmap_free(index);
+        return NULL;
+    }
+    return index;
+}
+
+/* guid_index_write saves the GUID index of g to file_name, the file is replaced atomically */
+bool guid_index_write(const char *file_name, const struct topo_graph *g) {
+    char tmp_name[4096];
+    if (snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", file_name) >= (int) sizeof(tmp_name)) {
+        return false;
+    }
+    struct hashmap *index = guid_index_build(g);
+    if (!index) {
+        return false;
+    }
+    int fd = open(tmp_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool ok = fd != -1 && hashmap_save(index, fd);
+    if (fd != -1 && close(fd) != 0) {
+        ok = false;
+    }
+    hashmap_free(index);
+    if (!ok || rename(tmp_name, file_name) != 0) {
+        unlink(tmp_name);
+        return false;
+    }
+    return true;
+}
+
+/* guid_index_map maps the GUID index of g saved in file_name, read-only and without rebuilding it,
+ * NULL if there is none or it cannot be of g. It is released with hashmap_free()
+ * */
+struct hashmap *guid_index_map(const char *file_name, const struct topo_graph *g) {
+    int fd = open(file_name, O_RDONLY);
+    if (fd == -1) {
+        return NULL;
+    }
+    struct hashmap *index = hashmap_map_readonly(fd, guid_ref_hash, guid_ref_compare, NULL);
+    close(fd);
+    if (index && hashmap_count(index) > g->ndevices) {
+        hashmap_free(index);
+        return NULL;
+    }
+    return index;
+}
+
+/* guid_index_find returns the device of g with node GUID guid of type, NULL if there is none.
+ * A device whose name in g is not that GUID is not returned, the index may be left from another run
+ * */
+const struct topo_guid_ref *guid_index_find(struct hashmap *index, const struct topo_graph *g, uint64_t guid,
+                                            char type) {
+    struct topo_guid_ref key, named;
+    memset(&key, 0, sizeof(key));
+    key.guid = guid;
+    key.type = type;
+    const struct topo_guid_ref *ref = hashmap_get(index, &key);
+    if (!ref || ref->index >= g->ndevices ||
+        !name_guid(TOPO_STR(g, g->nodes[ref->index].name), &named.guid, &named.type) ||
+        named.guid != guid || named.type != type) {
+        return NULL;
+    }
+    return ref;
+}
@@ -0,0 +1,118 @@
+#ifndef TOPO_H
+#define TOPO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* device types */
+typedef enum {
+    SW, CADAPTER
+} DEV_TYPE;
+/* base port types */
+typedef enum {
+    ENHANCED, BASE
+} PORT_TYPE;
+
+/* device of the finalized topology, plain fixed-width data without pointers,
+ * strings are offsets into the string pool of the graph
+ * */
+struct topo_node {
+    uint64_t sysimgguid;
+    uint64_t devguid;
+    uint64_t portguid; /* port GUID of switches, "switchguid=0x<devguid>(<portguid>)" */
+    uint64_t block_hash; /* hash of the device block of the topology file, 0 if unknown */
+    uint32_t vid;
+    uint32_t did;
+    int32_t ports_total;
+    int32_t base_port_no;
+    int32_t lid;
+    int32_t lmc;
+    uint32_t name; /* node GUID string, "S-<guid>" or "H-<guid>" */
+    uint32_t desc;
+    uint8_t type; /* DEV_TYPE */
+    uint8_t base_port_type; /* PORT_TYPE */
+    uint8_t pad[6];
+};
+
+/* link from a device to a port of its peer */
+struct topo_edge {
+    int32_t peer; /* index of the remote device, -1 if the topology does not describe it */
+    int32_t lport;
+    int32_t rport;
+    int32_t llid;
+    int32_t llmc;
+    int32_t rlid;
+    uint32_t node_guid; /* remote node GUID string as written in the line */
+    uint32_t port_guid;
+    uint32_t desc;
+    uint32_t speed;
+    uint8_t remote_type; /* DEV_TYPE of the remote GUID as written in the line ("S-" or "H-") */
+    uint8_t pad[7];
+};
+
+/* topology in compressed sparse row form,
+ * edges of device i are edges[offsets[i]] .. edges[offsets[i + 1] - 1]
+ * */
+struct topo_graph {
+    uint32_t ndevices;
+    uint32_t nedges;
+    struct topo_node *nodes;
+    uint32_t *offsets; /* ndevices + 1 entries */
+    struct topo_edge *edges;
+    const char *strings; /* NUL-terminated strings, offset 0 is the empty string */
+    uint32_t strings_size;
+    uint32_t strings_appended; /* bytes added by --incremental runs since the strings were pooled from scratch */
+};
+
+/* string of the graph at pool offset */
+#define TOPO_STR(g, off) ((g)->strings + (off))
+
+/* deduplicating storage for the strings of a graph */
+struct string_pool;
+
+struct string_pool *string_pool_new(void);
+
+struct string_pool *string_pool_new_from(const char *strings, uint32_t size);
+
+uint32_t string_pool_add(struct string_pool *pool, const char *s);
+
+const char *string_pool_str(const struct string_pool *pool, uint32_t offset);
+
+bool string_pool_oom(struct string_pool *pool);
+
+char *string_pool_release(struct string_pool *pool, uint32_t *size);
+
+/* graph saved as binary snapshot and mapped back */
+struct topo_snapshot {
+    void *base;
+    size_t size;
+};
+
+bool snapshot_write(const char *file_name, const struct topo_graph *g);
+
+bool snapshot_map(const char *file_name, struct topo_graph *g, struct topo_snapshot *snap);
+
+void snapshot_unmap(struct topo_snapshot *snap);
+
+/* device of a graph by its node GUID, the GUID index of a snapshot is saved next to it
+ * and mapped back with the snapshot, lookups then need no rebuilding
+ * */
+struct topo_guid_ref {
+    uint64_t guid;
+    uint32_t index;
+    char type; /* 'S' or 'H' */
+};
+
+struct hashmap;
+
+struct hashmap *guid_index_build(const struct topo_graph *g);
+
+bool guid_index_write(const char *file_name, const struct topo_graph *g);
+
+struct hashmap *guid_index_map(const char *file_name, const struct topo_graph *g);
+
+const struct topo_guid_ref *guid_index_find(struct hashmap *index, const struct topo_graph *g, uint64_t guid,
+                                            char type);
+
+#endif
@@ -0,0 +1,114 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include "watch.h"
+
+/* the directory is watched, a file renamed over the watched one is a new inode */
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO)
+
+struct watch {
+    int fd;
+    char *name; /* file name within the directory */
+};
+
+struct watch *watch_new(const char *path) {
+    struct watch *w = calloc(1, sizeof(struct watch));
+    char *dir = strdup(path);
+    if (!w || !dir) {
+        free(w);
+        free(dir);
+        return NULL;
+    }
+    char *slash = strrchr(dir, '/');
+    w->name = strdup(slash ? slash + 1 : path);
+    if (slash) {
+        slash[slash == dir] = '\0'; /* "/file" is watched in "/" */
+    }
+    w->fd = inotify_init1(IN_CLOEXEC);
+    if (!w->name || w->fd == -1 || inotify_add_watch(w->fd, slash ? dir : ".", WATCH_EVENTS) == -1) {
+        if (w->fd != -1) {
+            close(w->fd);
+        }
+        free(w->name);
+        free(w);
+        free(dir);
+        return NULL;
+    }
+    free(dir);
+    return w;
+}
+
+/* reading the pending events, true if one of them is about the file */
+static bool read_events(struct watch *w, int *error) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool hit = false;
+    ssize_t n = read(w->fd, buf, sizeof(buf));
+    if (n <= 0) {
+        *error = (n == 0 || errno != EINTR);
+        return false;
+    }
+    for (char *p = buf; p < buf + n;) {
+        struct inotify_event *ev = (struct inotify_event *) p;
+        if (ev->len && !strcmp(ev->name, w->name)) {
+            hit = true;
+        }
+        p += sizeof(struct inotify_event) + ev->len;
+    }
+    return hit;
+}
+
+static long int now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* watch_wait blocks until the file was written and closed, or another file was renamed to it,
+ * and then until it was left alone for settle_ms, so a writer that closes and opens the file
+ * again is waited for. 1 is returned then, 0 if a signal came first, -1 if the watch failed
+ * */
+int watch_wait(struct watch *w, int settle_ms) {
+    struct pollfd pfd = {.fd = w->fd, .events = POLLIN, .revents = 0};
+    int error = 0;
+    do {
+        if (poll(&pfd, 1, -1) < 0) {
+            return (errno == EINTR) ? 0 : -1;
+        }
+    } while (!read_events(w, &error) && !error);
+    if (error) {
+        return -1;
+    }
+    long int deadline = now_ms() + settle_ms;
+    for (;;) {
+        long int left = deadline - now_ms();
+        int n = poll(&pfd, 1, left > 0 ? (int) left : 0);
+        if (n == 0) {
+            return 1;
+        }
+        if (n < 0) {
+            return (errno == EINTR) ? 0 : -1;
+        }
+        /* events of other files of the directory do not delay the parse */
+        if (n > 0 && read_events(w, &error)) {
+            deadline = now_ms() + settle_ms;
+        }
+        if (error) {
+            return -1;
+        }
+    }
+}
+
+void watch_free(struct watch *w) {
+    if (w) {
+        close(w->fd);
+        free(w->name);
+        free(w);
+    }
+}
@@ -0,0 +1,13 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+/* waiting for a file to be rewritten, either in place or by renaming a new file over it */
+struct watch;
+
+struct watch *watch_new(const char *path);
+
+int watch_wait(struct watch *w, int settle_ms);
+
+void watch_free(struct watch *w);
+
+#endif